@@ -2,11 +2,17 @@
  * This code solves the 'IBM Ponder this' challenge from March 2024
  * See: research.ibm.com/haifa/ponderthis/challenges/March2024.html
  *
- * The algorithm uses a prime generator library.
+ * The search itself is done by libponder (Algorithm 1 engine, see
+ *  libponder/ponder.c), this code only handles the command line,
+ *  checkpoints, proofs and the verification of the answer.
+ * libponder uses a prime generator library.
  * It can be found at github.com/kimwalisch/primesieve/tree/master
  * and has to be installed before compiling.
  *
- * Usage: Usage: IBM_ponder_2024-03_1 [-v] [-m memSize] [-s startValue] n
+ * Usage: Usage: IBM_ponder_2024-03_1 [-v] [-m memSize] [-s startValue] [-k mult]
+ *                                    [-c checkpointFile [-C seconds] [-r]] [-p proofFile]
+ *                                    [-j reportFile [-P]] [-M metricsFile] [-E estimate]
+ *                                    [-T traceFile] n
  *  Options:
  *   -v
  *		verbose mode. Print information during the search.
@@ -20,6 +26,51 @@
  *		lower bound for the true correct value is known as it will
  *		save search time.
  *
+ *   -k mult
+ *		Step multiplier: the sequence is a_i = a_{i-1} + mult*f(i)
+ *		(default is 1). f is chosen when compiling, see common/ponder_step.h
+ *
+ *   -c checkpointFile
+ *		Saves the progress of the search in checkpointFile every
+ *		'seconds' seconds (see -C) and when interrupted by SIGINT or
+ *		SIGTERM.
+ *
+ *   -C seconds
+ *		Minimum time between two checkpoints (default is 60).
+ *
+ *   -r, --resume
+ *		Restarts the search where the checkpoint file says it stopped.
+ *
+ *   -p proofFile
+ *		Writes a minimality proof in proofFile: for each value ruled
+ *		out, the index of the term hit by the prime that ruled it out
+ *		(see common/ponder_proof.h). It can be checked with
+ *		IBM_ponder_2024-03_proofcheck. Not compatible with -c.
+ *
+ *   -j reportFile
+ *		Writes a JSON report of the run in reportFile ("-" for the
+ *		standard output), see common/ponder_report.h.
+ *
+ *   -P
+ *		With -j, also measures hardware counters (cycles, instructions,
+ *		last level cache, data TLB and branch misses) of each phase and
+ *		each thread with Linux perf events (see common/ponder_perf.h).
+ *
+ *   -M metricsFile
+ *		Rewrites live metrics of the search (offset, lower bound, rate,
+ *		ETA...) in metricsFile every 10 seconds, in the text format of
+ *		Prometheus (see common/ponder_metrics.h). A snapshot is also
+ *		printed on stderr when the process receives SIGUSR1.
+ *
+ *   -E estimate
+ *		Estimated answer, used for the ETA of the metrics.
+ *
+ *   -T traceFile
+ *		Records a timeline of the run (window fills, tests of each thread
+ *		and their waits at the end of windows, verifications, checkpoints)
+ *		and writes it at exit in traceFile, in the Chrome trace event
+ *		format (chrome://tracing or ui.perfetto.dev).
+ *
  ********************************************************************/
 
  
@@ -29,138 +80,105 @@
 #include <stdint.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <getopt.h>
 
-#include <primesieve.h>
+#include "../common/ponder_step.h"
+#include "../common/ponder_verify.h"
+#include "../common/ponder_checkpoint.h"
+#include "../common/ponder_proof.h"
+#include "../common/ponder_report.h"
+#include "../common/ponder_metrics.h"
+#include "../libponder/ponder.h"
 
-// Function prototypes
-void initArray(int_fast64_t size);
-int_fast64_t processArray(int_fast64_t offset, int_fast64_t startValueIndex,
-                          int_fast64_t n, int_fast64_t size);
-int_fast64_t look4StartValue(int_fast64_t startValue, int_fast64_t n, int_fast64_t size);
-int_fast64_t CheckSequence(int_fast64_t initialValue, int_fast64_t n, int *iter);
+int verbose = 0; // Do we want some information while program is running?
 
-/* This iterator is used by the primesieve library to generate primes
- *  one after the other.
- */
-primesieve_iterator it;
+/* Live metrics (see -M and -E options) */
+char *metricsFile = NULL;
+ponder_u128 estimate = 0;
+ponderMetrics metrics;
 
-/* Global array representing each tested number */
-char *numberArray = NULL;
+/* Timeline trace (see -T option) */
+#define TRACE_EVENTS 65536   /* last events kept for each thread */
+char *traceFile = NULL;
 
-int verbose = 0; // Do we want some information while program is running?
+/* Checkpoints (see -c, -C and -r options) */
+char *checkpointFile = NULL;
+int checkpointInterval = 60;
+ponderCheckpoint checkpoint;
+time_t lastCheckpoint;
 
-/* Allocates (if not already done) an array of char of the given size.
- * This array represent each tested number. Each element is set to one
- * until it is ruled out by the algorithm (and then switched to zero).
+/* Minimality proof (see -p option) */
+FILE *proofFile = NULL;
+
+/* Saves the progress of the search: every integer below value
+ *  has been ruled out.
  */
-void initArray(int_fast64_t size) {
-	if (!numberArray) {
-		numberArray = malloc(sizeof(char) * size);
-		if (!numberArray) {
-			printf("ERROR: cannot allocate enough memory for numbers array.\n");
-			exit(1);
-		}
-	}
-	if (verbose)
-		printf("Initializing numbers array...\n");
-	for (int_fast64_t i = 0; i < size; i++)
-		numberArray[i] = 1;
-	if (verbose)
-		printf("Allocation done !\n");
+void saveCheckpoint(int_fast64_t value) {
+	uint64_t trace = ponderTraceClock();
+	int written;
+	checkpoint.offset = value;
+	checkpoint.carry = 0;
+	written = writeCheckpoint(checkpointFile, &checkpoint);
+	ponderTraceEvent(0, "checkpoint", trace, -1);
+	if (!written)
+		printf("WARNING: cannot write checkpoint file %s.\n", checkpointFile);
+	else if (verbose)
+		printf("Checkpoint written at %" PRIdFAST64 "\n", value);
 }
 
-/* This is the function that does the job of eliminating integers that cannot be 
- * the initial value of the sequence. It does so by generating primes and 
- * working backwards: if p is prime, p-1, p-1-2, p-1-2-3... cannot be 
- * an correct initial value for the sequence.
- * - the global 'numberArray' is used to keep track of which integer
- *   has been eliminated, 'size' is the size of this array.
- *   If numberArray[i] == 0, it means that integer has been crossed out.
- * - That array may not be large enough for all the integers we want to try, 
- *   so blocks of integers are tested one after the other. That means element 0
- *   of the array does not represent integer 0 but rather integer of value 'offset'.
- * - 'startValueIndex' is the index from which to generate primes.
- *    If we want to check a new array (starting at real value offset), this index
- *    will be 0 but we may know that none of the first integers can be a correct initial
- *    value so we may start at an larger index.
- * - n is of course the sequence desired index. Small remark: we have n-1 iterations
- *   to do.`
- * If a correct initial value is found (ie: no tested prime has eliminated it),
- *  the function will return its index in the array (so the real value is index+offset).
- * If all integers have been ruled out, the function returns -1.
- */
- int_fast64_t processArray(int_fast64_t offset, int_fast64_t startValueIndex,
-                           int_fast64_t n, int_fast64_t size) {
-
-	int_fast64_t possibleStartIndex = startValueIndex;
-	int_fast64_t primeCounter = 0;
-	n--; /* There are in fact n-1 additions to do */
-	int_fast64_t upperBoundDiff = n*(n+1)/2; // no need to test above
-	int_fast64_t lastPrime, offsetPrime, initialOffsetPrime, i;
-
-	// Start again from the first prime after the initial value (which is offset)
-	primesieve_jump_to(&it, offset + startValueIndex, offset + size + 2*upperBoundDiff);
-		
-	do {
-		primeCounter++;
-		lastPrime = primesieve_next_prime(&it);
-		if (verbose && !(primeCounter & 0xFFFFF))
-			// print tested prime once in a while
-			printf("Testing Prime=%" PRIdFAST64 "\n", lastPrime);
-		offsetPrime = initialOffsetPrime = lastPrime - offset;
-		i = 0;
-		while (i <= n) { // rule out integers backwards
-			offsetPrime -= (i++);
-			if (offsetPrime < 0)
-				break;
-			if (offsetPrime >= size)
-				continue;
-			numberArray[offsetPrime] = 0;
-		}
-		// If the possible correct value has been rules out, find the smallest new one
-		if (!numberArray[possibleStartIndex]) {
-			do {
-				possibleStartIndex++;
-			} while ((possibleStartIndex < size) &&	!numberArray[possibleStartIndex]);
-			if (possibleStartIndex == size)
-				return -1; // We have cleared all array
-		}
-	} while ((possibleStartIndex + upperBoundDiff) >= initialOffsetPrime);
-	return possibleStartIndex;
+/* Called by libponder after each block of integers */
+int searchProgress(void *userData, ponder_u128 watermark, const ponderStats *stats) {
+	(void) userData;
+	if (verbose)
+		printf("Every value below %" PRIdFAST64 " has been ruled out (%" PRIdFAST64 " primes).\n",
+		       (int_fast64_t) watermark, stats->primes);
+	if (checkpointFile && checkpointDue(&lastCheckpoint, checkpointInterval))
+		saveCheckpoint(watermark);
+	metricsUpdate(&metrics, watermark, stats);
+	return 0;
 }
 
-/* This function calls the previous one which will test all integers in the 
- *  current block array. If no possible starting value is found, a new array is used,
- *  representing the next block of integer, so startValue is increased by the size
- *  of the array.
- */
-int_fast64_t look4StartValue(int_fast64_t startValue, int_fast64_t n, int_fast64_t size) {
-	int_fast64_t correctStartIndex;
-		
-	while (1) {
-		initArray(size);
-		correctStartIndex = processArray(startValue, 0 , n, size);
-		if (correctStartIndex >= 0) // Value is found!
-			return correctStartIndex + startValue;
-		else {
-			if (verbose)
-				printf("Numbers array is full, using new one.\n");
-			startValue += size;
-		}
+/* Called by libponder with the killers of the next integers */
+void searchProof(void *userData, const uint32_t *indices, int_fast64_t count) {
+	(void) userData;
+	if (!appendProof(proofFile, indices, count)) {
+		printf("ERROR: cannot write proof file.\n");
+		exit(1);
 	}
 }
 
+/* Called at exit: writes the timeline trace, if one has been asked for */
+void writeTrace(void) {
+	if (traceFile && !ponderTraceWrite(traceFile))
+		printf("WARNING: cannot write trace file %s.\n", traceFile);
+}
+
 /* Main function:
- *  check arguments, initialize prime generator, compute correct start value
+ *  check arguments, compute correct start value with libponder
  *  and check its correctness.
 */
 int main(int argc, char **argv) {
-	int_fast64_t n;
+	int_fast64_t n, stepK = 1;
 	int_fast64_t memSize = 10000000L; // default memory size of 10 millions
 	int_fast64_t startValue = 0;
+	char *proofFileName = NULL;
+	char *reportFile = NULL;
+	ponderReport report;
+	int perfCounters = 0;
+	uint64_t trace;
+	ponderParams params;
+	ponderContext *ctx;
+	ponder_u128 value;
+	ponderStatus status;
+	int resume = 0;
 	int c;
+	static struct option longOptions[] = {
+		{ "resume", no_argument, NULL, 'r' },
+		{ NULL, 0, NULL, 0 }
+	};
 
-	while ((c = getopt (argc, argv, "vm:s:")) != -1) {
+	reportInit(&report);
+	while ((c = getopt_long (argc, argv, "vm:s:k:c:C:rp:j:PM:E:T:", longOptions, NULL)) != -1) {
 		switch (c) {
 			case 'v':
 				verbose = 1;
@@ -171,75 +189,181 @@ int main(int argc, char **argv) {
 			case 's':
 				startValue = strtoll(optarg, NULL, 10);
 				break;
+			case 'k':
+				stepK = strtoll(optarg, NULL, 10);
+				break;
+			case 'c':
+				checkpointFile = optarg;
+				break;
+			case 'C':
+				checkpointInterval = strtoll(optarg, NULL, 10);
+				break;
+			case 'r':
+				resume = 1;
+				break;
+			case 'p':
+				proofFileName = optarg;
+				break;
+			case 'j':
+				reportFile = optarg;
+				break;
+			case 'P':
+				perfCounters = 1;
+				break;
+			case 'M':
+				metricsFile = optarg;
+				break;
+			case 'T':
+				traceFile = optarg;
+				break;
+			case 'E':
+				if (!parseU128(optarg, &estimate)) {
+					printf("ERROR: incorrect estimate %s.\n", optarg);
+					exit(1);
+				}
+				break;
 			case '?':
-				if (optopt == 'm' || optopt == 's')
+				if (optopt == 'm' || optopt == 's' || optopt == 'k' || optopt == 'c' || optopt == 'C' || optopt == 'p' ||
+				    optopt == 'j' || optopt == 'M' || optopt == 'E' || optopt == 'T')
 					fprintf (stderr, "Option -%c requires an argument.\n", optopt);
 				else if (isprint (optopt))
 					fprintf (stderr, "Unknown option `-%c'.\n", optopt);
 				else
 					fprintf (stderr, "Unknown option character `\\x%x'.\n", optopt);
-				fprintf (stderr, "Usage: IBM_ponder_2024_03 [-v] [-m memSize] [-s startValue] n\n");
+				fprintf (stderr, "Usage: IBM_ponder_2024_03 [-v] [-m memSize] [-s startValue] [-k mult] [-c file [-C seconds] [-r]] [-p proof] [-j report [-P]] [-M metrics] [-E estimate] [-T trace] n\n");
 				return 1;
 			default:
 				abort();
 		}
 	}
 	if (optind+1 != argc) {
-		fprintf (stderr, "Usage: IBM_ponder_2024_03 [-v] [-m memSize] [-s startValue] n\n");
+		fprintf (stderr, "Usage: IBM_ponder_2024_03 [-v] [-m memSize] [-s startValue] [-k mult] [-c file [-C seconds] [-r]] [-p proof] [-j report [-P]] [-M metrics] [-E estimate] [-T trace] n\n");
 		return 1;
 	}
 
+	if (traceFile) {
+		if (!ponderTraceStart(TRACE_EVENTS)) {
+			printf("ERROR: cannot allocate the trace.\n");
+			exit(1);
+		}
+		atexit(writeTrace);
+	}
+
 	n = strtoll(argv[optind], NULL, 10);
+	if (stepSpan(n, stepK) < 0) {
+		printf("ERROR: the sequence span does not fit in 64 bits.\n");
+		exit(1);
+	}
 
-	primesieve_init(&it);
+	if (resume && !checkpointFile) {
+		printf("ERROR: --resume needs a checkpoint file (-c).\n");
+		exit(1);
+	}
+	if (proofFileName) {
+		/* A proof is written in one go, from the start value */
+		if (checkpointFile) {
+			printf("ERROR: a proof cannot be written with checkpoints.\n");
+			exit(1);
+		}
+		if (!(proofFile = createProof(proofFileName, n, stepK, startValue))) {
+			printf("ERROR: cannot write proof file %s.\n", proofFileName);
+			exit(1);
+		}
+	}
+	if (checkpointFile) {
+		if (resume) {
+			if (!readCheckpoint(checkpointFile, &checkpoint)) {
+				printf("ERROR: cannot read checkpoint file %s.\n", checkpointFile);
+				exit(1);
+			}
+			checkCheckpoint(&checkpoint, "algorithm1", n, stepK);
+			startValue = checkpoint.offset + checkpoint.carry;
+			printf("Resuming from %" PRIdFAST64 "\n", startValue);
+		}
+		snprintf(checkpoint.engine, sizeof(checkpoint.engine), "algorithm1");
+		snprintf(checkpoint.policy, sizeof(checkpoint.policy), "%s", STEP_NAME);
+		checkpoint.n = n;
+		checkpoint.k = stepK;
+		checkpoint.memSize = memSize;
+		checkpoint.threads = 1;
+		installCheckpointSignals();
+	}
+	lastCheckpoint = time(NULL);
 
 	if (verbose)
-		printf("Looking for correct start value for n=%" PRIdFAST64 "\n", n);
-	startValue = look4StartValue(startValue, n, memSize);
+		printf("Looking for correct start value for n=%" PRIdFAST64 " (%s step, k=%" PRIdFAST64 ")\n",
+		       n, STEP_NAME, stepK);
+	ponderDefaultParams(&params);
+	params.engine = PONDER_ENGINE_BACKWARD;
+	params.n = n;
+	params.k = stepK;
+	params.memSize = memSize;
+	params.startValue = startValue;
+	if (checkpoint.found)
+		startValue = checkpoint.bestValue; // nothing left to search
+	else {
+		params.stopFlag = &stopRequested;
+		params.progress = searchProgress;
+		if (proofFile)
+			params.proof = searchProof;
+		params.detailedStats = reportFile != NULL;
+		params.perfCounters = reportFile && perfCounters;
+		if (!(ctx = ponderCreate(&params))) {
+			printf("ERROR: cannot allocate the search context.\n");
+			exit(1);
+		}
+		if (!metricsStart(&metrics, metricsFile, "IBM_ponder_2024-03_1", &params, !startValue || resume, estimate)) {
+			printf("ERROR: cannot start the metrics thread.\n");
+			exit(1);
+		}
+		status = ponderSearch(ctx, &value);
+		metricsStop(&metrics, ctx);
+		switch (status) {
+			case PONDER_FOUND:
+				startValue = value;
+				break;
+			case PONDER_CANCELLED:
+				if (checkpointFile)
+					saveCheckpoint(ponderWatermark(ctx));
+				printf("Interrupted, every value below %" PRIdFAST64 " has been ruled out.\n",
+				       (int_fast64_t) ponderWatermark(ctx));
+				exit(1);
+			default:
+				printf("ERROR: %s.\n", ponderError(ctx));
+				exit(1);
+		}
+		ponderGetStats(ctx, &report.stats);
+		ponderDestroy(ctx);
+	}
+	if (checkpointFile) {
+		checkpoint.found = 1;
+		checkpoint.bestValue = startValue;
+		saveCheckpoint(startValue);
+	}
 	if (verbose)
 		printf("For n=%" PRIdFAST64 ", start value = %" PRIdFAST64 "\n\n", n, startValue);
 
 	printf("For n=%" PRIdFAST64 ", a start value of %" PRIdFAST64 " has been found\n", n, startValue);
-	printf("Verifying...\n");
-
-	int iter;
-	int_fast64_t res;
-	if ((res = CheckSequence(startValue, n, &iter)))
-		printf("ERROR: %" PRIdFAST64 " is prime (%" PRIdFAST64 ") at iteration %d\n", startValue, res, iter);
-	else
-		printf("SUCCESS! %" PRIdFAST64 " is the correct answer.\n", startValue);
-
-	primesieve_free_iterator(&it);
-	free(numberArray);
-}
-
-
-/*********************************************************************/
-
-/* This function is used for verification purpose. Given an initial value A, it will
- *  check that no member of the sequence A, A+1, A+1+2,... of length n is a prime.
- * It returns 0 if the sequence is correct and the 'incorrect' prime otherwise.
- *  'iterationNbr' is used to keep track of the iteration number
- *  (so the calling code knows which An is prime).
- */
-int_fast64_t CheckSequence(int_fast64_t initialValue, int_fast64_t n, int *iterationNbr) {
-	int_fast64_t nextPrime;
-	*iterationNbr = 1;
-
-	primesieve_jump_to(&it, initialValue, initialValue + n*(n-1));
-	do {
-		while ((nextPrime = primesieve_next_prime(&it)) < initialValue)
-			; // Get the first prime to check
-		if (nextPrime == initialValue)
-			return initialValue;
-		while ((initialValue += (*iterationNbr)++) < nextPrime) {
-			if (*iterationNbr >= n)
-				break; // get next prime
+	trace = ponderTraceClock();
+	if (reportFile) {
+		report.program = "IBM_ponder_2024-03_1";
+		report.mode = "search";
+		report.params = params;
+		report.status = "found";
+		report.value = startValue;
+		reportVerify(&report, startValue, n, stepK, 0);
+		ponderTraceEvent(0, "verify", trace, -1);
+		if (!writeReport(reportFile, &report))
+			printf("WARNING: cannot write report file %s.\n", reportFile);
+	} else {
+		verifySequence(startValue, n, stepK, 0);
+		ponderTraceEvent(0, "verify", trace, -1);
+	}
+	if (proofFile) {
+		if (fclose(proofFile)) {
+			printf("ERROR: cannot write proof file %s.\n", proofFileName);
+			exit(1);
 		}
-		if (nextPrime == initialValue)
-			return initialValue;
-	} while (*iterationNbr < n);
-	if (verbose)
-		printf("Last check was for iteration %d, with value (%" PRIdFAST64 ")\n", *iterationNbr, initialValue);
-	return 0;
+		printf("Proof written in %s\n", proofFileName);
+	}
 }
@@ -2,11 +2,16 @@
  * This code solves the 'IBM Ponder this' challenge from March 2024
  * See: research.ibm.com/haifa/ponderthis/challenges/March2024.html
  *
- * The algorithm uses a prime generator library.
+ * The search itself is done by libponder (Algorithm 2 engine, see
+ *  libponder/ponder.c), this code only handles the command line and the
+ *  verification of the answer.
+ * libponder uses a prime generator library.
  * It can be found at github.com/kimwalisch/primesieve/tree/master
  * and has to be installed before compiling.
  *
- * Usage: Usage: IBM_ponder_2024-03_2 [-v] [-m memSize] n
+ * Usage: Usage: IBM_ponder_2024-03_2 [-v] [-m memSize] [-k mult] [-j reportFile [-P]]
+ *                            [-M metricsFile] [-E estimate]
+ *                            [-T traceFile] n
  *	Options:
  *	 -v
  *		verbose mode. Print information during the search.
@@ -15,6 +20,34 @@
  *		The size of the allocated array to rule out integers will be
  *		memSize bytes. Default is ten millions.
  *
+ *	 -k mult
+ *		Step multiplier: the sequence is a_i = a_{i-1} + mult*f(i)
+ *		(default is 1). f is chosen when compiling, see common/ponder_step.h
+ *
+ *	 -j reportFile
+ *		Writes a JSON report of the run in reportFile ("-" for the
+ *		standard output), see common/ponder_report.h.
+ *
+ *	 -P
+ *		With -j, also measures hardware counters (cycles, instructions,
+ *		last level cache, data TLB and branch misses) of each phase and
+ *		each thread with Linux perf events (see common/ponder_perf.h).
+ *
+ *	 -M metricsFile
+ *		Rewrites live metrics of the search (offset, lower bound, rate,
+ *		ETA...) in metricsFile every 10 seconds, in the text format of
+ *		Prometheus (see common/ponder_metrics.h). A snapshot is also
+ *		printed on stderr when the process receives SIGUSR1.
+ *
+ *	 -E estimate
+ *		Estimated answer, used for the ETA of the metrics.
+ *
+ *	 -T traceFile
+ *		Records a timeline of the run (window fills, tests of each thread
+ *		and their waits at the end of windows, verifications, checkpoints)
+ *		and writes it at exit in traceFile, in the Chrome trace event
+ *		format (chrome://tracing or ui.perfetto.dev).
+ *
  ********************************************************************/
  
 
@@ -25,82 +58,53 @@
 #include <unistd.h>
 #include <ctype.h>
 
-#include <primesieve.h>
-
-/* This iterator is used by the primesieve library to generate primes
- *  one after the other.
- */
-primesieve_iterator it;
-
-char *primeArray = NULL;     /* Array of primes */
-int_fast64_t n ;             /* Which X_n do we want? */
-int_fast64_t upperBoundDiff; /* Difference between a_0 and a_n, ie: n(n-1)/2 */
+#include "../common/ponder_step.h"
+#include "../common/ponder_verify.h"
+#include "../common/ponder_report.h"
+#include "../common/ponder_metrics.h"
+#include "../libponder/ponder.h"
 
 int verbose = 0; // Do we want some information while program is running?
 
-// Function prototypes
-void fillArrayOfPrimes(int_fast64_t offset, int_fast64_t memSize);
-int isCorrectValue(int_fast64_t offset, int_fast64_t value, int_fast64_t n);
-int_fast64_t CheckSequence(int_fast64_t initialValue, int_fast64_t n, int *iterationNbr);
+/* Live metrics (see -M and -E options) */
+char *metricsFile = NULL;
+ponder_u128 estimate = 0;
+ponderMetrics metrics;
 
-/* This function allocates (if not already done) an array of primes. The array
- *  represents integers in the range [offset - offset+memSize].
- *  Each prime integer is marked with a 1 in the array.
- * The array is in fact a bit larger than memSize because to be able
- *  to test integers up to offset+memsize, we need to check primes
- *  up to offset+memSize + upperBoundDiff
- */
-void fillArrayOfPrimes(int_fast64_t offset, int_fast64_t memSize) {
-	int_fast64_t lastPrime, pIndex;
-	/* We have to allocate a bit more. */
-	int_fast64_t primeSize = memSize + upperBoundDiff;
-	if (!primeArray) {
-		primeArray = malloc(sizeof(char) * primeSize);
-		if (!primeArray) {
-			printf("ERROR: cannot allocate enough memory for numbers array.\n");
-			exit(1);
-		}
-	}
-	if (verbose)
-		printf("Initializing numbers array from %" PRIdFAST64 "\n", offset);
-	for (int_fast64_t i = 0; i < primeSize; i++)
-		primeArray[i] = 0;
-	if (verbose)
-		printf("Allocation done !\n");
+/* Timeline trace (see -T option) */
+#define TRACE_EVENTS 65536   /* last events kept for each thread */
+char *traceFile = NULL;
 
-	// Start from the first prime after the offset and mark 1 for each prime
-	primesieve_jump_to(&it, offset, offset + primeSize);
-	lastPrime = primesieve_next_prime(&it);
-	while ((pIndex = lastPrime - offset) < primeSize) {
-		primeArray[pIndex] = 1;
-		lastPrime = primesieve_next_prime(&it);
-	}
+/* Called by libponder after each window of integers */
+int searchProgress(void *userData, ponder_u128 watermark, const ponderStats *stats) {
+	(void) userData;
 	if (verbose)
-		printf("Primes marked !\n");
+		printf("Every value below %" PRIdFAST64 " has been ruled out.\n", (int_fast64_t) watermark);
+	metricsUpdate(&metrics, watermark, stats);
+	return 0;
 }
 
-/* Test a value to see if it can be a starting one for the sequence.
- * It computes each value of the sequence a_i = a_i-1 + i and checks
- * whether it is a prime or not.
- * 'offset' is the initial offset of the prime array.
- */
-int isCorrectValue(int_fast64_t offset, int_fast64_t value, int_fast64_t n) {
-	int_fast64_t i = 0;
-	int_fast64_t valueOffset = value - offset;
-	while (i < n) {
-		if (primeArray[(valueOffset += (i++))])
-			return 0;
-	}
-	return 1;
+/* Called at exit: writes the timeline trace, if one has been asked for */
+void writeTrace(void) {
+	if (traceFile && !ponderTraceWrite(traceFile))
+		printf("WARNING: cannot write trace file %s.\n", traceFile);
 }
 
 int main(int argc, char **argv) {
-	int_fast64_t n, offset = 0;
+	int_fast64_t n, stepK = 1;
 	int_fast64_t memSize = 10000000L; // default memory size of 10 millions
-	int_fast64_t res, startValue = 0;
+	char *reportFile = NULL;
+	ponderReport report;
+	int perfCounters = 0;
+	uint64_t trace;
+	ponderParams params;
+	ponderContext *ctx;
+	ponder_u128 startValue;
+	ponderStatus status;
 	int c;
 
-	while ((c = getopt (argc, argv, "vm:")) != -1) {
+	reportInit(&report);
+	while ((c = getopt (argc, argv, "vm:k:j:PM:E:T:")) != -1) {
 		switch (c) {
 			case 'v':
 				verbose = 1;
@@ -108,83 +112,95 @@ int main(int argc, char **argv) {
 			case 'm':
 				memSize = strtoll(optarg, NULL, 10);
 				break;
+			case 'k':
+				stepK = strtoll(optarg, NULL, 10);
+				break;
+			case 'j':
+				reportFile = optarg;
+				break;
+			case 'P':
+				perfCounters = 1;
+				break;
+			case 'M':
+				metricsFile = optarg;
+				break;
+			case 'T':
+				traceFile = optarg;
+				break;
+			case 'E':
+				if (!parseU128(optarg, &estimate)) {
+					printf("ERROR: incorrect estimate %s.\n", optarg);
+					exit(1);
+				}
+				break;
 			case '?':
-				if (optopt == 'm')
-					fprintf (stderr, "Option -m requires an argument.\n");
+				if (optopt == 'm' || optopt == 'k' || optopt == 'j' || optopt == 'M' || optopt == 'E' || optopt == 'T')
+					fprintf (stderr, "Option -%c requires an argument.\n", optopt);
 				else if (isprint (optopt))
 					fprintf (stderr, "Unknown option `-%c'.\n", optopt);
 				else
 					fprintf (stderr, "Unknown option character `\\x%x'.\n", optopt);
-				fprintf (stderr, "Usage: greedy [-v] [-m memsize] n\n");
+				fprintf (stderr, "Usage: greedy [-v] [-m memsize] [-k mult] [-j report [-P]] [-M metrics] [-E estimate] [-T trace] n\n");
 				return 1;
 			default:
 				abort();
 		}
 	}
 	if (optind+1 != argc) {
-		fprintf (stderr, "Usage: greedy [-v] [-m memsize] n\n");
+		fprintf (stderr, "Usage: greedy [-v] [-m memsize] [-k mult] [-j report [-P]] [-M metrics] [-E estimate] [-T trace] n\n");
 		return 1;
 	}
 
-	n = strtoll(argv[optind], NULL, 10);
-
-	upperBoundDiff = n*(n+1)/2;
-	primesieve_init(&it);	
-
-	/* Initialize prime array */
-	fillArrayOfPrimes(0, memSize);
-	while (1) {
-		/* Have we ruled out all array? If so, proceed with the next integers block */
-		if (startValue-offset >= memSize)
-			fillArrayOfPrimes(offset = startValue, memSize);
-		res = isCorrectValue(offset, startValue, n);
-		if (res)
-			break;
-		startValue++;
+	if (traceFile) {
+		if (!ponderTraceStart(TRACE_EVENTS)) {
+			printf("ERROR: cannot allocate the trace.\n");
+			exit(1);
+		}
+		atexit(writeTrace);
 	}
 
-	if (res)
-		printf("For n=%" PRIdFAST64 ", a start value of %" PRIdFAST64 " has been found\n", n, startValue);
-
-	printf("Verifying...\n");
-
-	int iter;
-	if ((res = CheckSequence(startValue, n, &iter)))
-		printf("ERROR: %" PRIdFAST64 " is prime (%" PRIdFAST64 ") at iteration %d\n", startValue, res, iter);
-	else
-		printf("SUCCESS! %" PRIdFAST64 " is the correct answer.\n", startValue);
-
-	primesieve_free_iterator(&it);
-	free(primeArray);
-}
-
-
-/*********************************************************************/
-
-/* This function is used for verification purpose. Given an initial value A, it will
- *  check that no member of the sequence A, A+1, A+1+2,... of length n is a prime.
- * It returns 0 if the sequence is correct and the 'incorrect' prime otherwise.
- *  'iterationNbr' is used to keep track of the iteration number
- *  (so the calling code knows which An is prime).
- */
-int_fast64_t CheckSequence(int_fast64_t initialValue, int_fast64_t n, int *iterationNbr) {
-	int_fast64_t nextPrime;
-	*iterationNbr = 1;
+	n = strtoll(argv[optind], NULL, 10);
 
-	primesieve_jump_to(&it, initialValue, initialValue + n*(n-1));
-	do {
-		while ((nextPrime = primesieve_next_prime(&it)) < initialValue)
-			; // Get the first prime to check
-		if (nextPrime == initialValue)
-			return initialValue;
-		while ((initialValue += (*iterationNbr)++) < nextPrime) {
-			if (*iterationNbr >= n)
-				break; // get next prime
-		}
-		if (nextPrime == initialValue)
-			return initialValue;
-	} while (*iterationNbr < n);
-	if (verbose)
-		printf("Last check was for iteration %d, with value (%" PRIdFAST64 ")\n", *iterationNbr, initialValue);
-	return 0;
+	ponderDefaultParams(&params);
+	params.engine = PONDER_ENGINE_WINDOW;
+	params.n = n;
+	params.k = stepK;
+	params.memSize = memSize;
+	params.progress = searchProgress;
+	params.detailedStats = reportFile != NULL;
+	params.perfCounters = reportFile && perfCounters;
+	if (!(ctx = ponderCreate(&params))) {
+		printf("ERROR: cannot allocate the search context.\n");
+		exit(1);
+	}
+	if (!metricsStart(&metrics, metricsFile, "IBM_ponder_2024-03_2", &params, 1, estimate)) {
+		printf("ERROR: cannot start the metrics thread.\n");
+		exit(1);
+	}
+	status = ponderSearch(ctx, &startValue);
+	metricsStop(&metrics, ctx);
+	if (status != PONDER_FOUND) {
+		printf("ERROR: %s.\n", ponderError(ctx));
+		exit(1);
+	}
+	ponderGetStats(ctx, &report.stats);
+	ponderDestroy(ctx);
+
+	printf("For n=%" PRIdFAST64 ", a start value of %" PRIdFAST64 " has been found\n", n, (int_fast64_t) startValue);
+
+	trace = ponderTraceClock();
+	if (reportFile) {
+		report.program = "IBM_ponder_2024-03_2";
+		report.mode = "search";
+		report.params = params;
+		report.status = "found";
+		report.value = startValue;
+		reportVerify(&report, startValue, n, stepK, 0);
+		ponderTraceEvent(0, "verify", trace, -1);
+		if (!writeReport(reportFile, &report))
+			printf("WARNING: cannot write report file %s.\n", reportFile);
+	} else {
+		verifySequence(startValue, n, stepK, 0);
+		ponderTraceEvent(0, "verify", trace, -1);
+	}
 }
@@ -2,188 +2,404 @@
  * This code solves the 'IBM Ponder this' challenge from March 2024
  * See: research.ibm.com/haifa/ponderthis/challenges/March2024.html
  *
- * The algorithm uses a prime generator library.
+ * The search itself is done by libponder (threaded engine, see
+ *  libponder/ponder.c), this code only handles the command line, the
+ *  output files and the verification of the answers.
+ * libponder uses a prime generator library.
  * It can be found at github.com/kimwalisch/primesieve/tree/master
  * and has to be installed before compiling.
  *
- * Usage: Usage: IBM_ponder_2024-03_2_MT [-v] [-t numThreads] [-m memSize] n
+ * Usage: Usage: IBM_ponder_2024-03_2_MT [-v] [-t numThreads] [-m memSize]
+ *                        [-k mult] [-s startValue] [-e endValue [-d depth] [-o file] [-b]]
+ *                        [-c checkpointFile [-C seconds] [-r]] [-w shardEnd] [-x certFile]
+ *                        [-j reportFile [-P]] [-M metricsFile] [-E estimate]
+ *                        [-T traceFile] [-p placement] [-N] [--autotune]
+ *                        {n | -B n[:k],n[:k]...}
  *	Options:
  *	 -v
  *		verbose mode. Print information during the search.
  *
  *	 -t numThreads
- *		Uses numThreads threads to compute the results (default is 1)
+ *		Uses numThreads threads to compute the results. The default is
+ *		the number of CPUs the process may use: those of its affinity
+ *		(taskset, cpuset), fewer if its cgroup has a CPU quota (for
+ *		example docker --cpus). It is 1 in worker mode (-w).
  *
  *	 -m memSize
  *		The size of the allocated array to rule out integers will be
- *		memSize bytes. Default is ten millions.
+ *		memSize bytes. Default is a hundred millions, or the size of
+ *		the tuning profile (see --autotune).
+ *
+ *	 -k mult
+ *		Step multiplier: the sequence is a_i = a_{i-1} + mult*f(i)
+ *		(default is 1). f is chosen when compiling, see common/ponder_step.h
+ *
+ *	 -s startValue
+ *		The search will start at the given startValue. Values up to
+ *		2^128 are accepted; past 2^64 the windows are sieved with the
+ *		primes up to their square root, which is much slower.
+ *
+ *	 -B n[:k],n[:k]...
+ *		Batch mode: searches X_n for several parameter sets (n and
+ *		step multiplier k, default 1) at once, each prime window being
+ *		filled once and used for all of them.
+ *
+ *	 -e endValue
+ *		Enumerate mode: instead of stopping at the first correct value,
+ *		every correct start value in [startValue, endValue) is written out.
+ *
+ *	 -d depth
+ *		In enumerate mode, also write near misses: every start value
+ *		whose first 'depth' terms are not prime (default is n).
+ *
+ *	 -o file
+ *		In enumerate mode, write results to file (default is stdout).
+ *
+ *	 -b
+ *		In enumerate mode, write compact binary records (an 8-byte start
+ *		value followed by a 4-byte depth, native endianness) instead of
+ *		'value,depth' CSV lines. If endValue is past 2^64, start values
+ *		are written with 16 bytes (low 8 bytes first).
+ *
+ *	 -c checkpointFile
+ *		Saves the progress of the search (not in batch or enumerate
+ *		mode) in checkpointFile after a window once every 'seconds'
+ *		seconds (see -C) and when interrupted by SIGINT or SIGTERM.
+ *
+ *	 -C seconds
+ *		Minimum time between two checkpoints (default is 60).
+ *
+ *	 -r, --resume
+ *		Restarts the search where the checkpoint file says it stopped.
+ *
+ *	 -w shardEnd
+ *		Worker mode: only searches [startValue, shardEnd) and prints a
+ *		single result line for a coordinator (see common/ponder_shard.h
+ *		and IBM_ponder_2024-03_coordinator).
+ *
+ *	 -x certFile
+ *		Writes a compositeness certificate of the value found in certFile
+ *		(a factor of each term, see common/ponder_cert.h). It can be
+ *		checked with IBM_ponder_2024-03_certcheck.
+ *
+ *	 -j reportFile
+ *		Writes a JSON report of the run in reportFile ("-" for the
+ *		standard output): time spent filling windows, testing and
+ *		verifying, counters, work and idle time of each thread... (see
+ *		common/ponder_report.h). Probes are counted too, the test loops
+ *		are then slightly slower.
+ *
+ *	 -P
+ *		With -j, also measures hardware counters (cycles, instructions,
+ *		last level cache, data TLB and branch misses) of each phase and
+ *		each thread with Linux perf events (see common/ponder_perf.h).
+ *
+ *	 -M metricsFile
+ *		Rewrites live metrics of the search (offset, lower bound, rates
+ *		of each thread, ETA...) in metricsFile every 10 seconds, in the
+ *		text format of Prometheus (see common/ponder_metrics.h). A
+ *		snapshot is also printed on stderr when the process receives
+ *		SIGUSR1, with or without this option.
+ *
+ *	 -E estimate
+ *		Estimated answer, used for the ETA of the metrics (the default
+ *		is the end of the range in enumerate and worker modes).
+ *
+ *	 -T traceFile
+ *		Records a timeline of the run (window fills, tests of each thread
+ *		and their waits at the end of windows, verifications, checkpoints)
+ *		and writes it at exit in traceFile, in the Chrome trace event
+ *		format (chrome://tracing or ui.perfetto.dev).
+ *
+ *	 -p placement
+ *		CPUs of the threads (see common/ponder_topology.h):
+ *		balanced (default) binds each thread to a CPU, one per core
+ *		while there are enough cores, then a second hardware thread of
+ *		each core and so on, the threads of a core having adjacent
+ *		numbers so that they test neighbour values and share the lines
+ *		of the window in the L2 cache of the core; cores binds one
+ *		thread per core at most; smt fills the hardware threads of a
+ *		core before the next one; os leaves the threads to the system
+ *		(the default in worker mode, several workers sharing the CPUs).
+ *		With more threads than CPUs, the threads are not bound. The
+ *		resolved placement is printed on stderr.
+ *
+ *	 -N
+ *		NUMA mode: binds the threads as -p does (it cannot be os) and
+ *		gives the threads of each NUMA node a copy
+ *		of each window, filled by them on their node, instead of
+ *		probing a window spread over all the nodes. With -j -P, the
+ *		report counts the local and remote memory loads.
+ *
+ *	 --autotune
+ *		Before the search, tries window sizes of the threaded engine
+ *		and of Algorithm 1 for a few seconds each, from the start value,
+ *		and searches with the fastest one. Algorithm 1 is left out past
+ *		2^62, in worker mode and with -N. The setting is saved in a
+ *		profile ($PONDER_TUNE_PROFILE, default ~/.ponder_tune) for this
+ *		CPU model, thread count and range of n, and later searches
+ *		without -m use its window size if it is one of the threaded
+ *		engine: only --autotune switches to Algorithm 1 (see
+ *		common/ponder_tune.h). Not in batch or enumerate mode.
  *
  ********************************************************************/
- 
+
+
+#define _GNU_SOURCE /* CPU sets, see common/ponder_topology.h */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <inttypes.h>
 #include <stdint.h>
 #include <unistd.h>
 #include <ctype.h>
-#include <pthread.h>
+#include <getopt.h>
 
-#define MAX_THREADS 64
+#define MAX_THREADS PONDER_MAX_THREADS
+#define MAX_BATCH 64
 
-#include <primesieve.h>
+#include "../common/ponder_step.h"
+#include "../common/ponder_u128.h"
+#include "../common/ponder_verify.h"
+#include "../common/ponder_checkpoint.h"
+#include "../common/ponder_shard.h"
+#include "../common/ponder_cert.h"
+#include "../common/ponder_report.h"
+#include "../common/ponder_metrics.h"
+#include "../common/ponder_tune.h"
+#include "../common/ponder_topology.h"
+#include "../libponder/ponder.h"
 
-/* A bunch of global variables accessible by all threads on a read-only basis */
 int verbose = 0;
-char *primeArray = NULL;     /* Array of primes */
-int_fast64_t n ;             /* Which X_n do we want? */
-int_fast64_t memSize;        /* Size of the integers window */
-int_fast64_t upperBoundDiff; /* Difference between a_0 and a_n, ie: n(n-1)/2 */
-int_fast64_t globalOffset;   /* Integers window offset, ie: index 0 represent true integer 'globalOffset' */
-
-int numThreads = 1;
-
-/* a global variable to hold the best starting value found by a thread.
- * It will be modified by the threads when they find a possible starting value
- * for the sequence, so it must be declared volatile (so that each thread gets
- * the updated value) and protected by a mutual exclusion lock.
+int numThreads = 0;             /* 0: the usable CPUs, see placeThreads() */
+
+/* Batch mode: several (n, k) parameter sets are searched at the same time,
+ *  sharing the same prime windows.
  */
-volatile int_fast64_t bestValue = 0; 
-pthread_mutex_t mutex;
-
-/* The iterator used to generate all primes. See the primesieve library */
-primesieve_iterator it;
-
-/* Function prototypes */
-void fillArrayOfPrimes(int_fast64_t memSize);
-int test(int_fast64_t value);
-void *greedyLoop(void *ptr);
-int_fast64_t CheckSequence(int_fast64_t initialValue, int_fast64_t n, int *iterationNbr);
-
-/*********************************************************************/
-
-/* This function allocates (if not already done) an array of primes. The array
- *  represents integers in the range [globalOffset - globalOffset+memSize].
- *  Each prime integer is marked with a 1 in the array.
- * The array is in fact a bit larger than memSize because to be able
- *  to test integers up to globalOffset+memsize, we need to check primes
- *  up to globalOffset+memSize + upperBoundDiff
+ponderBatchSet batch[MAX_BATCH];
+int batchSize = 0;              /* 0 means no batch mode */
+int batchRemaining;
+ponderContext *batchContext;
+
+/* Enumerate mode parameters (see -e, -d, -o and -b options) */
+int binaryOutput = 0;
+int wideOutput = 0;          /* binary records hold 128-bit values */
+FILE *outFile;
+
+/* Checkpoints (see -c, -C and -r options) */
+char *checkpointFile = NULL;
+int checkpointInterval = 60;
+ponderCheckpoint checkpoint;
+time_t lastCheckpoint;
+
+/* Run report (see -j option) */
+char *reportFile = NULL;
+ponderReport report;
+
+/* Live metrics (see -M and -E options) */
+char *metricsFile = NULL;
+ponder_u128 estimate = 0;
+ponderMetrics metrics;
+
+/* Thread placement (see -p and -N options): CPU of each thread */
+topologyPlacement placement = TOPOLOGY_BALANCED;
+int placementGiven = 0;
+int numaMode = 0;
+int threadCpus[MAX_THREADS];
+
+/* Timeline trace (see -T option) */
+#define TRACE_EVENTS 65536   /* last events kept for each thread */
+char *traceFile = NULL;
+
+/* Saves the progress of the search: every integer below offset has been
+ *  ruled out (the threaded search does not know more inside a window).
  */
-void fillArrayOfPrimes(int_fast64_t memSize) {
-	int_fast64_t lastPrime, pIndex;
-	/* We have to allocate a bit more. */
-	int_fast64_t primeSize = memSize + upperBoundDiff;
-	if (!primeArray) {
-		primeArray = malloc(sizeof(char) * primeSize);
-		if (!primeArray) {
-			printf("ERROR: cannot allocate enough memory for numbers array.\n");
-			exit(1);
-		}
-	}
-	if (verbose)
-		printf("Initializing numbers array from %" PRIdFAST64 "\n", globalOffset);
-	for (int_fast64_t i = 0; i < primeSize; i++)
-		primeArray[i] = 0;
-	if (verbose)
-		printf("Allocation done !\n");
-
-	// Start from the first prime after the offset and mark 1 for each prime
-	primesieve_jump_to(&it, globalOffset, globalOffset + primeSize);
-	lastPrime = primesieve_next_prime(&it);
-	while ((pIndex = lastPrime - globalOffset) < primeSize) {
-		primeArray[pIndex] = 1;
-		lastPrime = primesieve_next_prime(&it);
-	}
+void saveCheckpoint(ponder_u128 offset) {
+	char offsetString[U128_STRING_SIZE];
+	uint64_t trace = ponderTraceClock();
+	int written;
+	checkpoint.offset = offset;
+	written = writeCheckpoint(checkpointFile, &checkpoint);
+	ponderTraceEvent(0, "checkpoint", trace, -1);
+	if (!written)
+		printf("WARNING: cannot write checkpoint file %s.\n", checkpointFile);
+	else if (verbose)
+		printf("Checkpoint written at %s\n", u128ToString(offset, offsetString));
+}
+
+/* Called by libponder after each window */
+int searchProgress(void *userData, ponder_u128 watermark, const ponderStats *stats) {
+	char valueString[U128_STRING_SIZE];
+	(void) userData;
 	if (verbose)
-		printf("Primes marked !\n");
+		printf("Every value below %s has been ruled out (%" PRIdFAST64 " windows, %.2f s filling them).\n",
+		       u128ToString(watermark, valueString), stats->windows, stats->fillSeconds);
+	if (checkpointFile && checkpointDue(&lastCheckpoint, checkpointInterval))
+		saveCheckpoint(watermark);
+	metricsUpdate(&metrics, watermark, stats);
+	return 0;
 }
 
-/* Test a value to see if it can be a starting one for the sequence.
- * It computes each value of the sequence a_i = a_i-1 + i and checks
- * whether it is a prime or not. 'globalOffset' is the initial offset
- *  of the prime array and is given with a global variable.
+/* Enumerate mode: writes one value to the output file, either as CSV or
+ *  as a binary record. libponder calls it from a single writer thread.
  */
-int isCorrectValue(int_fast64_t value) {
-	int_fast64_t i = 0;
-	int_fast64_t valueOffset = value - globalOffset;
-	while (i < n) {
-		if (primeArray[(valueOffset += (i++))])
-			return 0;
+void writeResult(void *userData, ponder_u128 value, int_fast64_t depth) {
+	char valueString[U128_STRING_SIZE];
+	(void) userData;
+	if (binaryOutput) {
+		uint64_t v[2] = { (uint64_t) value, (uint64_t) (value >> 64) };
+		uint32_t d = depth;
+		fwrite(v, sizeof(v[0]), wideOutput ? 2 : 1, outFile);
+		fwrite(&d, sizeof(d), 1, outFile);
+	} else
+		fprintf(outFile, "%s,%" PRIdFAST64 "\n", u128ToString(value, valueString), depth);
+}
+
+/* Batch mode: called when a parameter set gets its answer */
+void batchFound(void *userData, int set, ponder_u128 value) {
+	char valueString[U128_STRING_SIZE];
+	ponderStats stats = { 0 };
+	(void) userData;
+	ponderGetStats(batchContext, &stats);
+	printf("For n=%" PRIdFAST64 ", k=%" PRIdFAST64 ", a start value of %s"
+	       " has been found (window %" PRIdFAST64 ", %d parameter sets left)\n",
+	       batch[set].n, batch[set].k, u128ToString(value, valueString), stats.windows + 1, --batchRemaining);
+	ponderFreeStats(&stats);
+	uint64_t trace = ponderTraceClock();
+	if (reportFile)
+		reportVerify(&report, value, batch[set].n, batch[set].k, numThreads);
+	else
+		verifySequence(value, batch[set].n, batch[set].k, numThreads);
+	ponderTraceEvent(0, "verify", trace, -1);
+}
+
+/* Starts the metrics thread. 'proven' tells whether every value below
+ *  the start value is known to be ruled out.
+ */
+void startMetrics(const ponderParams *params, int proven) {
+	if (!metricsStart(&metrics, metricsFile, "IBM_ponder_2024-03_2_MT", params, proven, estimate)) {
+		printf("ERROR: cannot start the metrics thread.\n");
+		exit(1);
 	}
-	return 1;
 }
 
-/* This is the main loop executed by each thread.
- * The parameter is the initial starting value to check. It is equal to 
- *  the global offset plus the thread ID (from 0 to the number of threads
- *  [stored in the numThreads global variable]). 
- * The function then checks each number in the integer range and proceed
- *  with step 'numThreads'.
- * The function stops on three cases:
- *  - it has tested all integers in the range without success. The function
- *    will return -1 and the thread exits.
- *  - another thread has already found a correct starting value
- *    ['bestValue' global variable] lower than our current tested value.
- *    the thread will exit and return its current value.
- *  - the thread has found a correct value and it is lower than the current
- *    best value (or no correct value has yet been found).
- *    The thread will update the best value global variable
- *    (protected by a mutual exclusion lock) and return it.
+/* Writes the run report, if one has been asked for */
+void saveReport(const ponderParams *params, const char *mode, const char *status) {
+	if (!reportFile)
+		return;
+	report.program = "IBM_ponder_2024-03_2_MT";
+	report.mode = mode;
+	report.params = *params;
+	report.status = status;
+	if (!writeReport(reportFile, &report))
+		printf("WARNING: cannot write report file %s.\n", reportFile);
+}
+
+/* Sets the default thread count and binds the threads to their CPUs
+ *  (unless the placement is os), and prints the placement. Returns 1 if
+ *  the threads are bound.
  */
-void *mainLoop(void *ptr) {
-	int_fast64_t initialOffset = *(int_fast64_t *) ptr;
-	int_fast64_t threadID = initialOffset - globalOffset;
-	int_fast64_t *startValue = malloc(sizeof(int_fast64_t));
-	int res = 0;
-
-	*startValue = initialOffset;
-	while (*startValue < memSize + globalOffset) {
-		res = isCorrectValue(*startValue);
-		if (verbose && !(*startValue & 0x7FFFFFF))
-			// print tested value once in a while
-			printf("Testing %" PRIdFAST64 "\n", *startValue);
-		if (res || (bestValue && bestValue < *startValue))
-			break;
-		*startValue += numThreads;
+int placeThreads(void) {
+	static const char *placementNames[] = { "os", "cores", "smt", "balanced" };
+	static cpuTopology topology;
+	int bound = 0, usable = 1, quota = 0;
+
+	if (topologyRead(&topology)) {
+		quota = topologyQuota();
+		usable = topologyUsableCpus(&topology);
 	}
-	if (*startValue >= memSize + globalOffset) {
-		if (verbose)
-			printf("Thread %" PRIdFAST64 " out of memory.\n", threadID);
-		*startValue = -1;
-		pthread_exit(startValue);
+	if (!numThreads)
+		numThreads = usable < MAX_THREADS ? usable : MAX_THREADS;
+	if (topology.numCpus)
+		bound = topologyPlace(&topology, placement, numThreads, threadCpus);
+	if (numaMode && !bound) {
+		printf("ERROR: cannot bind %d threads to the CPUs of the process with the %s placement.\n",
+		       numThreads, placementNames[placement]);
+		exit(1);
 	}
-	pthread_mutex_lock(&mutex);
-	if (!bestValue || *startValue < bestValue) {
-		if (verbose)
-			printf("Thread %" PRIdFAST64 " updates best value.\n", threadID);
-		bestValue = *startValue;
-	} else {
-		if (verbose)
-			printf("Thread %" PRIdFAST64 " stops.\n", threadID);
+	fprintf(stderr, "Threads: %d; usable CPUs: %d (affinity %d, cgroup quota ", numThreads, usable, topology.numCpus);
+	if (quota)
+		fprintf(stderr, "%d", quota);
+	else
+		fprintf(stderr, "none");
+	fprintf(stderr, "), cores: %d; ", topology.numCores);
+	if (!bound) {
+		fprintf(stderr, "%s placement: not bound%s\n", placementNames[placement],
+		        placement != TOPOLOGY_OS ? " (more threads than CPUs)" : "");
+		return 0;
+	}
+	fprintf(stderr, "%s placement, thread:CPU/core/node", placementNames[placement]);
+	for (int i = 0; i < numThreads; i++)
+		for (int j = 0; j < topology.numCpus; j++)
+			if (topology.cpus[j].cpu == threadCpus[i])
+				fprintf(stderr, " %d:%d/%d/%d", i, threadCpus[i], topology.cpus[j].core, topology.cpus[j].node);
+	fprintf(stderr, "\n");
+	return 1;
+}
+
+/* Parses the -B argument: a comma separated list of n or n:k parameter sets */
+void parseBatch(char *list) {
+	char *p = list, *end;
+
+	while (*p) {
+		if (batchSize == MAX_BATCH) {
+			printf("ERROR: at most %d parameter sets in a batch.\n", MAX_BATCH);
+			exit(1);
+		}
+		batch[batchSize].n = strtoll(p, &end, 10);
+		batch[batchSize].k = 1;
+		if (*end == ':')
+			batch[batchSize].k = strtoll(end + 1, &end, 10);
+		if ((*end && *end != ',') || batch[batchSize].n <= 0) {
+			printf("ERROR: incorrect parameter set list '%s'.\n", list);
+			exit(1);
+		}
+		batchSize++;
+		p = *end ? end + 1 : end;
 	}
-	pthread_mutex_unlock(&mutex);
-	return startValue;
 }
 
-/* The main function will set up an integer range and launch several threads
- *  to test it. If no thread find a correct value, we start again with the
- *  next integer range (increasing globalOffset by memSize).
+/* Called at exit: writes the timeline trace, if one has been asked for */
+void writeTrace(void) {
+	if (traceFile && !ponderTraceWrite(traceFile))
+		printf("WARNING: cannot write trace file %s.\n", traceFile);
+}
+
+/* The main function sets up the libponder parameters from the command line
+ *  and runs the search of the selected mode.
  */
 int main(int argc, char **argv) {
-	pthread_t ID[MAX_THREADS];
-	int_fast64_t tab[MAX_THREADS];
-	void *exitPtr[MAX_THREADS];
-	int i;
-
-	memSize = 100000000L; // default memory size of 100 millions
+	char *outFileName = NULL;
+	char *batchList = NULL;
+	char valueString[U128_STRING_SIZE], endString[U128_STRING_SIZE];
+	ponder_u128 startValue = 0, endValue = 0, bestValue, shardEnd = 0;
+	int_fast64_t n, stepK = 1, minDepth = 0;
+	int_fast64_t memSize = 100000000L; // default memory size of 100 millions
+	int memSizeGiven = 0, autotune = 0, useTuned = 0;
+	tuneSetting tuned;
+	char *certFile = NULL;
+	int resume = 0;
+	ponderParams params;
+	ponderContext *ctx;
+	ponderStatus status;
+	int perfCounters = 0, bound;
+	uint64_t trace;
+	static struct option longOptions[] = {
+		{ "resume", no_argument, NULL, 'r' },
+		{ "autotune", no_argument, NULL, 'A' },
+		{ NULL, 0, NULL, 0 }
+	};
 	int c;
 
-	while ((c = getopt (argc, argv, "vm:t:")) != -1) {
+	reportInit(&report);
+	while ((c = getopt_long (argc, argv, "vm:t:k:s:e:d:o:bB:c:C:rw:x:j:PM:E:T:p:N", longOptions, NULL)) != -1) {
 		switch (c) {
 			case 'v':
 				verbose = 1;
 				break;
 			case 'm':
 				memSize = strtoll(optarg, NULL, 10);
+				memSizeGiven = 1;
 				break;
 			case 't':
 				numThreads = strtoll(optarg, NULL, 10);
@@ -192,87 +408,305 @@ int main(int argc, char **argv) {
 					exit(1);
 				}
 				break;
+			case 'k':
+				stepK = strtoll(optarg, NULL, 10);
+				break;
+			case 's':
+				if (!parseU128(optarg, &startValue)) {
+					printf("ERROR: incorrect start value %s.\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'e':
+				if (!parseU128(optarg, &endValue)) {
+					printf("ERROR: incorrect end value %s.\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'd':
+				minDepth = strtoll(optarg, NULL, 10);
+				break;
+			case 'o':
+				outFileName = optarg;
+				break;
+			case 'b':
+				binaryOutput = 1;
+				break;
+			case 'B':
+				batchList = optarg;
+				break;
+			case 'c':
+				checkpointFile = optarg;
+				break;
+			case 'C':
+				checkpointInterval = strtoll(optarg, NULL, 10);
+				break;
+			case 'r':
+				resume = 1;
+				break;
+			case 'A':
+				autotune = 1;
+				break;
+			case 'p':
+				if (!strcmp(optarg, "balanced"))
+					placement = TOPOLOGY_BALANCED;
+				else if (!strcmp(optarg, "cores"))
+					placement = TOPOLOGY_CORES;
+				else if (!strcmp(optarg, "smt"))
+					placement = TOPOLOGY_SMT;
+				else if (!strcmp(optarg, "os"))
+					placement = TOPOLOGY_OS;
+				else {
+					printf("ERROR: unknown placement %s (balanced, cores, smt or os).\n", optarg);
+					exit(1);
+				}
+				placementGiven = 1;
+				break;
+			case 'N':
+				numaMode = 1;
+				break;
+			case 'w':
+				if (!parseU128(optarg, &shardEnd)) {
+					printf("ERROR: incorrect shard end %s.\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'x':
+				certFile = optarg;
+				break;
+			case 'j':
+				reportFile = optarg;
+				break;
+			case 'P':
+				perfCounters = 1;
+				break;
+			case 'M':
+				metricsFile = optarg;
+				break;
+			case 'T':
+				traceFile = optarg;
+				break;
+			case 'E':
+				if (!parseU128(optarg, &estimate)) {
+					printf("ERROR: incorrect estimate %s.\n", optarg);
+					exit(1);
+				}
+				break;
 			case '?':
-				if (optopt == 'm' || optopt == 't')
+				if (optopt == 'm' || optopt == 't' || optopt == 'k' || optopt == 's' ||
+				    optopt == 'e' || optopt == 'd' || optopt == 'o' || optopt == 'B' ||
+				    optopt == 'c' || optopt == 'C' || optopt == 'w' || optopt == 'x' || optopt == 'j' ||
+				    optopt == 'M' || optopt == 'E' || optopt == 'T' || optopt == 'p')
 					fprintf (stderr, "Option -%c requires an argument.\n", optopt);
 				else if (isprint (optopt))
 					fprintf (stderr, "Unknown option `-%c'.\n", optopt);
 				else
 					fprintf (stderr, "Unknown option character `\\x%x'.\n", optopt);
-				fprintf (stderr, "Usage: greedy [-v] [-m memsize] [-t #threads] n\n");
+				fprintf (stderr, "Usage: greedy [-v] [-m memsize] [-t #threads] [-k mult] [-s start] "
+				                 "[-e end [-d depth] [-o file] [-b]] [-c file [-C seconds] [-r]] [-w end] [-x cert] [-j report [-P]] [-M metrics] [-E estimate] [-T trace] [-p placement] [-N] [--autotune] {n | -B n[:k],...}\n");
 				return 1;
 			default:
 				abort();
 		}
 	}
-	if (optind+1 != argc) {
-		fprintf (stderr, "Usage: greedy [-v] [-m memsize] n\n");
+	if ((optind+1 != argc && !batchList) || (optind != argc && batchList) || (batchList && endValue) ||
+	    (checkpointFile && (batchList || endValue)) || (resume && !checkpointFile) ||
+	    (shardEnd && (batchList || endValue || checkpointFile || shardEnd <= startValue)) ||
+	    (certFile && (batchList || endValue || shardEnd)) || (autotune && (batchList || endValue)) ||
+	    (numaMode && placement == TOPOLOGY_OS)) {
+		fprintf (stderr, "Usage: greedy [-v] [-m memsize] [-t #threads] [-k mult] [-s start] "
+		                 "[-e end [-d depth] [-o file] [-b]] [-c file [-C seconds] [-r]] [-w end] [-x cert] [-j report [-P]] [-M metrics] [-E estimate] [-T trace] [-p placement] [-N] [--autotune] {n | -B n[:k],...}\n");
 		return 1;
 	}
 
-	n = strtoll(argv[optind], NULL, 10);
-	upperBoundDiff = n*(n+1)/2;
-	globalOffset = 0;
-	primesieve_init(&it);	
-	pthread_mutex_init(&mutex, NULL); /* initialize lock */
-
-	while (!bestValue) {
-		fillArrayOfPrimes(memSize);
-		for (i = 0; i < numThreads; i++) {
-			tab[i] = i+globalOffset;
-			pthread_create(&ID[i], NULL, mainLoop, &tab[i]);
+	if (traceFile) {
+		if (!ponderTraceStart(TRACE_EVENTS)) {
+			printf("ERROR: cannot allocate the trace.\n");
+			exit(1);
 		}
-		for (i = 0; i < numThreads; i++) {
-			pthread_join(ID[i], &exitPtr[i]);
-			if (verbose)
-				printf("Le thread %d returns %" PRIdFAST64 ".\n", i, *(int_fast64_t *) exitPtr[i]);
-			free(exitPtr[i]);
+		atexit(writeTrace);
+	}
+
+	/* Workers share the CPUs of the host: one thread each, not bound */
+	if (shardEnd && !numThreads)
+		numThreads = 1;
+	if (shardEnd && !placementGiven)
+		placement = TOPOLOGY_OS;
+	bound = placeThreads();
+
+	ponderDefaultParams(&params);
+	params.engine = PONDER_ENGINE_THREADED;
+	params.k = stepK;
+	params.memSize = memSize;
+	params.numThreads = numThreads;
+	params.startValue = startValue;
+	params.progress = searchProgress;
+	params.detailedStats = reportFile != NULL;
+	params.perfCounters = reportFile && perfCounters;
+	params.cpus = bound ? threadCpus : NULL;
+	params.numaReplicas = numaMode;
+	report.params = params; // for the verifications, completed by saveReport()
+
+	if (batchList) {
+		/* Batch mode: one window for all parameter sets, each one completing
+		 *  independently of the others.
+		 */
+		parseBatch(batchList);
+		batchRemaining = batchSize;
+		if (!(batchContext = ctx = ponderCreate(&params))) {
+			printf("ERROR: cannot allocate the search context.\n");
+			exit(1);
 		}
-		globalOffset += memSize;
+		startMetrics(&params, !startValue);
+		if (ponderBatch(ctx, batch, batchSize, batchFound) != PONDER_FOUND) {
+			printf("ERROR: %s.\n", ponderError(ctx));
+			exit(1);
+		}
+		metricsStop(&metrics, ctx);
+		ponderGetStats(ctx, &report.stats);
+		if (verbose)
+			printf("%" PRIdFAST64 " windows filled for %d parameter sets, %" PRIdFAST64 " tests.\n",
+			       report.stats.windows + 1, batchSize, report.stats.tests);
+		ponderDestroy(ctx);
+		report.batchSize = batchSize;
+		saveReport(&params, "batch", "found");
+		return 0;
 	}
-	pthread_mutex_destroy(&mutex); /* destroy lock */
-		
-	printf("For n=%" PRIdFAST64 ", a start value of %" PRIdFAST64 " has been found\n", n, bestValue);
-	printf("Verifying...\n");
-
-	int iter;
-	int_fast64_t res;
-	if ((res = CheckSequence(bestValue, n, &iter)))
-		printf("ERROR: %" PRIdFAST64 " is prime (%" PRIdFAST64 ") at iteration %d\n", bestValue, res, iter);
-	else
-		printf("SUCCESS! %" PRIdFAST64 " is the correct answer.\n", bestValue);
 
-	primesieve_free_iterator(&it);
-	free(primeArray);
-}
+	n = params.n = strtoll(argv[optind], NULL, 10);
 
+	if (endValue) {
+		/* Enumerate mode: no best value, every window up to endValue is tested */
+		int_fast64_t found;
+		wideOutput = (endValue > UINT64_MAX);
+		outFile = stdout;
+		if (outFileName && !(outFile = fopen(outFileName, binaryOutput ? "wb" : "w"))) {
+			printf("ERROR: cannot open output file %s.\n", outFileName);
+			exit(1);
+		}
+		params.endValue = endValue;
+		if (!(ctx = ponderCreate(&params))) {
+			printf("ERROR: cannot allocate the search context.\n");
+			exit(1);
+		}
+		startMetrics(&params, !startValue);
+		if ((status = ponderEnumerate(ctx, minDepth, writeResult, &found)) == PONDER_ERROR) {
+			printf("ERROR: %s.\n", ponderError(ctx));
+			exit(1);
+		}
+		metricsStop(&metrics, ctx);
+		ponderGetStats(ctx, &report.stats);
+		ponderDestroy(ctx);
+		fflush(outFile);
+		if (outFile != stdout)
+			fclose(outFile);
+		fprintf(stderr, "For n=%" PRIdFAST64 ", %" PRIdFAST64 " start values of depth at least %"
+		        PRIdFAST64 " in [%s, %s)\n", n, found, (!minDepth || minDepth > n) ? n : minDepth,
+		        u128ToString(startValue, valueString), u128ToString(endValue, endString));
+		report.count = found;
+		saveReport(&params, "enumerate", status == PONDER_CANCELLED ? "cancelled" : "complete");
+		return 0;
+	}
 
-/*********************************************************************/
+	memset(&checkpoint, 0, sizeof(checkpoint));
+	if (checkpointFile) {
+		if (resume) {
+			if (!readCheckpoint(checkpointFile, &checkpoint)) {
+				printf("ERROR: cannot read checkpoint file %s.\n", checkpointFile);
+				exit(1);
+			}
+			checkCheckpoint(&checkpoint, "multithreaded", n, stepK);
+			params.startValue = checkpoint.offset + checkpoint.carry;
+			printf("Resuming from %s\n", u128ToString(params.startValue, valueString));
+		}
+		snprintf(checkpoint.engine, sizeof(checkpoint.engine), "multithreaded");
+		snprintf(checkpoint.policy, sizeof(checkpoint.policy), "%s", STEP_NAME);
+		checkpoint.n = n;
+		checkpoint.k = stepK;
+		checkpoint.memSize = memSize;
+		checkpoint.threads = numThreads;
+		checkpoint.carry = 0;
+		installCheckpointSignals();
+		params.stopFlag = &stopRequested;
+	}
+	lastCheckpoint = time(NULL);
 
-/* This function is used for verification purpose. Given an initial value A, it will
- *  check that no member of the sequence A, A+1, A+1+2,... of length n is a prime.
- * It returns 0 if the sequence is correct and the 'incorrect' prime otherwise.
- *  'iterationNbr' is used to keep track of the iteration number
- *  (so the calling code knows which An is prime).
- */
-int_fast64_t CheckSequence(int_fast64_t initialValue, int_fast64_t n, int *iterationNbr) {
-	int_fast64_t nextPrime;
-	*iterationNbr = 1;
-
-	primesieve_jump_to(&it, initialValue, initialValue + n*(n-1));
-	do {
-		while ((nextPrime = primesieve_next_prime(&it)) < initialValue)
-			; // Get the first prime to check
-		if (nextPrime == initialValue)
-			return initialValue;
-		while ((initialValue += (*iterationNbr)++) < nextPrime) {
-			if (*iterationNbr >= n)
-				break; // get next prime
+	/* Engine and window size: calibrated, or the window size of the tuning
+	 *  profile unless -m is given. The engine only changes with --autotune:
+	 *  Algorithm 1 ignores the threads and their placement.
+	 */
+	if (autotune && !checkpoint.found) {
+		tuned = tuneCalibrate(&params, tuneBackwardAllowed(params.startValue) && !shardEnd && !numaMode, verbose);
+		if (!tuneSave(&params, &tuned))
+			printf("WARNING: cannot write the tuning profile.\n");
+		useTuned = 1;
+	} else if (!memSizeGiven && tuneLookup(&params, &tuned)) {
+		// the size of an Algorithm 1 setting is one of its blocks
+		if (!(useTuned = tuned.engine == PONDER_ENGINE_THREADED) && verbose)
+			printf("The tuning profile gives Algorithm 1 for n=%" PRIdFAST64 ", use --autotune to search with it\n", n);
+	}
+	if (useTuned) {
+		params.engine = tuned.engine;
+		params.memSize = checkpoint.memSize = memSize = tuned.memSize;
+		if (verbose || autotune)
+			printf("Tuned setting for n=%" PRIdFAST64 ": %s engine, memSize %" PRIdFAST64 "\n", n,
+			       tuneEngineName(tuned.engine), memSize);
+	}
+
+	if (checkpoint.found)
+		bestValue = checkpoint.bestValue; // nothing left to search
+	else {
+		/* A worker only searches its shard */
+		params.endValue = shardEnd;
+		if (!(ctx = ponderCreate(&params))) {
+			printf("ERROR: cannot allocate the search context.\n");
+			exit(1);
 		}
-		if (nextPrime == initialValue)
-			return initialValue;
-	} while (*iterationNbr < n);
-	if (verbose)
-		printf("Last check was for iteration %d, with value (%" PRIdFAST64 ")\n", *iterationNbr, initialValue);
-	return 0;
+		startMetrics(&params, !startValue || resume);
+		status = ponderSearch(ctx, &bestValue);
+		metricsStop(&metrics, ctx);
+		if (shardEnd && (status == PONDER_FOUND || status == PONDER_NOT_FOUND)) {
+			/* Worker mode: the coordinator verifies the final answer itself */
+			shardResult result = { startValue, shardEnd, shardEnd, 0 };
+			if (status == PONDER_FOUND) {
+				result.watermark = bestValue;
+				result.found = 1;
+			}
+			writeShardResult(stdout, &result);
+			ponderGetStats(ctx, &report.stats);
+			ponderDestroy(ctx);
+			report.value = bestValue;
+			saveReport(&params, "search", reportStatus(status));
+			return 0;
+		}
+		if (status == PONDER_CANCELLED) {
+			saveCheckpoint(ponderWatermark(ctx));
+			printf("Interrupted, every value below %s has been ruled out.\n",
+			       u128ToString(ponderWatermark(ctx), valueString));
+			exit(1);
+		}
+		if (status != PONDER_FOUND) {
+			printf("ERROR: %s.\n", ponderError(ctx));
+			exit(1);
+		}
+		ponderGetStats(ctx, &report.stats);
+		ponderDestroy(ctx);
+	}
+	if (checkpointFile) {
+		checkpoint.found = 1;
+		checkpoint.bestValue = bestValue;
+		saveCheckpoint(bestValue);
+	}
+
+	printf("For n=%" PRIdFAST64 ", a start value of %s has been found\n", n, u128ToString(bestValue, valueString));
+	trace = ponderTraceClock();
+	if (reportFile)
+		reportVerify(&report, bestValue, n, stepK, numThreads);
+	else
+		verifySequence(bestValue, n, stepK, numThreads);
+	ponderTraceEvent(0, "verify", trace, -1);
+	if (certFile)
+		emitCertificate(certFile, bestValue, n, stepK);
+	report.value = bestValue;
+	saveReport(&params, "search", "found");
 }
@@ -0,0 +1,418 @@
+/*********************************************************************
+ * This code benchmarks the searches of the 'IBM Ponder this' challenge
+ * from March 2024
+ * See: research.ibm.com/haifa/ponderthis/challenges/March2024.html
+ *
+ * It runs the engines of libponder (Algorithm 1, Algorithm 2 and the
+ *  threaded Algorithm 3, see libponder/ponder.h) over a matrix of n, window
+ *  sizes and thread counts, each configuration several times, and writes
+ *  for each one the median, mean, standard deviation, minimum and maximum
+ *  of the search time and the median throughput (candidates per second).
+ * Each answer is checked against the table of known results below (and
+ *  all the answers for the same n against each other). Given the CSV
+ *  output of a previous run, the speedup of each configuration is added,
+ *  so each change gets a comparison against the previous baseline.
+ * The exit status is 1 if an answer is wrong.
+ *
+ * libponder uses a prime generator library.
+ * It can be found at github.com/kimwalisch/primesieve/tree/master
+ * and has to be installed before compiling.
+ *
+ * Usage: IBM_ponder_2024-03_bench [-v] [-n n,n...] [-e engine,engine...] [-m memSize,memSize...]
+ *                                 [-t numThreads,numThreads...] [-k mult] [-r repeats] [-c]
+ *                                 [-o csvFile] [-j jsonFile] [-b baselineCsv]
+ *	Options:
+ *	 -v
+ *		verbose mode. Print each run.
+ *
+ *	 -n n,n...
+ *		Values of n (default 100,500,1000).
+ *
+ *	 -e engine,engine...
+ *		Engines: 1 (backward), 2 (window) and 3 (threaded), default all.
+ *
+ *	 -m memSize,memSize...
+ *		Window sizes, 0 being the default of the engine (default 0).
+ *
+ *	 -t numThreads,numThreads...
+ *		Thread counts of the threaded engine (default 1,2,4).
+ *
+ *	 -k mult
+ *		Step multiplier (default is 1). f is chosen when compiling, see
+ *		common/ponder_step.h
+ *
+ *	 -r repeats
+ *		Runs of each configuration (default 3).
+ *
+ *	 -c
+ *		Uses the prime cache file of $PONDER_PRIME_CACHE (by default
+ *		every window is sieved, as the cache makes timings depend on
+ *		the previous runs).
+ *
+ *	 -o csvFile
+ *		Writes the results in csvFile (default is stdout).
+ *
+ *	 -j jsonFile
+ *		Also writes the results, with the time of each run, as JSON.
+ *
+ *	 -b baselineCsv
+ *		CSV output of a previous run: the median of the same
+ *		configuration and the speedup are added to each line.
+ *
+ ********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <string.h>
+#include <math.h>
+
+#include "../common/ponder_step.h"
+#include "../libponder/ponder.h"
+
+#define MAX_LIST 32
+#define MAX_REPEATS 100
+#define MAX_BASELINE 1024
+#define LINE_SIZE 1024
+
+/* Known X_n for the triangular step and k=1 */
+typedef struct {
+	int_fast64_t n;
+	ponder_u128 value;
+} knownValue;
+
+static const knownValue knownValues[] = {
+	{ 3, 9 }, { 50, 945 }, { 100, 5349 }, { 400, 603054 }, { 500, 3279864 },
+	{ 600, 6407664 }, { 700, 26447649 }, { 1000, 115192665 }
+};
+
+static const char *engineNames[] = { "", "backward", "window", "threaded" };
+
+/* A configuration of the matrix and its runs */
+typedef struct {
+	int engine;
+	int_fast64_t n;
+	int_fast64_t memSize;
+	int numThreads;
+	int runs;
+	double seconds[MAX_REPEATS];
+	double rates[MAX_REPEATS];      /* candidates per second */
+	double median, mean, stddev, min, max, rate;
+	ponder_u128 value;
+	const char *check;              /* ok, unknown or WRONG */
+	double baseline;                /* median of the baseline, 0 if none */
+} benchConfig;
+
+int verbose = 0;
+int_fast64_t stepK = 1;
+int repeats = 3;
+int useCache = 0;
+
+/* Baseline: key and median of each configuration of a previous CSV */
+typedef struct {
+	char engine[16];
+	int_fast64_t n, k, memSize;
+	int numThreads;
+	double median;
+} baselineEntry;
+
+baselineEntry baseline[MAX_BASELINE];
+int baselineSize = 0;
+
+/* Parses a comma separated list of positive (or zero) integers */
+int parseList(const char *list, int_fast64_t *values, const char *what) {
+	const char *p = list;
+	char *end;
+	int count = 0;
+
+	while (*p) {
+		if (count == MAX_LIST) {
+			printf("ERROR: at most %d %s.\n", MAX_LIST, what);
+			exit(1);
+		}
+		values[count] = strtoll(p, &end, 10);
+		if (end == p || (*end && *end != ',') || values[count] < 0) {
+			printf("ERROR: incorrect list of %s '%s'.\n", what, list);
+			exit(1);
+		}
+		count++;
+		p = *end ? end + 1 : end;
+	}
+	return count;
+}
+
+/* Reads the CSV written by a previous run */
+void readBaseline(const char *fileName) {
+	char line[LINE_SIZE];
+	FILE *f = fopen(fileName, "r");
+	baselineEntry *b;
+
+	if (!f) {
+		printf("ERROR: cannot read baseline file %s.\n", fileName);
+		exit(1);
+	}
+	while (fgets(line, sizeof(line), f) && baselineSize < MAX_BASELINE) {
+		b = &baseline[baselineSize];
+		/* engine,n,k,memSize,threads,runs,median,... */
+		if (sscanf(line, "%15[^,],%" SCNdFAST64 ",%" SCNdFAST64 ",%" SCNdFAST64 ",%d,%*d,%lf",
+		           b->engine, &b->n, &b->k, &b->memSize, &b->numThreads, &b->median) == 6)
+			baselineSize++;
+	}
+	fclose(f);
+}
+
+double baselineMedian(const benchConfig *c) {
+	for (int i = 0; i < baselineSize; i++)
+		if (!strcmp(baseline[i].engine, engineNames[c->engine]) && baseline[i].n == c->n &&
+		    baseline[i].k == stepK && baseline[i].memSize == c->memSize && baseline[i].numThreads == c->numThreads)
+			return baseline[i].median;
+	return 0;
+}
+
+int compareDoubles(const void *a, const void *b) {
+	double x = *(const double *) a, y = *(const double *) b;
+	return (x > y) - (x < y);
+}
+
+double median(const double *values, int count) {
+	double sorted[MAX_REPEATS];
+
+	memcpy(sorted, values, sizeof(double) * count);
+	qsort(sorted, count, sizeof(double), compareDoubles);
+	return (count & 1) ? sorted[count / 2] : (sorted[count / 2 - 1] + sorted[count / 2]) / 2;
+}
+
+/* Median, mean, sample standard deviation, minimum and maximum of the runs */
+void computeStatistics(benchConfig *c) {
+	double sum = 0, squares = 0;
+
+	c->min = c->max = c->seconds[0];
+	for (int i = 0; i < c->runs; i++) {
+		sum += c->seconds[i];
+		if (c->seconds[i] < c->min)
+			c->min = c->seconds[i];
+		if (c->seconds[i] > c->max)
+			c->max = c->seconds[i];
+	}
+	c->mean = sum / c->runs;
+	for (int i = 0; i < c->runs; i++)
+		squares += (c->seconds[i] - c->mean) * (c->seconds[i] - c->mean);
+	c->stddev = c->runs > 1 ? sqrt(squares / (c->runs - 1)) : 0;
+	c->median = median(c->seconds, c->runs);
+	c->rate = median(c->rates, c->runs);
+}
+
+/* Known answer for n, 0 if none */
+ponder_u128 knownAnswer(int_fast64_t n) {
+	if (strcmp(STEP_NAME, "triangular") || stepK != 1)
+		return 0;
+	for (size_t i = 0; i < sizeof(knownValues) / sizeof(knownValues[0]); i++)
+		if (knownValues[i].n == n)
+			return knownValues[i].value;
+	return 0;
+}
+
+/* Runs a configuration 'repeats' times. 'first' is the answer found for n
+ *  by the previous configurations (0 if none), for the consistency check.
+ */
+void runConfig(benchConfig *c, ponder_u128 first) {
+	char valueString[U128_STRING_SIZE];
+	ponder_u128 known = knownAnswer(c->n), value;
+	ponderParams params;
+	ponderContext *ctx;
+	ponderStats stats = { 0 };
+
+	ponderDefaultParams(&params);
+	params.engine = c->engine;
+	params.n = c->n;
+	params.k = stepK;
+	params.memSize = c->memSize;
+	params.numThreads = c->numThreads;
+	if (!useCache)
+		params.primeCache = NULL;
+	c->check = known ? "ok" : "unknown";
+	for (c->runs = 0; c->runs < repeats; c->runs++) {
+		if (!(ctx = ponderCreate(&params))) {
+			printf("ERROR: cannot allocate the search context.\n");
+			exit(1);
+		}
+		if (ponderSearch(ctx, &value) != PONDER_FOUND) {
+			printf("ERROR: %s (%s engine, n=%" PRIdFAST64 ").\n", ponderError(ctx), engineNames[c->engine], c->n);
+			exit(1);
+		}
+		ponderGetStats(ctx, &stats);
+		ponderDestroy(ctx);
+		c->seconds[c->runs] = stats.totalSeconds;
+		c->rates[c->runs] = stats.totalSeconds > 0 ? stats.tests / stats.totalSeconds : 0;
+		if ((known && value != known) || (first && value != first) || (c->runs && value != c->value))
+			c->check = "WRONG";
+		c->value = value;
+		if (verbose)
+			fprintf(stderr, "%s engine, n=%" PRIdFAST64 ", memSize=%" PRIdFAST64 ", %d threads: %s in %.3f s\n",
+			        engineNames[c->engine], c->n, c->memSize, c->numThreads, u128ToString(value, valueString),
+			        stats.totalSeconds);
+	}
+	ponderFreeStats(&stats);
+	computeStatistics(c);
+	c->baseline = baselineMedian(c);
+}
+
+void writeCsv(FILE *f, const benchConfig *configs, int count) {
+	char valueString[U128_STRING_SIZE];
+
+	fprintf(f, "engine,n,k,memSize,threads,runs,median,mean,stddev,min,max,candidatesPerSecond,value,check,"
+	           "baselineMedian,speedup\n");
+	for (int i = 0; i < count; i++) {
+		const benchConfig *c = &configs[i];
+		fprintf(f, "%s,%" PRIdFAST64 ",%" PRIdFAST64 ",%" PRIdFAST64 ",%d,%d,%.6f,%.6f,%.6f,%.6f,%.6f,%.0f,%s,%s,",
+		        engineNames[c->engine], c->n, stepK, c->memSize, c->numThreads, c->runs, c->median, c->mean,
+		        c->stddev, c->min, c->max, c->rate, u128ToString(c->value, valueString), c->check);
+		if (c->baseline > 0)
+			fprintf(f, "%.6f,%.3f\n", c->baseline, c->baseline / c->median);
+		else
+			fprintf(f, ",\n");
+	}
+}
+
+int writeJson(const char *fileName, const benchConfig *configs, int count) {
+	char valueString[U128_STRING_SIZE];
+	FILE *f = fopen(fileName, "w");
+	int ok;
+
+	if (!f)
+		return 0;
+	fprintf(f, "{\n  \"step\": \"%s\",\n  \"k\": %" PRIdFAST64 ",\n  \"repeats\": %d,\n  \"primeCache\": %s,\n"
+	           "  \"results\": [", STEP_NAME, stepK, repeats, useCache ? "true" : "false");
+	for (int i = 0; i < count; i++) {
+		const benchConfig *c = &configs[i];
+		fprintf(f, "%s\n    { \"engine\": \"%s\", \"n\": %" PRIdFAST64 ", \"memSize\": %" PRIdFAST64
+		        ", \"threads\": %d, \"value\": \"%s\", \"check\": \"%s\",\n      \"seconds\": [",
+		        i ? "," : "", engineNames[c->engine], c->n, c->memSize, c->numThreads,
+		        u128ToString(c->value, valueString), c->check);
+		for (int j = 0; j < c->runs; j++)
+			fprintf(f, "%s%.6f", j ? ", " : "", c->seconds[j]);
+		fprintf(f, "],\n      \"median\": %.6f, \"mean\": %.6f, \"stddev\": %.6f, \"variance\": %.9f, "
+		        "\"min\": %.6f, \"max\": %.6f, \"candidatesPerSecond\": %.0f",
+		        c->median, c->mean, c->stddev, c->stddev * c->stddev, c->min, c->max, c->rate);
+		if (c->baseline > 0)
+			fprintf(f, ",\n      \"baselineMedian\": %.6f, \"speedup\": %.3f", c->baseline, c->baseline / c->median);
+		fprintf(f, " }");
+	}
+	fprintf(f, "\n  ]\n}\n");
+	ok = !ferror(f);
+	return !fclose(f) && ok;
+}
+
+int main(int argc, char **argv) {
+	int_fast64_t ns[MAX_LIST] = { 100, 500, 1000 }, engines[MAX_LIST] = { 1, 2, 3 };
+	int_fast64_t memSizes[MAX_LIST] = { 0 }, threads[MAX_LIST] = { 1, 2, 4 };
+	int numN = 3, numEngines = 3, numMemSizes = 1, numThreadCounts = 3;
+	char *csvFile = NULL, *jsonFile = NULL;
+	benchConfig *configs, *c;
+	int count = 0, wrong = 0;
+	FILE *out = stdout;
+	int opt;
+
+	while ((opt = getopt (argc, argv, "vn:e:m:t:k:r:co:j:b:")) != -1) {
+		switch (opt) {
+			case 'v':
+				verbose = 1;
+				break;
+			case 'n':
+				numN = parseList(optarg, ns, "values of n");
+				break;
+			case 'e':
+				numEngines = parseList(optarg, engines, "engines");
+				break;
+			case 'm':
+				numMemSizes = parseList(optarg, memSizes, "window sizes");
+				break;
+			case 't':
+				numThreadCounts = parseList(optarg, threads, "thread counts");
+				break;
+			case 'k':
+				stepK = strtoll(optarg, NULL, 10);
+				break;
+			case 'r':
+				repeats = strtoll(optarg, NULL, 10);
+				if (repeats <= 0 || repeats > MAX_REPEATS) {
+					printf("Number of repeats has to be between 1 and %d.\n", MAX_REPEATS);
+					exit(1);
+				}
+				break;
+			case 'c':
+				useCache = 1;
+				break;
+			case 'o':
+				csvFile = optarg;
+				break;
+			case 'j':
+				jsonFile = optarg;
+				break;
+			case 'b':
+				readBaseline(optarg);
+				break;
+			case '?':
+				if (optopt == 'n' || optopt == 'e' || optopt == 'm' || optopt == 't' || optopt == 'k' ||
+				    optopt == 'r' || optopt == 'o' || optopt == 'j' || optopt == 'b')
+					fprintf (stderr, "Option -%c requires an argument.\n", optopt);
+				else if (isprint (optopt))
+					fprintf (stderr, "Unknown option `-%c'.\n", optopt);
+				else
+					fprintf (stderr, "Unknown option character `\\x%x'.\n", optopt);
+				fprintf (stderr, "Usage: bench [-v] [-n n,...] [-e engine,...] [-m memSize,...] [-t #threads,...] "
+				                 "[-k mult] [-r repeats] [-c] [-o csv] [-j json] [-b baseline]\n");
+				return 1;
+			default:
+				abort();
+		}
+	}
+	for (int e = 0; e < numEngines; e++)
+		if (engines[e] < PONDER_ENGINE_BACKWARD || engines[e] > PONDER_ENGINE_THREADED) {
+			printf("ERROR: engines are 1, 2 and 3.\n");
+			exit(1);
+		}
+	for (int t = 0; t < numThreadCounts; t++)
+		if (threads[t] <= 0 || threads[t] > PONDER_MAX_THREADS) {
+			printf("Number of threads has to be between 1 and %d.\n", PONDER_MAX_THREADS);
+			exit(1);
+		}
+
+	if (!(configs = calloc(numN * numEngines * numMemSizes * numThreadCounts, sizeof(benchConfig)))) {
+		printf("ERROR: cannot allocate the configurations.\n");
+		exit(1);
+	}
+	for (int i = 0; i < numN; i++) {
+		ponder_u128 first = 0;
+		for (int e = 0; e < numEngines; e++)
+			for (int m = 0; m < numMemSizes; m++)
+				for (int t = 0; t < (engines[e] == PONDER_ENGINE_THREADED ? numThreadCounts : 1); t++) {
+					c = &configs[count++];
+					c->engine = engines[e];
+					c->n = ns[i];
+					c->memSize = memSizes[m];
+					c->numThreads = engines[e] == PONDER_ENGINE_THREADED ? threads[t] : 1;
+					runConfig(c, first);
+					if (!first)
+						first = c->value;
+					wrong |= !strcmp(c->check, "WRONG");
+				}
+	}
+
+	if (csvFile && !(out = fopen(csvFile, "w"))) {
+		printf("ERROR: cannot open output file %s.\n", csvFile);
+		exit(1);
+	}
+	writeCsv(out, configs, count);
+	if (out != stdout)
+		fclose(out);
+	if (jsonFile && !writeJson(jsonFile, configs, count)) {
+		printf("ERROR: cannot write JSON file %s.\n", jsonFile);
+		exit(1);
+	}
+	free(configs);
+	return wrong;
+}
@@ -0,0 +1,92 @@
+/*********************************************************************
+ * This code checks answers to the 'IBM Ponder this' challenge from March 2024
+ * See: research.ibm.com/haifa/ponderthis/challenges/March2024.html
+ *
+ * It reads compositeness certificates written by the searches (-x) and
+ *  checks that each factor is nontrivial and divides its term: one
+ *  division per term, no prime generation, so primesieve is not needed.
+ * It has to be compiled with the same step policy as the search which
+ *  wrote the certificate (see common/ponder_step.h).
+ *
+ * Usage: IBM_ponder_2024-03_certcheck [-t numThreads] certFile...
+ *	Options:
+ *	 -t numThreads
+ *		Uses numThreads threads to check each certificate (default is
+ *		one per online processor).
+ *
+ ********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "../common/ponder_step.h"
+#include "../common/ponder_cert.h"
+
+int main(int argc, char **argv) {
+	int numThreads = 0, errors = 0;
+	int c;
+
+	while ((c = getopt (argc, argv, "t:")) != -1) {
+		switch (c) {
+			case 't':
+				numThreads = strtoll(optarg, NULL, 10);
+				break;
+			case '?':
+				if (optopt == 't')
+					fprintf (stderr, "Option -%c requires an argument.\n", optopt);
+				else if (isprint (optopt))
+					fprintf (stderr, "Unknown option `-%c'.\n", optopt);
+				else
+					fprintf (stderr, "Unknown option character `\\x%x'.\n", optopt);
+				fprintf (stderr, "Usage: certcheck [-t #threads] certFile...\n");
+				return 1;
+			default:
+				abort();
+		}
+	}
+	if (optind == argc) {
+		fprintf (stderr, "Usage: certcheck [-t #threads] certFile...\n");
+		return 1;
+	}
+
+	for (; optind < argc; optind++) {
+		ponderCertificate cert;
+		struct timespec start, end;
+		char value[U128_STRING_SIZE];
+		int_fast64_t failed;
+
+		if (!readCertificate(argv[optind], &cert)) {
+			printf("ERROR: %s is not a valid certificate file.\n", argv[optind]);
+			errors++;
+			continue;
+		}
+		if (strcmp(cert.policy, STEP_NAME)) {
+			printf("ERROR: %s is for the %s step, this checker was compiled for the %s step.\n",
+			       argv[optind], cert.policy, STEP_NAME);
+			errors++;
+			free(cert.factors);
+			continue;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		failed = checkCertificate(&cert, numThreads);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		u128ToString(cert.initialValue, value);
+		if (failed < cert.n) {
+			printf("ERROR: %s, factor %" PRIu64 " of term %" PRIdFAST64 " is wrong.\n",
+			       argv[optind], cert.factors[failed], failed);
+			errors++;
+		} else
+			printf("SUCCESS! every term of n=%" PRIdFAST64 ", k=%" PRIdFAST64 " starting at %s is not prime.\n",
+			       cert.n, cert.k, value);
+		printf("Check of %" PRIdFAST64 " terms took %.0f microseconds.\n", cert.n,
+		       (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) * 1e-3);
+		free(cert.factors);
+	}
+	return errors ? 1 : 0;
+}
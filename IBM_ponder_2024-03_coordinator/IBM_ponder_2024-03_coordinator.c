@@ -0,0 +1,432 @@
+/*********************************************************************
+ * This code solves the 'IBM Ponder this' challenge from March 2024
+ * See: research.ibm.com/haifa/ponderthis/challenges/March2024.html
+ *
+ * It does not search by itself: it splits the integers in shards of
+ *  consecutive values and hands them out to several processes of
+ *  IBM_ponder_2024-03_2_MT running in worker mode (-w). Each worker
+ *  writes its result on a Unix socket (see common/ponder_shard.h).
+ * A worker dying without giving a result gets its shard given again to
+ *  a new worker. When a value is found, workers on shards after it are
+ *  stopped, and the coordinator only waits for the shards before it.
+ * On an error, SIGINT or SIGTERM, it stops its workers before leaving.
+ *
+ * Usage: IBM_ponder_2024-03_coordinator [-v] [-p workers] [-S shardSize]
+ *                        [-s startValue] [-x workerPath] [-t numThreads]
+ *                        [-m memSize] [-k mult] n
+ *	Options:
+ *	 -v
+ *		verbose mode. Print information during the search.
+ *
+ *	 -p workers
+ *		Number of worker processes running at the same time (default 2).
+ *
+ *	 -S shardSize
+ *		Number of start values in a shard (default is one billion).
+ *
+ *	 -s startValue
+ *		The search will start at the given startValue.
+ *
+ *	 -x workerPath
+ *		Worker executable (default is ./IBM_ponder_2024-03_2_MT).
+ *
+ *	 -t numThreads, -m memSize
+ *		Passed to each worker.
+ *
+ *	 -k mult
+ *		Step multiplier, passed to each worker. The coordinator must be
+ *		compiled with the same step policy as the workers.
+ *
+ ********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include "../common/ponder_step.h"
+#include "../common/ponder_u128.h"
+#include "../common/ponder_verify.h"
+#include "../common/ponder_shard.h"
+
+#define MAX_WORKERS 256
+#define MAX_ATTEMPTS 3   /* a shard failing that many times stops the search */
+#define LINE_SIZE 256
+
+enum { SHARD_PENDING, SHARD_RUNNING, SHARD_DONE, SHARD_CANCELLED };
+
+typedef struct {
+	shardResult result; /* start and end are set when the shard is created */
+	int state;
+	int attempts;
+} shard;
+
+typedef struct {
+	pid_t pid;          /* 0 if the slot is free */
+	int fd;             /* our end of the socket */
+	int shardIndex;
+	int gotResult;
+	char line[LINE_SIZE];
+	int lineSize;
+} worker;
+
+int verbose = 0;
+volatile sig_atomic_t stopRequested = 0; /* SIGINT or SIGTERM */
+shard *shards = NULL;
+int numShards = 0, maxShards = 0;
+worker workers[MAX_WORKERS];
+int numWorkers = 2;
+
+/* Worker command line, the start and end values are filled for each shard */
+char *workerPath = "./IBM_ponder_2024-03_2_MT";
+char *workerArgs[16];
+int startArg, endArg;
+
+/* Stops the workers still running and waits for them, before leaving
+ *  or on an error: they must not keep searching on their own.
+ */
+void stopWorkers(void) {
+	for (int i = 0; i < numWorkers; i++) {
+		if (!workers[i].pid)
+			continue;
+		kill(workers[i].pid, SIGTERM);
+		close(workers[i].fd);
+		waitpid(workers[i].pid, NULL, 0);
+		workers[i].pid = 0;
+	}
+}
+
+static void stopSignalHandler(int sig) {
+	(void) sig;
+	stopRequested = 1;
+}
+
+/* Returns the index of a new pending shard [start, start+size) */
+int addShard(ponder_u128 start, ponder_u128 size) {
+	if (numShards == maxShards) {
+		maxShards = maxShards ? 2 * maxShards : 64;
+		if (!(shards = realloc(shards, maxShards * sizeof(shard)))) {
+			printf("ERROR: cannot allocate shards.\n");
+			stopWorkers();
+			exit(1);
+		}
+	}
+	memset(&shards[numShards], 0, sizeof(shard));
+	shards[numShards].result.start = start;
+	shards[numShards].result.end = (PONDER_U128_MAX - start < size) ? PONDER_U128_MAX : start + size;
+	shards[numShards].state = SHARD_PENDING;
+	return numShards++;
+}
+
+/* Starts a worker process on a shard. Its standard output is one end of
+ *  a socket pair, we keep the other.
+ */
+void launchWorker(worker *w, int shardIndex) {
+	char start[U128_STRING_SIZE], end[U128_STRING_SIZE];
+	int sv[2];
+	shard *s = &shards[shardIndex];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) {
+		printf("ERROR: cannot create socket: %s.\n", strerror(errno));
+		stopWorkers();
+		exit(1);
+	}
+	workerArgs[startArg] = u128ToString(s->result.start, start);
+	workerArgs[endArg] = u128ToString(s->result.end, end);
+	fflush(stdout);
+	if (!(w->pid = fork())) {
+		close(sv[0]);
+		dup2(sv[1], STDOUT_FILENO);
+		close(sv[1]);
+		execv(workerPath, workerArgs);
+		fprintf(stderr, "ERROR: cannot run %s: %s.\n", workerPath, strerror(errno));
+		_exit(1);
+	}
+	if (w->pid < 0) {
+		printf("ERROR: cannot fork: %s.\n", strerror(errno));
+		w->pid = 0;
+		close(sv[0]);
+		close(sv[1]);
+		stopWorkers();
+		exit(1);
+	}
+	close(sv[1]);
+	w->fd = sv[0];
+	w->shardIndex = shardIndex;
+	w->gotResult = 0;
+	w->lineSize = 0;
+	s->state = SHARD_RUNNING;
+	s->attempts++;
+	if (verbose)
+		printf("Worker %d started on [%s, %s)\n", (int) w->pid, start, end);
+}
+
+/* Stops the workers of every shard starting after 'value': they cannot
+ *  improve on it anymore.
+ */
+void cancelShardsAfter(ponder_u128 value) {
+	for (int i = 0; i < numShards; i++) {
+		if (shards[i].result.start <= value || shards[i].state == SHARD_DONE)
+			continue;
+		shards[i].state = SHARD_CANCELLED;
+	}
+	for (int i = 0; i < numWorkers; i++)
+		if (workers[i].pid && shards[workers[i].shardIndex].state == SHARD_CANCELLED)
+			kill(workers[i].pid, SIGTERM);
+}
+
+/* Handles a line written by a worker. Returns the value found if any
+ *  (or PONDER_U128_MAX).
+ */
+ponder_u128 workerLine(worker *w) {
+	shardResult r;
+	shard *s = &shards[w->shardIndex];
+
+	if (!parseShardResult(w->line, &r))
+		return PONDER_U128_MAX; // information or garbage
+	if (r.start != s->result.start || r.end != s->result.end) {
+		printf("WARNING: worker %d answered for another shard.\n", (int) w->pid);
+		return PONDER_U128_MAX;
+	}
+	w->gotResult = 1;
+	if (s->state == SHARD_CANCELLED)
+		return PONDER_U128_MAX;
+	s->result = r;
+	s->state = SHARD_DONE;
+	return r.found ? r.watermark : PONDER_U128_MAX;
+}
+
+/* Called when the socket of a worker is closed: the process is over.
+ *  If it did not give its result, the shard is given again later.
+ */
+void workerExit(worker *w) {
+	int status;
+	shard *s = &shards[w->shardIndex];
+
+	close(w->fd);
+	waitpid(w->pid, &status, 0);
+	if (!w->gotResult && s->state == SHARD_RUNNING) {
+		char start[U128_STRING_SIZE], end[U128_STRING_SIZE];
+		u128ToString(s->result.start, start);
+		u128ToString(s->result.end, end);
+		if (s->attempts >= MAX_ATTEMPTS) {
+			printf("ERROR: shard [%s, %s) failed %d times.\n", start, end, s->attempts);
+			w->pid = 0;
+			stopWorkers();
+			exit(1);
+		}
+		printf("WARNING: worker %d died on [%s, %s), shard reassigned.\n", (int) w->pid, start, end);
+		s->state = SHARD_PENDING;
+	}
+	w->pid = 0;
+}
+
+int main(int argc, char **argv) {
+	ponder_u128 startValue = 0, shardSize = 1000000000, nextStart, best = PONDER_U128_MAX;
+	int_fast64_t n, stepK = 1;
+	char *numThreads = NULL, *memSize = NULL, *stepArg = NULL;
+	char valueString[U128_STRING_SIZE];
+	struct pollfd fds[MAX_WORKERS];
+	int pollWorker[MAX_WORKERS];
+	struct sigaction action;
+	shardResult prefix;
+	int prefixShard = 0;
+	int c, a = 0;
+
+	while ((c = getopt (argc, argv, "vp:S:s:x:t:m:k:")) != -1) {
+		switch (c) {
+			case 'v':
+				verbose = 1;
+				break;
+			case 'p':
+				numWorkers = strtoll(optarg, NULL, 10);
+				if ((numWorkers <= 0) || (numWorkers > MAX_WORKERS)) {
+					printf("Number of workers has to be between 1 and %d.\n", MAX_WORKERS);
+					exit(1);
+				}
+				break;
+			case 'S':
+				if (!parseU128(optarg, &shardSize) || !shardSize) {
+					printf("ERROR: incorrect shard size %s.\n", optarg);
+					exit(1);
+				}
+				break;
+			case 's':
+				if (!parseU128(optarg, &startValue)) {
+					printf("ERROR: incorrect start value %s.\n", optarg);
+					exit(1);
+				}
+				break;
+			case 'x':
+				workerPath = optarg;
+				break;
+			case 't':
+				numThreads = optarg;
+				break;
+			case 'm':
+				memSize = optarg;
+				break;
+			case 'k':
+				stepArg = optarg;
+				stepK = strtoll(optarg, NULL, 10);
+				break;
+			case '?':
+				if (optopt == 'p' || optopt == 'S' || optopt == 's' || optopt == 'x' ||
+				    optopt == 't' || optopt == 'm' || optopt == 'k')
+					fprintf (stderr, "Option -%c requires an argument.\n", optopt);
+				else if (isprint (optopt))
+					fprintf (stderr, "Unknown option `-%c'.\n", optopt);
+				else
+					fprintf (stderr, "Unknown option character `\\x%x'.\n", optopt);
+				fprintf (stderr, "Usage: coordinator [-v] [-p workers] [-S shardSize] [-s start] "
+				                 "[-x worker] [-t #threads] [-m memsize] [-k mult] n\n");
+				return 1;
+			default:
+				abort();
+		}
+	}
+	if (optind+1 != argc) {
+		fprintf (stderr, "Usage: coordinator [-v] [-p workers] [-S shardSize] [-s start] "
+		                 "[-x worker] [-t #threads] [-m memsize] [-k mult] n\n");
+		return 1;
+	}
+	n = strtoll(argv[optind], NULL, 10);
+
+	/* Worker command line: worker [-t T] [-m M] [-k K] -s start -w end n */
+	workerArgs[a++] = workerPath;
+	if (numThreads) {
+		workerArgs[a++] = "-t";
+		workerArgs[a++] = numThreads;
+	}
+	if (memSize) {
+		workerArgs[a++] = "-m";
+		workerArgs[a++] = memSize;
+	}
+	if (stepArg) {
+		workerArgs[a++] = "-k";
+		workerArgs[a++] = stepArg;
+	}
+	workerArgs[a++] = "-s";
+	startArg = a++;
+	workerArgs[a++] = "-w";
+	endArg = a++;
+	workerArgs[a++] = argv[optind];
+	workerArgs[a] = NULL;
+
+	/* A dead worker must not kill us when we stop it */
+	signal(SIGPIPE, SIG_IGN);
+	/* Stopped, we stop the workers first (poll is interrupted, not restarted) */
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = stopSignalHandler;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	memset(workers, 0, sizeof(workers));
+	memset(&prefix, 0, sizeof(prefix));
+	prefix.start = prefix.end = prefix.watermark = startValue;
+	nextStart = startValue;
+
+	while (1) {
+		int running = 0, numFds = 0;
+
+		/* Give work to free workers, lowest shards first */
+		for (int i = 0; i < numWorkers; i++) {
+			int s;
+			if (workers[i].pid)
+				continue;
+			for (s = prefixShard; s < numShards; s++)
+				if (shards[s].state == SHARD_PENDING && shards[s].result.start < best)
+					break;
+			if (s == numShards) {
+				if (nextStart >= best || nextStart == PONDER_U128_MAX)
+					break;
+				s = addShard(nextStart, shardSize);
+				nextStart = shards[s].result.end;
+			}
+			launchWorker(&workers[i], s);
+		}
+		for (int i = 0; i < numWorkers; i++) {
+			if (!workers[i].pid)
+				continue;
+			running++;
+			fds[numFds].fd = workers[i].fd;
+			fds[numFds].events = POLLIN;
+			pollWorker[numFds++] = i;
+		}
+		if (!running)
+			break;
+
+		if (stopRequested) {
+			printf("ERROR: interrupted, the workers have been stopped.\n");
+			stopWorkers();
+			exit(1);
+		}
+		if (poll(fds, numFds, 1000) < 0) { // a signal just before poll is seen a second later
+			if (errno == EINTR)
+				continue;
+			printf("ERROR: poll failed: %s.\n", strerror(errno));
+			stopWorkers();
+			exit(1);
+		}
+		for (int f = 0; f < numFds; f++) {
+			worker *w = &workers[pollWorker[f]];
+			char buffer[LINE_SIZE];
+			ssize_t size;
+
+			if (!fds[f].revents)
+				continue;
+			if ((size = read(w->fd, buffer, sizeof(buffer))) <= 0) {
+				workerExit(w);
+				continue;
+			}
+			/* Cut the stream in lines */
+			for (ssize_t b = 0; b < size; b++) {
+				ponder_u128 value;
+				if (buffer[b] != '\n') {
+					if (w->lineSize < LINE_SIZE - 1)
+						w->line[w->lineSize++] = buffer[b];
+					continue;
+				}
+				w->line[w->lineSize] = 0;
+				w->lineSize = 0;
+				if ((value = workerLine(w)) < best) {
+					best = value;
+					if (verbose)
+						printf("Value %s found, stopping later shards\n", u128ToString(best, valueString));
+					cancelShardsAfter(best);
+				}
+			}
+		}
+
+		/* Merge the shards completed in order */
+		while (prefixShard < numShards && shards[prefixShard].state == SHARD_DONE &&
+		       mergeShardResult(&prefix, &shards[prefixShard].result) && !prefix.found) {
+			prefixShard++;
+			if (verbose)
+				printf("Every value below %s has been ruled out\n", u128ToString(prefix.watermark, valueString));
+		}
+		if (prefix.found)
+			break;
+	}
+
+	/* The remaining workers, if any, are on cancelled shards */
+	stopWorkers();
+	free(shards);
+
+	if (!prefix.found) {
+		printf("ERROR: no start value below %s.\n", u128ToString(prefix.watermark, valueString));
+		exit(1);
+	}
+	printf("For n=%" PRIdFAST64 ", a start value of %s has been found\n", n, u128ToString(prefix.watermark, valueString));
+	verifySequence(prefix.watermark, n, stepK, 0);
+	return 0;
+}
@@ -0,0 +1,922 @@
+/*********************************************************************
+ * This code solves the 'IBM Ponder this' challenge from March 2024
+ * See: research.ibm.com/haifa/ponderthis/challenges/March2024.html
+ *
+ * It is a long-running server answering X_n and depth queries on a Unix
+ *  socket, so that a workload of many queries does not sieve the same
+ *  integers again for each of them:
+ *  - the sieved primes are kept in memory as tiles of TILE_SIZE integers
+ *    (one bit per integer), the least recently used tile being dropped
+ *    when the cache is full. libponder gets its windows from them.
+ *  - the answers and the lower bounds found so far are kept as well. A
+ *    correct value for n is correct for any smaller n, so X_m for m >= n
+ *    and the lower bounds for m <= n help answering X_n (nearby queries).
+ *  - concurrent X_n queries are answered by one batch search (Algorithm 3
+ *    batch mode), a query arriving during a search making it restart from
+ *    where it is with the new parameter set. Depth queries with the same
+ *    step multiplier on overlapping ranges are answered by one enumeration.
+ * The searches are done by libponder (see libponder/ponder.h) in a single
+ *  sweeper thread, each client having its own thread.
+ *
+ * Protocol: one request per line, answers are text lines.
+ *	SEARCH n [k]
+ *		-> X n k value source microseconds
+ *		   source is cached, nearby, coalesced (answered by the search
+ *		   of another query) or swept.
+ *	DEPTH n k start end [minDepth]
+ *		-> one line "value depth" for each start value of [start, end)
+ *		   whose first minDepth terms (default n) are not prime, in
+ *		   increasing order, then END count source microseconds
+ *		   end - start is at most DEPTH_MAX_RANGE (2^28): larger ranges
+ *		   have to be split into several queries, so that one query
+ *		   cannot hold the sweeper (and every SEARCH) for long.
+ *	STATS
+ *		-> cache, search and latency statistics, then END
+ *	Errors are answered by a line ERROR message.
+ *  For instance: echo "SEARCH 1000" | nc -U /tmp/IBM_ponder_2024-03.sock
+ *
+ * Usage: IBM_ponder_2024-03_daemon [-v] [-u socketPath] [-t numThreads]
+ *                                  [-m memSize] [-c cacheSize]
+ *	Options:
+ *	 -v
+ *		verbose mode. Print each request served.
+ *
+ *	 -u socketPath
+ *		Unix socket to listen on (default /tmp/IBM_ponder_2024-03.sock).
+ *
+ *	 -t numThreads
+ *		Number of search threads (default 1).
+ *
+ *	 -m memSize
+ *		Size of the windows of the searches (default is one hundred
+ *		millions).
+ *
+ *	 -c cacheSize
+ *		Memory used by the prime tiles in MB (default 128, ie: about
+ *		one billion integers).
+ *
+ * libponder uses a prime generator library.
+ * It can be found at github.com/kimwalisch/primesieve/tree/master
+ * and has to be installed before compiling.
+ ********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <primesieve.h>
+
+#include "../common/ponder_step.h"
+#include "../common/ponder_checkpoint.h"
+#include "../libponder/ponder.h"
+
+#define LINE_SIZE 256
+#define TILE_SIZE (1 << 24)                  /* integers in a prime tile */
+#define TILE_LIMIT (UINT64_MAX - (1 << 25))  /* no tile past it, primesieve stops at 2^64 */
+#define MAX_BATCH 64
+#define DEPTH_CACHE_SIZE 32                  /* enumerations remembered */
+#define DEPTH_CACHE_VALUES 65536             /* larger ones are not */
+#define DEPTH_MAX_VALUES (1 << 22)           /* larger ones are refused */
+#define DEPTH_MAX_RANGE (1 << 28)            /* start values of a query, and of a merged group */
+#define LATENCY_BUCKETS 40                   /* bucket i: latency < 2^i microseconds */
+
+/* A tile: bit i of bits is set if index*TILE_SIZE + i is prime */
+typedef struct {
+	uint64_t index;
+	unsigned char *bits;
+	uint64_t lastUse;
+} primeTile;
+
+/* What is known for a parameter set: no start value below lowerBound is
+ *  correct, and if found is set, lowerBound is X_n.
+ */
+typedef struct {
+	int_fast64_t n, k;
+	ponder_u128 lowerBound;
+	int found;
+	int pending;        /* waiting for or in a batch search */
+	int failed;         /* the last search gave an error */
+} knownResult;
+
+typedef struct {
+	ponder_u128 value;
+	int_fast64_t depth;
+} depthValue;
+
+typedef struct depthQuery {
+	int_fast64_t n, k, minDepth;
+	ponder_u128 start, end;
+	depthValue *values; /* answer, allocated by the sweeper */
+	int_fast64_t count;
+	int done;
+	const char *source;
+	char error[128];
+	struct depthQuery *next;
+} depthQuery;
+
+/* An enumeration with n and minDepth over [start, end), values sorted */
+typedef struct {
+	int_fast64_t n, k, minDepth;
+	ponder_u128 start, end;
+	depthValue *values;
+	int_fast64_t count;
+} depthCacheEntry;
+
+typedef struct {
+	int_fast64_t count;
+	double totalMicros, maxMicros;
+	int_fast64_t buckets[LATENCY_BUCKETS];
+} latencyStats;
+
+int verbose = 0;
+char *socketPath = "/tmp/IBM_ponder_2024-03.sock";
+int numThreads = 1;
+int_fast64_t memSize = 100000000L;
+
+/* Everything below is protected by the mutex, except the tiles which
+ *  only the sweeper thread uses.
+ */
+pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t workCond = PTHREAD_COND_INITIALIZER;  /* the sweeper has work */
+pthread_cond_t doneCond = PTHREAD_COND_INITIALIZER;  /* a query has been answered */
+int newWork = 0;        /* work arrived which the running search does not cover */
+
+knownResult *results = NULL;
+int numResults = 0, maxResults = 0;
+int sweep[MAX_BATCH];   /* results searched by the running batch */
+int sweepSize = 0;
+
+depthQuery *depthHead = NULL, *depthTail = NULL;
+depthCacheEntry depthCache[DEPTH_CACHE_SIZE];
+int depthCacheNext = 0;
+
+primeTile *tiles = NULL;
+int numTiles = 0, maxTiles = 128 * 8 * 1024 * 1024 / TILE_SIZE;
+uint64_t tileClock = 0;
+primesieve_iterator tileIterator;
+char expandTable[256][8];
+
+/* Statistics */
+int_fast64_t tileHits = 0, tileMisses = 0, tileEvictions = 0;
+int_fast64_t searchCached = 0, searchNearby = 0, searchCoalesced = 0, searchSwept = 0;
+int_fast64_t depthCached = 0, depthCoalesced = 0, depthSwept = 0;
+int_fast64_t batchSweeps = 0, depthSweeps = 0, cancelledSweeps = 0, errors = 0;
+latencyStats searchLatency, depthLatency;
+
+/*********************************************************************
+ * Prime tiles
+ *********************************************************************/
+
+/* Returns the tile of the given index, sieving it (in place of the least
+ *  recently used one if the cache is full) if it is not in the cache.
+ */
+primeTile *getTile(uint64_t index, int_fast64_t *hits, int_fast64_t *misses, int_fast64_t *evictions) {
+	primeTile *t = NULL;
+	uint64_t low = index * TILE_SIZE, p;
+	int i;
+
+	for (i = 0; i < numTiles; i++)
+		if (tiles[i].index == index) {
+			tiles[i].lastUse = ++tileClock;
+			(*hits)++;
+			return &tiles[i];
+		}
+	(*misses)++;
+	if (numTiles < maxTiles) {
+		t = &tiles[numTiles];
+		if (!(t->bits = malloc(TILE_SIZE / 8)))
+			return NULL;
+		numTiles++;
+	} else {
+		t = &tiles[0];
+		for (i = 1; i < numTiles; i++)
+			if (tiles[i].lastUse < t->lastUse)
+				t = &tiles[i];
+		(*evictions)++;
+	}
+	t->index = index;
+	t->lastUse = ++tileClock;
+	memset(t->bits, 0, TILE_SIZE / 8);
+	primesieve_jump_to(&tileIterator, low, low + TILE_SIZE);
+	while ((p = primesieve_next_prime(&tileIterator)) < low + TILE_SIZE)
+		t->bits[(p - low) >> 3] |= 1 << ((p - low) & 7);
+	return t;
+}
+
+/* Writes len bytes, 1 for a set bit and 0 otherwise, from bit 'bit' */
+void expandBits(const unsigned char *bits, uint64_t bit, char *out, int_fast64_t len) {
+	for (; len && (bit & 7); len--, bit++)
+		*out++ = (bits[bit >> 3] >> (bit & 7)) & 1;
+	for (; len >= 8; len -= 8, bit += 8, out += 8)
+		memcpy(out, expandTable[bits[bit >> 3]], 8);
+	for (; len; len--, bit++)
+		*out++ = (bits[bit >> 3] >> (bit & 7)) & 1;
+}
+
+/* libponder window function: the window is copied from the tiles */
+int fillWindow(void *userData, ponder_u128 offset, char *array, int_fast64_t size) {
+	int_fast64_t hits = 0, misses = 0, evictions = 0, i = 0, len;
+	uint64_t pos = (uint64_t) offset;
+	primeTile *t;
+
+	(void) userData;
+	if (offset + size > TILE_LIMIT)
+		return 0;
+	while (i < size) {
+		if (!(t = getTile(pos / TILE_SIZE, &hits, &misses, &evictions)))
+			return 0;
+		len = TILE_SIZE - pos % TILE_SIZE;
+		if (len > size - i)
+			len = size - i;
+		expandBits(t->bits, pos % TILE_SIZE, array + i, len);
+		i += len;
+		pos += len;
+	}
+	pthread_mutex_lock(&mutex);
+	tileHits += hits;
+	tileMisses += misses;
+	tileEvictions += evictions;
+	pthread_mutex_unlock(&mutex);
+	return 1;
+}
+
+/*********************************************************************
+ * Known results
+ *********************************************************************/
+
+/* Returns the index of the result of (n, k), adding it if needed */
+int findResult(int_fast64_t n, int_fast64_t k) {
+	int i;
+
+	for (i = 0; i < numResults; i++)
+		if (results[i].n == n && results[i].k == k)
+			return i;
+	if (numResults == maxResults) {
+		maxResults = maxResults ? 2 * maxResults : 64;
+		if (!(results = realloc(results, maxResults * sizeof(knownResult)))) {
+			printf("ERROR: cannot allocate results.\n");
+			exit(1);
+		}
+	}
+	memset(&results[numResults], 0, sizeof(knownResult));
+	results[numResults].n = n;
+	results[numResults].k = k;
+	return numResults++;
+}
+
+/* Best known lower bound of X_n: a value ruled out for m <= n terms is
+ *  ruled out for n terms.
+ */
+ponder_u128 knownLowerBound(int_fast64_t n, int_fast64_t k) {
+	ponder_u128 bound = 0;
+
+	for (int i = 0; i < numResults; i++)
+		if (results[i].k == k && results[i].n <= n && results[i].lowerBound > bound)
+			bound = results[i].lowerBound;
+	return bound;
+}
+
+/* Looks for X_n among the known results. Returns 1 if it is X_n itself,
+ *  2 if it comes from a nearby result (X_m for m > n, which is correct for
+ *  n as well, reached by the lower bound of X_n), 0 if it is unknown.
+ */
+int knownAnswer(int_fast64_t n, int_fast64_t k, ponder_u128 *value) {
+	ponder_u128 bound = knownLowerBound(n, k);
+	int i;
+
+	for (i = 0; i < numResults; i++)
+		if (results[i].k == k && results[i].n == n && results[i].found) {
+			*value = results[i].lowerBound;
+			return 1;
+		}
+	for (i = 0; i < numResults; i++)
+		if (results[i].k == k && results[i].n > n && results[i].found && results[i].lowerBound == bound) {
+			*value = bound;
+			i = findResult(n, k); // remember it
+			results[i].lowerBound = bound;
+			results[i].found = 1;
+			return 2;
+		}
+	return 0;
+}
+
+/*********************************************************************
+ * Depth results
+ *********************************************************************/
+
+/* Answers q from a cached enumeration over a range covering it, for the
+ *  same k, at least as many terms and a depth not larger. Its depths are
+ *  capped to q->n. Returns 1 if found.
+ */
+int lookupDepth(depthQuery *q) {
+	for (int c = 0; c < DEPTH_CACHE_SIZE; c++) {
+		depthCacheEntry *e = &depthCache[c];
+		if (!e->values || e->k != q->k || e->n < q->n || e->minDepth > q->minDepth ||
+		    e->start > q->start || e->end < q->end)
+			continue;
+		q->count = 0;
+		if (!(q->values = malloc((e->count ? e->count : 1) * sizeof(depthValue)))) {
+			snprintf(q->error, sizeof(q->error), "cannot allocate the answer");
+			return 1;
+		}
+		for (int_fast64_t i = 0; i < e->count; i++) {
+			if (e->values[i].value < q->start || e->values[i].value >= q->end ||
+			    e->values[i].depth < q->minDepth)
+				continue;
+			q->values[q->count].value = e->values[i].value;
+			q->values[q->count++].depth = e->values[i].depth < q->n ? e->values[i].depth : q->n;
+		}
+		return 1;
+	}
+	return 0;
+}
+
+/* Keeps a copy of an enumeration if it is small enough */
+void storeDepth(int_fast64_t n, int_fast64_t k, int_fast64_t minDepth, ponder_u128 start, ponder_u128 end,
+                const depthValue *values, int_fast64_t count) {
+	depthCacheEntry *e = &depthCache[depthCacheNext];
+
+	if (count > DEPTH_CACHE_VALUES)
+		return;
+	free(e->values);
+	if (!(e->values = malloc((count ? count : 1) * sizeof(depthValue))))
+		return;
+	memcpy(e->values, values, count * sizeof(depthValue));
+	e->n = n;
+	e->k = k;
+	e->minDepth = minDepth;
+	e->start = start;
+	e->end = end;
+	e->count = count;
+	depthCacheNext = (depthCacheNext + 1) % DEPTH_CACHE_SIZE;
+}
+
+/*********************************************************************
+ * Sweeper thread
+ *********************************************************************/
+
+ponderContext *sweepContext;
+depthValue *sweepValues = NULL;  /* values of the running enumeration */
+int_fast64_t sweepCount = 0, sweepMax = 0;
+
+/* Batch progress: every parameter set still searched has no correct value
+ *  below the watermark. The batch stops if new work has arrived (in case
+ *  it arrived before the search started and could not cancel it).
+ */
+int batchProgress(void *userData, ponder_u128 watermark, const ponderStats *stats) {
+	int stop;
+
+	(void) userData;
+	(void) stats;
+	pthread_mutex_lock(&mutex);
+	for (int j = 0; j < sweepSize; j++) {
+		knownResult *r = &results[sweep[j]];
+		if (!r->found && r->lowerBound < watermark)
+			r->lowerBound = watermark;
+	}
+	stop = newWork;
+	pthread_mutex_unlock(&mutex);
+	return stop;
+}
+
+void batchFound(void *userData, int set, ponder_u128 value) {
+	(void) userData;
+	pthread_mutex_lock(&mutex);
+	results[sweep[set]].lowerBound = value;
+	results[sweep[set]].found = 1;
+	results[sweep[set]].pending = 0;
+	pthread_cond_broadcast(&doneCond);
+	pthread_mutex_unlock(&mutex);
+}
+
+/* Called with the lock held: runs (without it) one batch search over the
+ *  pending parameter sets, from the smallest of their lower bounds.
+ */
+void runBatch(void) {
+	ponderBatchSet sets[MAX_BATCH];
+	ponderParams params;
+	ponder_u128 start = PONDER_U128_MAX, bound;
+	ponderStatus status;
+
+	sweepSize = 0;
+	for (int i = 0; i < numResults && sweepSize < MAX_BATCH; i++) {
+		if (!results[i].pending)
+			continue;
+		sets[sweepSize].n = results[i].n;
+		sets[sweepSize].k = results[i].k;
+		if ((bound = knownLowerBound(results[i].n, results[i].k)) < start)
+			start = bound;
+		sweep[sweepSize++] = i;
+	}
+	newWork = 0;
+	batchSweeps++;
+	pthread_mutex_unlock(&mutex);
+
+	ponderDefaultParams(&params);
+	params.engine = PONDER_ENGINE_THREADED;
+	params.numThreads = numThreads;
+	params.memSize = memSize;
+	params.startValue = start;
+	params.stopFlag = &stopRequested;
+	params.progress = batchProgress;
+	params.window = fillWindow;
+	ponderSetParams(sweepContext, &params);
+	status = ponderBatch(sweepContext, sets, sweepSize, batchFound);
+
+	pthread_mutex_lock(&mutex);
+	if (status == PONDER_CANCELLED)
+		cancelledSweeps++;
+	else if (status == PONDER_ERROR) {
+		printf("ERROR: %s.\n", ponderError(sweepContext));
+		for (int j = 0; j < sweepSize; j++)
+			if (!results[sweep[j]].found) {
+				results[sweep[j]].pending = 0;
+				results[sweep[j]].failed = 1;
+			}
+		pthread_cond_broadcast(&doneCond);
+	}
+	sweepSize = 0;
+}
+
+/* libponder enumerate callback, from its single writer thread */
+void collectDepth(void *userData, ponder_u128 value, int_fast64_t depth) {
+	(void) userData;
+	if (sweepCount == sweepMax) {
+		if (sweepMax == DEPTH_MAX_VALUES) {
+			sweepCount++; // overflow, see runDepth()
+			return;
+		}
+		if (sweepCount > sweepMax)
+			return;
+		sweepMax = sweepMax ? 2 * sweepMax : 4096;
+		if (sweepMax > DEPTH_MAX_VALUES)
+			sweepMax = DEPTH_MAX_VALUES;
+		if (!(sweepValues = realloc(sweepValues, sweepMax * sizeof(depthValue)))) {
+			printf("ERROR: cannot allocate depth values.\n");
+			exit(1);
+		}
+	}
+	sweepValues[sweepCount].value = value;
+	sweepValues[sweepCount++].depth = depth;
+}
+
+int compareDepthValues(const void *a, const void *b) {
+	ponder_u128 x = ((const depthValue *) a)->value, y = ((const depthValue *) b)->value;
+	return (x > y) - (x < y);
+}
+
+/* Called with the lock held: takes the first depth query and every queued
+ *  one with the same k whose range overlaps theirs, as long as the merged
+ *  range stays within DEPTH_MAX_RANGE, and answers them (with the lock
+ *  released) with a single enumeration for the largest n and the smallest
+ *  depth.
+ */
+void runDepth(void) {
+	depthQuery *group = NULL, **q;
+	int_fast64_t n, minDepth;
+	ponder_u128 start, end;
+	ponderParams params;
+	ponderStatus status;
+	int_fast64_t total;
+	int changed = 1;
+
+	group = depthHead;
+	depthHead = group->next;
+	group->next = NULL;
+	n = group->n;
+	minDepth = group->minDepth;
+	start = group->start;
+	end = group->end;
+	while (changed) {
+		changed = 0;
+		for (q = &depthHead; *q; ) {
+			depthQuery *d = *q;
+			if (d->k != group->k || d->end < start || d->start > end ||
+			    (d->end > end ? d->end : end) - (d->start < start ? d->start : start) > DEPTH_MAX_RANGE) {
+				q = &d->next;
+				continue;
+			}
+			*q = d->next; // move it to the group
+			d->next = group;
+			group = d;
+			if (d->n > n)
+				n = d->n;
+			if (d->minDepth < minDepth)
+				minDepth = d->minDepth;
+			if (d->start < start)
+				start = d->start;
+			if (d->end > end)
+				end = d->end;
+			changed = 1;
+		}
+	}
+	depthTail = NULL;
+	for (depthQuery *d = depthHead; d; d = d->next)
+		depthTail = d;
+	depthSweeps++;
+	pthread_mutex_unlock(&mutex);
+
+	ponderDefaultParams(&params);
+	params.engine = PONDER_ENGINE_THREADED;
+	params.n = n;
+	params.k = group->k;
+	params.numThreads = numThreads;
+	params.memSize = memSize;
+	params.startValue = start;
+	params.endValue = end;
+	params.stopFlag = &stopRequested;
+	params.window = fillWindow;
+	ponderSetParams(sweepContext, &params);
+	sweepCount = 0;
+	status = ponderEnumerate(sweepContext, minDepth, collectDepth, &total);
+	if (status == PONDER_NOT_FOUND && sweepCount <= DEPTH_MAX_VALUES)
+		qsort(sweepValues, sweepCount, sizeof(depthValue), compareDepthValues);
+
+	pthread_mutex_lock(&mutex);
+	if (status == PONDER_NOT_FOUND && sweepCount <= DEPTH_MAX_VALUES)
+		storeDepth(n, group->k, minDepth, start, end, sweepValues, sweepCount);
+	for (depthQuery *d = group, *next; d; d = next) {
+		next = d->next;
+		if (status == PONDER_ERROR)
+			snprintf(d->error, sizeof(d->error), "%s", ponderError(sweepContext));
+		else if (status == PONDER_CANCELLED)
+			snprintf(d->error, sizeof(d->error), "the daemon is stopping");
+		else if (sweepCount > DEPTH_MAX_VALUES)
+			snprintf(d->error, sizeof(d->error), "more than %d values, raise the minimum depth", DEPTH_MAX_VALUES);
+		else if (!(d->values = malloc((sweepCount ? sweepCount : 1) * sizeof(depthValue))))
+			snprintf(d->error, sizeof(d->error), "cannot allocate the answer");
+		else {
+			d->count = 0;
+			for (int_fast64_t i = 0; i < sweepCount; i++) {
+				if (sweepValues[i].value < d->start || sweepValues[i].value >= d->end ||
+				    sweepValues[i].depth < d->minDepth)
+					continue;
+				d->values[d->count].value = sweepValues[i].value;
+				d->values[d->count++].depth = sweepValues[i].depth < d->n ? sweepValues[i].depth : d->n;
+			}
+		}
+		d->source = (d == group) ? "swept" : "coalesced";
+		if (d != group)
+			depthCoalesced++;
+		else
+			depthSwept++;
+		d->done = 1;
+	}
+	pthread_cond_broadcast(&doneCond);
+}
+
+/* The sweeper: depth queries first (a running batch search is stopped
+ *  when one arrives and resumed afterwards), then batch searches.
+ */
+void *sweeperLoop(void *ptr) {
+	(void) ptr;
+	pthread_mutex_lock(&mutex);
+	while (!stopRequested) {
+		int pending = 0;
+		for (int i = 0; i < numResults && !pending; i++)
+			pending = results[i].pending;
+		if (depthHead) {
+			// Answered meanwhile by a previous enumeration?
+			if (lookupDepth(depthHead)) {
+				depthHead->source = "cached";
+				depthHead->done = 1;
+				depthCached++;
+				if (!(depthHead = depthHead->next))
+					depthTail = NULL;
+				pthread_cond_broadcast(&doneCond);
+			} else
+				runDepth();
+		} else if (pending)
+			runBatch();
+		else
+			pthread_cond_wait(&workCond, &mutex);
+	}
+	pthread_mutex_unlock(&mutex);
+	return NULL;
+}
+
+/*********************************************************************
+ * Clients
+ *********************************************************************/
+
+double microsSince(const struct timespec *start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1e6 + (now.tv_nsec - start->tv_nsec) * 1e-3;
+}
+
+/* Called with the lock held */
+void addLatency(latencyStats *s, double micros) {
+	int b = 0;
+	while (b < LATENCY_BUCKETS - 1 && micros >= (double) ((int_fast64_t) 1 << b))
+		b++;
+	s->buckets[b]++;
+	s->count++;
+	s->totalMicros += micros;
+	if (micros > s->maxMicros)
+		s->maxMicros = micros;
+}
+
+/* Upper bound of the latency of the given fraction of requests */
+int_fast64_t latencyPercentile(const latencyStats *s, double fraction) {
+	int_fast64_t seen = 0;
+	for (int b = 0; b < LATENCY_BUCKETS; b++)
+		if ((seen += s->buckets[b]) >= fraction * s->count)
+			return (int_fast64_t) 1 << b;
+	return (int_fast64_t) 1 << (LATENCY_BUCKETS - 1);
+}
+
+void printLatency(FILE *out, const char *name, const latencyStats *s) {
+	fprintf(out, "latency %s count=%" PRIdFAST64 " mean=%.0fus p50<%" PRIdFAST64 "us p99<%" PRIdFAST64 "us max=%.0fus\n",
+	        name, s->count, s->count ? s->totalMicros / s->count : 0.0,
+	        latencyPercentile(s, 0.5), latencyPercentile(s, 0.99), s->maxMicros);
+}
+
+/* Called with the lock held when a query needs the sweeper. A running
+ *  batch search is stopped at once (its current window is lost) so that
+ *  the query does not wait for the end of the window.
+ */
+void wakeSweeper(void) {
+	newWork = 1;
+	if (sweepSize)
+		ponderCancel(sweepContext);
+	pthread_cond_signal(&workCond);
+}
+
+void serveSearch(FILE *out, int_fast64_t n, int_fast64_t k, const struct timespec *start) {
+	const char *source = "swept";
+	char valueString[U128_STRING_SIZE];
+	ponder_u128 value;
+	double micros;
+	int r, answer, ok = 1;
+
+	pthread_mutex_lock(&mutex);
+	if ((answer = knownAnswer(n, k, &value))) {
+		source = (answer == 1) ? "cached" : "nearby";
+		if (answer == 1)
+			searchCached++;
+		else
+			searchNearby++;
+	} else {
+		r = findResult(n, k);
+		if (results[r].pending) {
+			source = "coalesced";
+			searchCoalesced++;
+		} else {
+			results[r].pending = 1;
+			results[r].failed = 0;
+			searchSwept++;
+			wakeSweeper();
+		}
+		while (results[r].pending)
+			pthread_cond_wait(&doneCond, &mutex);
+		if ((ok = results[r].found))
+			value = results[r].lowerBound;
+		else
+			errors++;
+	}
+	micros = microsSince(start);
+	addLatency(&searchLatency, micros);
+	pthread_mutex_unlock(&mutex);
+
+	if (!ok) {
+		fprintf(out, "ERROR search failed, see the daemon output\n");
+		return;
+	}
+	fprintf(out, "X %" PRIdFAST64 " %" PRIdFAST64 " %s %s %.0f\n", n, k, u128ToString(value, valueString), source, micros);
+	if (verbose)
+		printf("X_%" PRIdFAST64 " (k=%" PRIdFAST64 ") = %s, %s in %.0f microseconds\n",
+		       n, k, valueString, source, micros);
+}
+
+void serveDepth(FILE *out, depthQuery *q, const struct timespec *start) {
+	char valueString[U128_STRING_SIZE];
+	double micros;
+
+	pthread_mutex_lock(&mutex);
+	if (lookupDepth(q)) {
+		q->source = "cached";
+		depthCached++;
+	} else {
+		if (depthTail)
+			depthTail->next = q;
+		else
+			depthHead = q;
+		depthTail = q;
+		wakeSweeper();
+		while (!q->done)
+			pthread_cond_wait(&doneCond, &mutex);
+	}
+	if (q->error[0])
+		errors++;
+	micros = microsSince(start);
+	addLatency(&depthLatency, micros);
+	pthread_mutex_unlock(&mutex);
+
+	if (q->error[0])
+		fprintf(out, "ERROR %s\n", q->error);
+	else {
+		for (int_fast64_t i = 0; i < q->count; i++)
+			fprintf(out, "%s %" PRIdFAST64 "\n", u128ToString(q->values[i].value, valueString), q->values[i].depth);
+		fprintf(out, "END %" PRIdFAST64 " %s %.0f\n", q->count, q->source, micros);
+		if (verbose)
+			printf("Depth query n=%" PRIdFAST64 " k=%" PRIdFAST64 ": %" PRIdFAST64 " values, %s in %.0f microseconds\n",
+			       q->n, q->k, q->count, q->source, micros);
+	}
+	free(q->values);
+}
+
+void serveStats(FILE *out) {
+	pthread_mutex_lock(&mutex);
+	fprintf(out, "tiles used=%d max=%d integers=%" PRIdFAST64 " hits=%" PRIdFAST64 " misses=%" PRIdFAST64
+	        " evictions=%" PRIdFAST64 "\n", numTiles, maxTiles, (int_fast64_t) numTiles * TILE_SIZE,
+	        tileHits, tileMisses, tileEvictions);
+	fprintf(out, "search cached=%" PRIdFAST64 " nearby=%" PRIdFAST64 " coalesced=%" PRIdFAST64
+	        " swept=%" PRIdFAST64 "\n", searchCached, searchNearby, searchCoalesced, searchSwept);
+	fprintf(out, "depth cached=%" PRIdFAST64 " coalesced=%" PRIdFAST64 " swept=%" PRIdFAST64 "\n",
+	        depthCached, depthCoalesced, depthSwept);
+	fprintf(out, "sweeps batch=%" PRIdFAST64 " depth=%" PRIdFAST64 " cancelled=%" PRIdFAST64
+	        " errors=%" PRIdFAST64 "\n", batchSweeps, depthSweeps, cancelledSweeps, errors);
+	printLatency(out, "search", &searchLatency);
+	printLatency(out, "depth", &depthLatency);
+	pthread_mutex_unlock(&mutex);
+	fprintf(out, "END\n");
+}
+
+/* Reads a positive 64-bit integer argument */
+int parseArgument(const char *arg, int_fast64_t *value) {
+	ponder_u128 v;
+	if (!arg || !parseU128(arg, &v) || !v || v > INT64_MAX)
+		return 0;
+	*value = (int_fast64_t) v;
+	return 1;
+}
+
+void *clientLoop(void *ptr) {
+	int fd = (int) (intptr_t) ptr;
+	FILE *in = fdopen(fd, "r"), *out = fdopen(dup(fd), "w");
+	char line[LINE_SIZE], *command, *args[5], *save;
+	struct timespec start;
+	int numArgs;
+
+	if (!in || !out) {
+		close(fd);
+		return NULL;
+	}
+	while (fgets(line, sizeof(line), in)) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		if (!(command = strtok_r(line, " \t\r\n", &save)))
+			continue;
+		for (numArgs = 0; numArgs < 5 && (args[numArgs] = strtok_r(NULL, " \t\r\n", &save)); numArgs++)
+			;
+		if (!strcmp(command, "SEARCH")) {
+			int_fast64_t n, k = 1;
+			if (numArgs < 1 || numArgs > 2 || !parseArgument(args[0], &n) ||
+			    (numArgs == 2 && !parseArgument(args[1], &k)))
+				fprintf(out, "ERROR usage: SEARCH n [k]\n");
+			else if (stepSpan(n, k) < 0)
+				fprintf(out, "ERROR the sequence span does not fit in 64 bits\n");
+			else
+				serveSearch(out, n, k, &start);
+		} else if (!strcmp(command, "DEPTH")) {
+			depthQuery q;
+			memset(&q, 0, sizeof(q));
+			if (numArgs < 4 || numArgs > 5 || !parseArgument(args[0], &q.n) || !parseArgument(args[1], &q.k) ||
+			    !parseU128(args[2], &q.start) || !parseU128(args[3], &q.end) ||
+			    (numArgs == 5 && !parseArgument(args[4], &q.minDepth)))
+				fprintf(out, "ERROR usage: DEPTH n k start end [minDepth]\n");
+			else if (stepSpan(q.n, q.k) < 0)
+				fprintf(out, "ERROR the sequence span does not fit in 64 bits\n");
+			else if (q.end <= q.start)
+				fprintf(out, "ERROR the end value has to be larger than the start value\n");
+			else if (q.end - q.start > DEPTH_MAX_RANGE)
+				fprintf(out, "ERROR at most %d start values in a query, split the range\n", DEPTH_MAX_RANGE);
+			else {
+				if (!q.minDepth || q.minDepth > q.n)
+					q.minDepth = q.n;
+				serveDepth(out, &q, &start);
+			}
+		} else if (!strcmp(command, "STATS"))
+			serveStats(out);
+		else
+			fprintf(out, "ERROR unknown request %s\n", command);
+		fflush(out);
+	}
+	fclose(in);
+	fclose(out);
+	return NULL;
+}
+
+/*********************************************************************/
+
+int main(int argc, char **argv) {
+	struct sockaddr_un address;
+	pthread_t sweeperID, clientID;
+	int_fast64_t cacheSize;
+	int listenFd, fd, c;
+
+	while ((c = getopt (argc, argv, "vu:t:m:c:")) != -1) {
+		switch (c) {
+			case 'v':
+				verbose = 1;
+				break;
+			case 'u':
+				socketPath = optarg;
+				break;
+			case 't':
+				numThreads = strtoll(optarg, NULL, 10);
+				if ((numThreads <= 0) || (numThreads > PONDER_MAX_THREADS)) {
+					printf("Number of threads has to be between 1 and %d.\n", PONDER_MAX_THREADS);
+					exit(1);
+				}
+				break;
+			case 'm':
+				memSize = strtoll(optarg, NULL, 10);
+				break;
+			case 'c':
+				cacheSize = strtoll(optarg, NULL, 10);
+				if (cacheSize <= 0) {
+					printf("ERROR: the cache size has to be positive.\n");
+					exit(1);
+				}
+				maxTiles = (cacheSize * 8 * 1024 * 1024 + TILE_SIZE - 1) / TILE_SIZE;
+				break;
+			case '?':
+				if (optopt == 'u' || optopt == 't' || optopt == 'm' || optopt == 'c')
+					fprintf (stderr, "Option -%c requires an argument.\n", optopt);
+				else if (isprint (optopt))
+					fprintf (stderr, "Unknown option `-%c'.\n", optopt);
+				else
+					fprintf (stderr, "Unknown option character `\\x%x'.\n", optopt);
+				fprintf (stderr, "Usage: daemon [-v] [-u socketPath] [-t #threads] [-m memsize] [-c cacheMB]\n");
+				return 1;
+			default:
+				abort();
+		}
+	}
+	if (optind != argc) {
+		fprintf (stderr, "Usage: daemon [-v] [-u socketPath] [-t #threads] [-m memsize] [-c cacheMB]\n");
+		return 1;
+	}
+	if (strlen(socketPath) >= sizeof(address.sun_path)) {
+		printf("ERROR: socket path %s is too long.\n", socketPath);
+		exit(1);
+	}
+
+	for (int b = 0; b < 256; b++)
+		for (int j = 0; j < 8; j++)
+			expandTable[b][j] = (b >> j) & 1;
+	if (!(tiles = calloc(maxTiles, sizeof(primeTile)))) {
+		printf("ERROR: cannot allocate the tiles.\n");
+		exit(1);
+	}
+	primesieve_init(&tileIterator);
+	if (!(sweepContext = ponderCreate(&(ponderParams) { 0 }))) {
+		printf("ERROR: cannot allocate the search context.\n");
+		exit(1);
+	}
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, socketPath);
+	unlink(socketPath);
+	if ((listenFd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+	    bind(listenFd, (struct sockaddr *) &address, sizeof(address)) || listen(listenFd, 64)) {
+		printf("ERROR: cannot listen on %s: %s.\n", socketPath, strerror(errno));
+		exit(1);
+	}
+	signal(SIGPIPE, SIG_IGN); // a client leaving early must not kill us
+	installCheckpointSignals();
+	pthread_create(&sweeperID, NULL, sweeperLoop, NULL);
+	printf("Listening on %s (%s step, %d threads, %d tiles of %d integers)\n",
+	       socketPath, STEP_NAME, numThreads, maxTiles, TILE_SIZE);
+	fflush(stdout);
+
+	while (!stopRequested) {
+		if ((fd = accept(listenFd, NULL, NULL)) < 0) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			printf("ERROR: accept failed: %s.\n", strerror(errno));
+			break;
+		}
+		if (pthread_create(&clientID, NULL, clientLoop, (void *) (intptr_t) fd)) {
+			close(fd);
+			continue;
+		}
+		pthread_detach(clientID);
+	}
+	close(listenFd);
+	unlink(socketPath);
+	printf("Stopped.\n");
+	return 0;
+}
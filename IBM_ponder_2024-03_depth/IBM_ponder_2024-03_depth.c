@@ -0,0 +1,150 @@
+/*********************************************************************
+ * This code explores the 'IBM Ponder this' challenge from March 2024
+ * See: research.ibm.com/haifa/ponderthis/challenges/March2024.html
+ *
+ * It gives the depth L(a) of scattered start values a: the index of the
+ *  first prime term of the sequence a, a+k*f(1), a+k*f(1)+k*f(2)... or n
+ *  if none of its first n terms is prime (a is then a correct start value).
+ *  The searches scan the integers from a start value, this code answers
+ *  isolated values without sieving anything, with the point queries of
+ *  libponder (ponderDepthOf(), residues then Miller-Rabin).
+ *
+ * Usage: IBM_ponder_2024-03_depth [-v] [-n maxDepth] [-k mult] [-t numThreads] [a ...]
+ *	The values are read on the command line or, if there is none, on the
+ *	 standard input (one per line). One line "a L(a)" is written for each.
+ *	Options:
+ *	 -v
+ *		verbose mode. Print the number of queries per second at the end.
+ *
+ *	 -n maxDepth
+ *		Length of the sequences (default 1000).
+ *
+ *	 -k mult
+ *		Step multiplier (default is 1). f is chosen when compiling, see
+ *		common/ponder_step.h
+ *
+ *	 -t numThreads
+ *		Number of threads answering a batch of values (default 1).
+ *
+ ********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <string.h>
+#include <time.h>
+
+#include "../common/ponder_step.h"
+#include "../libponder/ponder.h"
+
+#define BATCH_SIZE 4096 /* values answered at once when read on the standard input */
+#define LINE_SIZE 256
+
+int verbose = 0;
+int numThreads = 1;
+ponderDepthEngine *engine;
+ponder_u128 values[BATCH_SIZE];
+int_fast64_t depths[BATCH_SIZE];
+int_fast64_t numQueries = 0;
+
+/* Answers and prints a batch of values */
+void answerBatch(int_fast64_t count) {
+	char valueString[U128_STRING_SIZE];
+
+	ponderDepthBatch(engine, values, count, depths, numThreads);
+	for (int_fast64_t i = 0; i < count; i++) {
+		if (depths[i] < 0)
+			printf("%s ERROR: the sequence goes past 2^128\n", u128ToString(values[i], valueString));
+		else
+			printf("%s %" PRIdFAST64 "\n", u128ToString(values[i], valueString), depths[i]);
+	}
+	numQueries += count;
+}
+
+/* Parses a value, or exits */
+void parseValue(const char *str, ponder_u128 *value) {
+	if (!parseU128(str, value)) {
+		printf("ERROR: incorrect value %s.\n", str);
+		exit(1);
+	}
+}
+
+int main(int argc, char **argv) {
+	int_fast64_t maxDepth = 1000, stepK = 1, count = 0;
+	struct timespec startTime, endTime;
+	char line[LINE_SIZE];
+	double seconds;
+	int c;
+
+	while ((c = getopt (argc, argv, "vn:k:t:")) != -1) {
+		switch (c) {
+			case 'v':
+				verbose = 1;
+				break;
+			case 'n':
+				maxDepth = strtoll(optarg, NULL, 10);
+				break;
+			case 'k':
+				stepK = strtoll(optarg, NULL, 10);
+				break;
+			case 't':
+				numThreads = strtoll(optarg, NULL, 10);
+				if ((numThreads <= 0) || (numThreads > PONDER_MAX_THREADS)) {
+					printf("Number of threads has to be between 1 and %d.\n", PONDER_MAX_THREADS);
+					exit(1);
+				}
+				break;
+			case '?':
+				if (optopt == 'n' || optopt == 'k' || optopt == 't')
+					fprintf (stderr, "Option -%c requires an argument.\n", optopt);
+				else if (isprint (optopt))
+					fprintf (stderr, "Unknown option `-%c'.\n", optopt);
+				else
+					fprintf (stderr, "Unknown option character `\\x%x'.\n", optopt);
+				fprintf (stderr, "Usage: depth [-v] [-n maxDepth] [-k mult] [-t #threads] [a ...]\n");
+				return 1;
+			default:
+				abort();
+		}
+	}
+
+	if (!(engine = ponderDepthCreate(maxDepth, stepK))) {
+		printf("ERROR: incorrect maxDepth or k (the sequence span has to fit in 64 bits).\n");
+		exit(1);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &startTime);
+	if (optind < argc) {
+		for (; optind < argc; optind++) {
+			parseValue(argv[optind], &values[count++]);
+			if (count == BATCH_SIZE) {
+				answerBatch(count);
+				count = 0;
+			}
+		}
+	} else {
+		while (fgets(line, sizeof(line), stdin)) {
+			line[strcspn(line, " \t\r\n")] = 0;
+			if (!line[0])
+				continue;
+			parseValue(line, &values[count++]);
+			if (count == BATCH_SIZE) {
+				answerBatch(count);
+				count = 0;
+			}
+		}
+	}
+	if (count)
+		answerBatch(count);
+	clock_gettime(CLOCK_MONOTONIC, &endTime);
+
+	if (verbose) {
+		seconds = (endTime.tv_sec - startTime.tv_sec) + (endTime.tv_nsec - startTime.tv_nsec) * 1e-9;
+		printf("%" PRIdFAST64 " queries (n=%" PRIdFAST64 ", %s step, k=%" PRIdFAST64 ") in %.3f seconds, %.0f queries per second\n",
+		       numQueries, maxDepth, STEP_NAME, stepK, seconds, seconds > 0 ? numQueries / seconds : 0.0);
+	}
+	ponderDepthDestroy(engine);
+	return 0;
+}
@@ -0,0 +1,525 @@
+/*********************************************************************
+ * This code measures the hot paths of the 'IBM Ponder this' challenge
+ * from March 2024 searches in isolation
+ * See: research.ibm.com/haifa/ponderthis/challenges/March2024.html
+ *
+ * End-to-end timings mix sieving, testing and thread scheduling. This
+ *  code times each kernel alone, at fixed offsets, and writes one CSV
+ *  line per kernel, window and offset with the median over the runs of:
+ *  - ns per candidate (start value tested, or integer of the window),
+ *  - ns per prime (primes of the window, or consumed by the elimination),
+ *  - bytes of window per candidate.
+ * The kernels are:
+ *  - fill: the windows of libponder, filled with primesieve, copied from
+ *    the prime cache (if $PONDER_PRIME_CACHE is set) or sieved as past
+ *    2^64 ("sieve128", at 2^64 + offset);
+ *  - test: the evaluation of candidates on a window of primes, with
+ *    . byte:  isCorrectSequence() of libponder, one byte per integer,
+ *    . depth: sequenceDepth() of libponder (detailed statistics),
+ *    . bit:   the same on a window of one bit per integer,
+ *    . word:  64 candidates at once, each term of the 64 sequences being
+ *             one unaligned 64-bit load of the bit window,
+ *    . wheel: the byte kernel skipping the terms which are multiples of
+ *             2, 3 or 5 (known from a mod 30), never prime past 5;
+ *    on the real window (primes) and on a synthetic one (random ones
+ *    on the integers prime to 30, with the density of the primes);
+ *  - eliminate: processArray() of Algorithm 1.
+ * Before timing, the test kernels are checked to agree with each other on
+ *  a small n where many candidates are correct.
+ *
+ * The kernels are the static functions of libponder, so this code includes
+ *  libponder/ponder.c and is compiled without it:
+ *	cc -O3 IBM_ponder_2024-03_kernels.c -lprimesieve -lpthread -lm -o IBM_ponder_2024-03_kernels
+ *
+ * Usage: IBM_ponder_2024-03_kernels [-v] [-n n] [-k mult] [-m memSize] [-s offset,offset...]
+ *                                   [-r repeats] [-K kernel,kernel...]
+ *	Options:
+ *	 -v
+ *		verbose mode. Print each run.
+ *
+ *	 -n n
+ *		Length of the sequences (default 1000).
+ *
+ *	 -k mult
+ *		Step multiplier (default is 1). f is chosen when compiling, see
+ *		common/ponder_step.h
+ *
+ *	 -m memSize
+ *		Candidates of a window (default is ten millions).
+ *
+ *	 -s offset,offset...
+ *		Offsets of the windows (default 1000000000,1000000000000).
+ *
+ *	 -r repeats
+ *		Runs of each kernel (default 5).
+ *
+ *	 -K kernel,kernel...
+ *		Kernels to run among fill, cache, sieve128, byte, depth, bit,
+ *		word, wheel and eliminate (default all but sieve128, which
+ *		takes seconds).
+ *
+ ********************************************************************/
+
+#include "../libponder/ponder.c" /* the kernels are static functions of libponder */
+
+#include <unistd.h>
+#include <ctype.h>
+#include <math.h>
+
+#define MAX_OFFSETS 16
+#define MAX_REPEATS 100
+#define WHEEL 30
+
+int verbose = 0;
+int_fast64_t n = 1000, stepK = 1, memSize = 10000000L;
+int repeats = 5;
+const char *kernelList = "fill,cache,byte,depth,bit,word,wheel,eliminate";
+
+/* Offsets of the terms: a_i = a_0 + termOffsets[i] */
+int_fast64_t *termOffsets;
+
+/* For each residue of a_0 mod WHEEL, the offsets of the terms which are
+ *  not multiples of 2, 3 or 5.
+ */
+int_fast64_t *wheelOffsets[WHEEL];
+int_fast64_t wheelSize[WHEEL];
+
+/* Result of a timed kernel */
+typedef struct {
+	double seconds[MAX_REPEATS];
+	int_fast64_t passing;           /* correct candidates, for the test kernels */
+	int_fast64_t primes;
+} kernelRun;
+
+static double now(void) {
+	return seconds(CLOCK_MONOTONIC);
+}
+
+int wanted(const char *kernel) {
+	const char *p = kernelList;
+	size_t length = strlen(kernel);
+
+	while ((p = strstr(p, kernel))) {
+		if ((p == kernelList || p[-1] == ',') && (p[length] == ',' || !p[length]))
+			return 1;
+		p += length;
+	}
+	return 0;
+}
+
+int compareDoubles(const void *a, const void *b) {
+	double x = *(const double *) a, y = *(const double *) b;
+	return (x > y) - (x < y);
+}
+
+double medianSeconds(const kernelRun *run) {
+	double sorted[MAX_REPEATS];
+
+	memcpy(sorted, run->seconds, sizeof(double) * repeats);
+	qsort(sorted, repeats, sizeof(double), compareDoubles);
+	return (repeats & 1) ? sorted[repeats / 2] : (sorted[repeats / 2 - 1] + sorted[repeats / 2]) / 2;
+}
+
+/* Writes a CSV line; a metric which does not apply is left empty */
+void report(const char *kernel, const char *window, ponder_u128 offset, const kernelRun *run,
+            int_fast64_t candidates, int_fast64_t primes, double bytesPerCandidate) {
+	char offsetString[U128_STRING_SIZE];
+	double median = medianSeconds(run);
+
+	printf("%s,%s,%s,%" PRIdFAST64 ",%" PRIdFAST64 ",%.3f,", kernel, window, u128ToString(offset, offsetString),
+	       n, candidates, median * 1e9 / candidates);
+	if (primes > 0)
+		printf("%.3f", median * 1e9 / primes);
+	printf(",%.4f,", bytesPerCandidate);
+	if (run->passing >= 0)
+		printf("%" PRIdFAST64, run->passing);
+	printf("\n");
+	fflush(stdout);
+}
+
+/*********************************************************************
+ * Test kernels. Each one returns the number of correct candidates among
+ *  the first 'count' ones of the window.
+ *********************************************************************/
+
+int_fast64_t kernelByte(const char *array, const uint64_t *bits, ponder_u128 offset, int_fast64_t count) {
+	int_fast64_t passing = 0;
+	(void) bits;
+	(void) offset;
+	for (int_fast64_t i = 0; i < count; i++)
+		passing += isCorrectSequence(array, i, n, stepK);
+	return passing;
+}
+
+int_fast64_t kernelDepth(const char *array, const uint64_t *bits, ponder_u128 offset, int_fast64_t count) {
+	int_fast64_t passing = 0;
+	(void) bits;
+	(void) offset;
+	for (int_fast64_t i = 0; i < count; i++)
+		passing += (sequenceDepth(array, i, n, stepK) == n);
+	return passing;
+}
+
+int_fast64_t kernelBit(const char *array, const uint64_t *bits, ponder_u128 offset, int_fast64_t count) {
+	int_fast64_t passing = 0, t, p;
+	(void) array;
+	(void) offset;
+	for (int_fast64_t i = 0; i < count; i++) {
+		for (t = 0; t < n; t++) {
+			p = i + termOffsets[t];
+			if ((bits[p >> 6] >> (p & 63)) & 1)
+				break;
+		}
+		passing += (t == n);
+	}
+	return passing;
+}
+
+int_fast64_t kernelWord(const char *array, const uint64_t *bits, ponder_u128 offset, int_fast64_t count) {
+	int_fast64_t passing = 0, p;
+	uint64_t alive, word;
+	(void) array;
+	(void) offset;
+	for (int_fast64_t base = 0; base < count; base += 64) {
+		alive = (count - base >= 64) ? ~(uint64_t) 0 : ((uint64_t) 1 << (count - base)) - 1;
+		for (int_fast64_t t = 0; t < n && alive; t++) {
+			p = base + termOffsets[t];
+			word = bits[p >> 6] >> (p & 63);
+			if (p & 63)
+				word |= bits[(p >> 6) + 1] << (64 - (p & 63));
+			alive &= ~word;
+		}
+		passing += __builtin_popcountll(alive);
+	}
+	return passing;
+}
+
+int_fast64_t kernelWheel(const char *array, const uint64_t *bits, ponder_u128 offset, int_fast64_t count) {
+	int_fast64_t passing = 0, t, size;
+	const int_fast64_t *offsets;
+	int r = (int) (offset % WHEEL);
+	(void) bits;
+	for (int_fast64_t i = 0; i < count; i++) {
+		offsets = wheelOffsets[r];
+		size = wheelSize[r];
+		for (t = 0; t < size; t++)
+			if (array[i + offsets[t]])
+				break;
+		passing += (t == size);
+		if (++r == WHEEL)
+			r = 0;
+	}
+	return passing;
+}
+
+typedef int_fast64_t (*testKernel)(const char *, const uint64_t *, ponder_u128, int_fast64_t);
+
+static const struct {
+	const char *name;
+	testKernel kernel;
+	int bitWindow;
+} testKernels[] = {
+	{ "byte", kernelByte, 0 },
+	{ "depth", kernelDepth, 0 },
+	{ "bit", kernelBit, 1 },
+	{ "word", kernelWord, 1 },
+	{ "wheel", kernelWheel, 0 }
+};
+#define TEST_KERNELS ((int) (sizeof(testKernels) / sizeof(testKernels[0])))
+
+/* Offsets of the terms for the current n and k, and the wheel lists */
+void computeOffsets(void) {
+	stepState step;
+
+	free(termOffsets);
+	termOffsets = malloc(sizeof(int_fast64_t) * n);
+	termOffsets[0] = 0;
+	stepInit(&step, stepK);
+	for (int_fast64_t t = 1; t < n; t++)
+		termOffsets[t] = termOffsets[t-1] + stepNext(&step);
+	for (int r = 0; r < WHEEL; r++) {
+		free(wheelOffsets[r]);
+		wheelOffsets[r] = malloc(sizeof(int_fast64_t) * n);
+		wheelSize[r] = 0;
+		for (int_fast64_t t = 0; t < n; t++) {
+			int residue = (r + termOffsets[t]) % WHEEL;
+			if (residue % 2 && residue % 3 && residue % 5)
+				wheelOffsets[r][wheelSize[r]++] = termOffsets[t];
+		}
+	}
+}
+
+/* Packs a byte window in a bit window, with a padding word */
+uint64_t *packBits(const char *array, int_fast64_t size) {
+	uint64_t *bits = calloc(size / 64 + 2, sizeof(uint64_t));
+
+	if (!bits) {
+		printf("ERROR: cannot allocate the bit window.\n");
+		exit(1);
+	}
+	for (int_fast64_t i = 0; i < size; i++)
+		if (array[i])
+			bits[i >> 6] |= (uint64_t) 1 << (i & 63);
+	return bits;
+}
+
+/* Same density of ones as the primes around offset, at random places
+ *  among the integers prime to 30 (8 out of 30), like the primes.
+ */
+void syntheticWindow(char *array, int_fast64_t size, ponder_u128 offset) {
+	double density = WHEEL / 8.0 / log((double) offset + size);
+	uint64_t state = 0x9E3779B97F4A7C15ULL, threshold = (uint64_t) (density * 18446744073709551615.0);
+	int r = (int) (offset % WHEEL);
+
+	for (int_fast64_t i = 0; i < size; i++) {
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		array[i] = (r % 2 && r % 3 && r % 5) && state < threshold;
+		if (++r == WHEEL)
+			r = 0;
+	}
+}
+
+/* A context set up for a window at 'offset' */
+ponderContext *createContext(ponder_u128 offset, int withCache) {
+	ponderParams params;
+	ponderContext *ctx;
+
+	ponderDefaultParams(&params);
+	params.engine = PONDER_ENGINE_WINDOW;
+	params.n = n;
+	params.k = stepK;
+	params.memSize = memSize;
+	if (!withCache)
+		params.primeCache = NULL;
+	if (!(ctx = ponderCreate(&params))) {
+		printf("ERROR: cannot allocate the search context.\n");
+		exit(1);
+	}
+	ctx->offset = offset;
+	ctx->memSize = memSize;
+	ctx->span = stepSpan(n, stepK);
+	if (withCache && params.primeCache && !(ctx->cache = primeCacheOpen(params.primeCache))) {
+		printf("ERROR: cannot open prime cache %s.\n", params.primeCache);
+		exit(1);
+	}
+	return ctx;
+}
+
+/* Checks that the test kernels agree, on a small n with many correct
+ *  candidates (real window, offset 1000 so that the wheel applies).
+ */
+void checkKernels(void) {
+	int_fast64_t savedN = n, savedMemSize = memSize, expected = -1, passing;
+	ponderContext *ctx;
+	uint64_t *bits;
+
+	n = 30;
+	memSize = 1000000;
+	computeOffsets();
+	ctx = createContext(1000, 0);
+	if (!fillArrayOfPrimes(ctx)) {
+		printf("ERROR: %s.\n", ponderError(ctx));
+		exit(1);
+	}
+	bits = packBits(ctx->array, memSize + ctx->span);
+	for (int i = 0; i < TEST_KERNELS; i++) {
+		passing = testKernels[i].kernel(ctx->array, bits, ctx->offset, memSize);
+		if (expected < 0)
+			expected = passing;
+		else if (passing != expected) {
+			printf("ERROR: kernel %s finds %" PRIdFAST64 " correct candidates instead of %" PRIdFAST64 ".\n",
+			       testKernels[i].name, passing, expected);
+			exit(1);
+		}
+	}
+	if (verbose)
+		fprintf(stderr, "Test kernels agree: %" PRIdFAST64 " correct candidates for n=30 in [1000, 1001000)\n",
+		        expected);
+	free(bits);
+	ponderDestroy(ctx);
+	n = savedN;
+	memSize = savedMemSize;
+	computeOffsets();
+}
+
+/*********************************************************************/
+
+/* Fill kernels: "fill" (primesieve), "cache" and "sieve128" */
+void benchFill(const char *kernel, ponder_u128 offset) {
+	int_fast64_t primeSize = memSize + stepSpan(n, stepK), primes = 0;
+	ponderContext *ctx = createContext(offset, !strcmp(kernel, "cache"));
+	kernelRun run = { .passing = -1 };
+	double start;
+
+	if (!strcmp(kernel, "cache") && (!ctx->cache || offset + primeSize >= PRIME_CACHE_LIMIT)) {
+		ponderDestroy(ctx); // no cache file given, or the window is past it
+		return;
+	}
+	if (!strcmp(kernel, "sieve128")) {
+		ctx->offset = ((ponder_u128) 1 << 64) + offset;
+		if (!allocArray(ctx, primeSize, 0))
+			exit(1);
+	}
+	for (int r = 0; r < repeats; r++) {
+		start = now();
+		if (!strcmp(kernel, "sieve128"))
+			sieveArrayOfPrimes(ctx, primeSize);
+		else if (!fillArrayOfPrimes(ctx)) {
+			printf("ERROR: %s.\n", ponderError(ctx));
+			exit(1);
+		}
+		run.seconds[r] = now() - start;
+		if (verbose)
+			fprintf(stderr, "%s: %.6f s\n", kernel, run.seconds[r]);
+	}
+	for (int_fast64_t i = 0; i < primeSize; i++)
+		primes += ctx->array[i];
+	report(kernel, "real", ctx->offset, &run, memSize, primes, (double) primeSize / memSize);
+	ponderDestroy(ctx);
+}
+
+/* Test kernels, on the real and on a synthetic window */
+void benchTests(ponder_u128 offset) {
+	int_fast64_t primeSize = memSize + stepSpan(n, stepK);
+	ponderContext *ctx = createContext(offset, 0);
+	kernelRun run;
+	uint64_t *bits;
+	double start;
+
+	if (!fillArrayOfPrimes(ctx)) {
+		printf("ERROR: %s.\n", ponderError(ctx));
+		exit(1);
+	}
+	for (int synthetic = 0; synthetic < 2; synthetic++) {
+		if (synthetic)
+			syntheticWindow(ctx->array, primeSize, offset);
+		bits = packBits(ctx->array, primeSize);
+		for (int i = 0; i < TEST_KERNELS; i++) {
+			if (!wanted(testKernels[i].name) || (!strcmp(testKernels[i].name, "wheel") && offset < WHEEL))
+				continue;
+			for (int r = 0; r < repeats; r++) {
+				start = now();
+				run.passing = testKernels[i].kernel(ctx->array, bits, offset, memSize);
+				run.seconds[r] = now() - start;
+				if (verbose)
+					fprintf(stderr, "%s: %.6f s\n", testKernels[i].name, run.seconds[r]);
+			}
+			report(testKernels[i].name, synthetic ? "synthetic" : "real", offset, &run, memSize, 0,
+			       testKernels[i].bitWindow ? primeSize / 8.0 / memSize : (double) primeSize / memSize);
+		}
+		free(bits);
+	}
+	ponderDestroy(ctx);
+}
+
+/* Elimination loop of Algorithm 1 on a block at offset */
+void benchEliminate(ponder_u128 offset) {
+	ponderContext *ctx = createContext(offset, 0);
+	kernelRun run = { .passing = -1 };
+	int_fast64_t res = 0, primes = 0;
+	double start;
+
+	if (offset >> 62) {
+		ponderDestroy(ctx); // Algorithm 1 only handles values below 2^62
+		return;
+	}
+	if (!allocArray(ctx, memSize, 0)) {
+		printf("ERROR: %s.\n", ponderError(ctx));
+		exit(1);
+	}
+	for (int r = 0; r < repeats; r++) {
+		ctx->stats.primes = 0;
+		start = now();
+		res = processArray(ctx, memSize);
+		run.seconds[r] = now() - start;
+		primes = ctx->stats.primes;
+		if (verbose)
+			fprintf(stderr, "eliminate: %.6f s\n", run.seconds[r]);
+	}
+	run.passing = res >= 0;
+	/* the candidates ruled out (all of them unless a correct one is found) */
+	report("eliminate", "real", offset, &run, res >= 0 ? res + 1 : memSize, primes, 1.0);
+	ponderDestroy(ctx);
+}
+
+int main(int argc, char **argv) {
+	int_fast64_t offsets[MAX_OFFSETS] = { 1000000000LL, 1000000000000LL };
+	int numOffsets = 2;
+	char *p, *end;
+	int c;
+
+	while ((c = getopt (argc, argv, "vn:k:m:s:r:K:")) != -1) {
+		switch (c) {
+			case 'v':
+				verbose = 1;
+				break;
+			case 'n':
+				n = strtoll(optarg, NULL, 10);
+				break;
+			case 'k':
+				stepK = strtoll(optarg, NULL, 10);
+				break;
+			case 'm':
+				memSize = strtoll(optarg, NULL, 10);
+				break;
+			case 's':
+				numOffsets = 0;
+				for (p = optarg; *p; p = *end ? end + 1 : end) {
+					if (numOffsets == MAX_OFFSETS) {
+						printf("ERROR: at most %d offsets.\n", MAX_OFFSETS);
+						exit(1);
+					}
+					offsets[numOffsets] = strtoll(p, &end, 10);
+					if (end == p || (*end && *end != ',') || offsets[numOffsets] < 0) {
+						printf("ERROR: incorrect list of offsets '%s'.\n", optarg);
+						exit(1);
+					}
+					numOffsets++;
+				}
+				break;
+			case 'r':
+				repeats = strtoll(optarg, NULL, 10);
+				if (repeats <= 0 || repeats > MAX_REPEATS) {
+					printf("Number of repeats has to be between 1 and %d.\n", MAX_REPEATS);
+					exit(1);
+				}
+				break;
+			case 'K':
+				kernelList = optarg;
+				break;
+			case '?':
+				if (optopt == 'n' || optopt == 'k' || optopt == 'm' || optopt == 's' || optopt == 'r' || optopt == 'K')
+					fprintf (stderr, "Option -%c requires an argument.\n", optopt);
+				else if (isprint (optopt))
+					fprintf (stderr, "Unknown option `-%c'.\n", optopt);
+				else
+					fprintf (stderr, "Unknown option character `\\x%x'.\n", optopt);
+				fprintf (stderr, "Usage: kernels [-v] [-n n] [-k mult] [-m memSize] [-s offset,...] [-r repeats] [-K kernel,...]\n");
+				return 1;
+			default:
+				abort();
+		}
+	}
+	if (stepSpan(n, stepK) < 0 || n < 2 || memSize <= 0) {
+		printf("ERROR: incorrect n, k or memSize.\n");
+		exit(1);
+	}
+
+	computeOffsets();
+	checkKernels();
+	printf("kernel,window,offset,n,candidates,nsPerCandidate,nsPerPrime,bytesPerCandidate,correct\n");
+	for (int o = 0; o < numOffsets; o++) {
+		if (wanted("fill"))
+			benchFill("fill", offsets[o]);
+		if (wanted("cache"))
+			benchFill("cache", offsets[o]);
+		if (wanted("sieve128"))
+			benchFill("sieve128", offsets[o]);
+		benchTests(offsets[o]);
+		if (wanted("eliminate"))
+			benchEliminate(offsets[o]);
+	}
+	return 0;
+}
@@ -0,0 +1,88 @@
+/*********************************************************************
+ * This code checks answers to the 'IBM Ponder this' challenge from March 2024
+ * See: research.ibm.com/haifa/ponderthis/challenges/March2024.html
+ *
+ * It reads a minimality proof written by Algorithm 1 (-p) and checks
+ *  that each start value it covers has a prime term at the given index
+ *  (see common/ponder_proof.h), then verifies the first value after the
+ *  proof: if the proof starts at 0, that value is X_n.
+ * Only primality tests are needed, so primesieve is not. It has to be
+ *  compiled with the same step policy as the search which wrote the proof.
+ *
+ * Usage: IBM_ponder_2024-03_proofcheck [-t numThreads] [-i] proofFile
+ *	Options:
+ *	 -t numThreads
+ *		Uses numThreads threads (default is one per online processor).
+ *
+ *	 -i
+ *		Independent check: the verification of the value after the
+ *		proof tests each term itself instead of reading the prime
+ *		cache named by $PONDER_PRIME_CACHE, which was written by the
+ *		searches (see common/ponder_verify.h).
+ *
+ ********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "../common/ponder_step.h"
+#include "../common/ponder_verify.h"
+#include "../common/ponder_proof.h"
+
+int main(int argc, char **argv) {
+	int numThreads = 0, ok;
+	int_fast64_t n, k;
+	ponder_u128 start, end;
+	struct timespec startTime, endTime;
+	char startString[U128_STRING_SIZE], endString[U128_STRING_SIZE];
+	int c;
+
+	while ((c = getopt (argc, argv, "t:i")) != -1) {
+		switch (c) {
+			case 't':
+				numThreads = strtoll(optarg, NULL, 10);
+				break;
+			case 'i':
+				verifyIgnoreCache = 1;
+				break;
+			case '?':
+				if (optopt == 't')
+					fprintf (stderr, "Option -%c requires an argument.\n", optopt);
+				else if (isprint (optopt))
+					fprintf (stderr, "Unknown option `-%c'.\n", optopt);
+				else
+					fprintf (stderr, "Unknown option character `\\x%x'.\n", optopt);
+				fprintf (stderr, "Usage: proofcheck [-t #threads] [-i] proofFile\n");
+				return 1;
+			default:
+				abort();
+		}
+	}
+	if (optind+1 != argc) {
+		fprintf (stderr, "Usage: proofcheck [-t #threads] [-i] proofFile\n");
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &startTime);
+	ok = checkProof(argv[optind], numThreads, &n, &k, &start, &end);
+	clock_gettime(CLOCK_MONOTONIC, &endTime);
+	if (!ok)
+		return 1;
+	u128ToString(start, startString);
+	u128ToString(end, endString);
+	printf("SUCCESS! no start value in [%s, %s) is correct for n=%" PRIdFAST64 ", k=%" PRIdFAST64 ".\n",
+	       startString, endString, n, k);
+	printf("Check of %s values took %.0f microseconds.\n", u128ToString(end - start, startString),
+	       (endTime.tv_sec - startTime.tv_sec) * 1e6 + (endTime.tv_nsec - startTime.tv_nsec) * 1e-3);
+
+	if (!verifySequence(end, n, k, numThreads))
+		return 1;
+	if (!start)
+		printf("Hence %s is the smallest correct start value.\n", endString);
+	return 0;
+}
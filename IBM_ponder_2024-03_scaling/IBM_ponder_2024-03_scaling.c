@@ -0,0 +1,433 @@
+/*********************************************************************
+ * This code measures how the threaded search of the 'IBM Ponder this'
+ * challenge from March 2024 scales with the number of threads
+ * See: research.ibm.com/haifa/ponderthis/challenges/March2024.html
+ *
+ * It runs the threaded engine of libponder (Algorithm 3, see
+ *  libponder/ponder.h) in this process for a list of thread counts and
+ *  thread placements:
+ *  - strong scaling: the same work for every thread count, the search of
+ *    X_n from 0;
+ *  - weak scaling: a work proportional to the thread count, the
+ *    enumeration of the start values of depth n in a range of 'work'
+ *    values per thread (enumerate mode never stops early, so the work does
+ *    not depend on where the answers are).
+ * The placements are:
+ *  - os: the threads go where the system puts them,
+ *  - cores: one thread per physical core (SMT off), so at most as many
+ *    threads as cores,
+ *  - smt: the two (or more) hardware threads of a core are filled before
+ *    the next core (SMT on),
+ *  - balanced: one thread per core, then the second hardware thread of
+ *    each core and so on, the threads of a core numbered one after the
+ *    other (the default of IBM_ponder_2024-03_2_MT).
+ * For each scaling, placement and thread count, the median time of the
+ *  runs gives the speedup over one thread (for weak scaling, the scaled
+ *  speedup: t times the work in t1/tt) and the parallel efficiency
+ *  (speedup / threads). The knee is the last thread count before the
+ *  threads added bring less than 'threshold' of the speedup they would
+ *  bring with a perfect scaling; it is flagged in the CSV and printed on
+ *  stderr for each curve.
+ * A first run, not timed, warms up the memory and primesieve.
+ *
+ * libponder uses a prime generator library.
+ * It can be found at github.com/kimwalisch/primesieve/tree/master
+ * and has to be installed before compiling.
+ *
+ * Usage: IBM_ponder_2024-03_scaling [-v] [-S] [-W] [-n n] [-w work] [-s offset] [-t numThreads,numThreads...]
+ *                                   [-p placement,placement...] [-m memSize] [-k mult] [-r repeats]
+ *                                   [-e threshold] [-o csvFile]
+ *	Options:
+ *	 -v
+ *		verbose mode. Print each run.
+ *
+ *	 -S
+ *		Strong scaling only.
+ *
+ *	 -W
+ *		Weak scaling only (default both).
+ *
+ *	 -n n
+ *		Length of the sequences (default 700 for strong scaling, the
+ *		search of X_700 taking about 2 seconds with one thread, and
+ *		1000 for weak scaling).
+ *
+ *	 -w work
+ *		Start values per thread for weak scaling (default 20000000).
+ *
+ *	 -s offset
+ *		First start value for weak scaling (default 1000000000).
+ *
+ *	 -t numThreads,numThreads...
+ *		Thread counts (default 1, 2, 4... up to the CPUs the process
+ *		can use, and that number). 1 is always run.
+ *
+ *	 -p placement,placement...
+ *		Placements among os, cores, smt and balanced (default all).
+ *
+ *	 -m memSize
+ *		Window size (default is the one of the threaded engine).
+ *
+ *	 -k mult
+ *		Step multiplier (default is 1). f is chosen when compiling, see
+ *		common/ponder_step.h
+ *
+ *	 -r repeats
+ *		Runs of each configuration (default 3).
+ *
+ *	 -e threshold
+ *		Fraction of the perfect speedup below which added threads are
+ *		past the knee (default 0.5).
+ *
+ *	 -o csvFile
+ *		Writes the results in csvFile (default is stdout).
+ *
+ ********************************************************************/
+
+#define _GNU_SOURCE /* CPU sets, see common/ponder_topology.h */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <string.h>
+
+#include "../common/ponder_step.h"
+#include "../common/ponder_topology.h"
+#include "../libponder/ponder.h"
+
+#define MAX_LIST 32
+#define MAX_REPEATS 100
+
+#define NUM_PLACEMENTS 4
+static const char *placementNames[NUM_PLACEMENTS] = { "os", "cores", "smt", "balanced" };
+static const char *scalingNames[] = { "strong", "weak" };
+
+/* A point of a scaling curve */
+typedef struct {
+	int numThreads;
+	double seconds;                 /* median of the runs */
+	double rate;                    /* candidates per second */
+	double speedup;
+	double efficiency;
+	int knee;
+} scalingPoint;
+
+int verbose = 0;
+int_fast64_t strongN = 700, weakN = 1000, stepK = 1, memSize = 0, work = 20000000;
+ponder_u128 weakOffset = 1000000000;
+int repeats = 3;
+double threshold = 0.5;
+cpuTopology topology;
+
+/* Parses a comma separated list of positive integers */
+int parseList(const char *list, int_fast64_t *values, const char *what) {
+	const char *p = list;
+	char *end;
+	int count = 0;
+
+	while (*p) {
+		if (count == MAX_LIST) {
+			printf("ERROR: at most %d %s.\n", MAX_LIST, what);
+			exit(1);
+		}
+		values[count] = strtoll(p, &end, 10);
+		if (end == p || (*end && *end != ',') || values[count] <= 0) {
+			printf("ERROR: incorrect list of %s '%s'.\n", what, list);
+			exit(1);
+		}
+		count++;
+		p = *end ? end + 1 : end;
+	}
+	return count;
+}
+
+int compareDoubles(const void *a, const void *b) {
+	double x = *(const double *) a, y = *(const double *) b;
+	return (x > y) - (x < y);
+}
+
+int compareInts(const void *a, const void *b) {
+	int_fast64_t x = *(const int_fast64_t *) a, y = *(const int_fast64_t *) b;
+	return (x > y) - (x < y);
+}
+
+double median(double *values, int count) {
+	qsort(values, count, sizeof(double), compareDoubles);
+	return (count & 1) ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) / 2;
+}
+
+/* The results of enumerate mode are not needed */
+void ignoreResult(void *userData, ponder_u128 value, int_fast64_t depth) {
+	(void) userData;
+	(void) value;
+	(void) depth;
+}
+
+/* One run. Returns its time and sets *tests; for strong scaling, the
+ *  answer has to be the same as the previous runs (*value, 0 at first).
+ */
+double runOnce(int scaling, int numThreads, const int *cpus, ponder_u128 *value, int_fast64_t *tests) {
+	char valueString[U128_STRING_SIZE], expected[U128_STRING_SIZE];
+	ponderParams params;
+	ponderContext *ctx;
+	ponderStats stats = { 0 };
+	ponderStatus status;
+	ponder_u128 found = 0;
+	int_fast64_t count;
+
+	ponderDefaultParams(&params);
+	params.engine = PONDER_ENGINE_THREADED;
+	params.n = scaling ? weakN : strongN;
+	params.k = stepK;
+	params.memSize = memSize;
+	params.numThreads = numThreads;
+	params.cpus = cpus;
+	params.primeCache = NULL; // every run sieves its windows
+	if (scaling) {
+		params.startValue = weakOffset;
+		params.endValue = weakOffset + (ponder_u128) work * numThreads;
+	}
+	if (!(ctx = ponderCreate(&params))) {
+		printf("ERROR: cannot allocate the search context.\n");
+		exit(1);
+	}
+	status = scaling ? ponderEnumerate(ctx, weakN, ignoreResult, &count) : ponderSearch(ctx, &found);
+	if (status != (scaling ? PONDER_NOT_FOUND : PONDER_FOUND)) {
+		printf("ERROR: %s (%s scaling, %d threads).\n", status == PONDER_ERROR ? ponderError(ctx) : "no answer",
+		       scalingNames[scaling], numThreads);
+		exit(1);
+	}
+	if (!scaling && *value && found != *value) {
+		printf("ERROR: %s found with %d threads instead of %s.\n", u128ToString(found, valueString), numThreads,
+		       u128ToString(*value, expected));
+		exit(1);
+	}
+	*value = found;
+	ponderGetStats(ctx, &stats);
+	ponderDestroy(ctx);
+	ponderFreeStats(&stats);
+	*tests = stats.tests;
+	return stats.totalSeconds;
+}
+
+/* Measures a curve; returns its number of points (thread counts the
+ *  placement cannot hold are left out).
+ */
+int runCurve(int scaling, topologyPlacement placement, const int_fast64_t *threads, int numThreadCounts,
+             scalingPoint *points, ponder_u128 *value) {
+	double seconds[MAX_REPEATS], rates[MAX_REPEATS];
+	int cpus[PONDER_MAX_THREADS], count = 0;
+	int_fast64_t tests;
+
+	for (int i = 0; i < numThreadCounts; i++) {
+		int numThreads = (int) threads[i];
+		if (placement != TOPOLOGY_OS && !topologyPlace(&topology, placement, numThreads, cpus)) {
+			if (verbose)
+				fprintf(stderr, "%s scaling, %s: no room for %d threads\n", scalingNames[scaling],
+				        placementNames[placement], numThreads);
+			continue;
+		}
+		for (int r = 0; r < repeats; r++) {
+			seconds[r] = runOnce(scaling, numThreads, placement == TOPOLOGY_OS ? NULL : cpus, value, &tests);
+			rates[r] = seconds[r] > 0 ? tests / seconds[r] : 0;
+			if (verbose)
+				fprintf(stderr, "%s scaling, %s, %d threads: %.3f s, %.0f candidates/s\n", scalingNames[scaling],
+				        placementNames[placement], numThreads, seconds[r], rates[r]);
+		}
+		points[count].numThreads = numThreads;
+		points[count].seconds = median(seconds, repeats);
+		points[count].rate = median(rates, repeats);
+		count++;
+	}
+	return count;
+}
+
+/* Speedups, efficiencies and knee of a curve, whose first point is 1 thread */
+void analyzeCurve(int scaling, scalingPoint *points, int count) {
+	double base = points[0].seconds, marginal;
+	int knee = -1;
+
+	for (int i = 0; i < count; i++) {
+		scalingPoint *p = &points[i];
+		p->speedup = scaling ? p->numThreads * base / p->seconds : base / p->seconds;
+		p->efficiency = p->speedup / p->numThreads;
+		p->knee = 0;
+		if (i && knee < 0) {
+			/* speedup brought by each added thread, 1 for a perfect scaling */
+			marginal = (p->speedup - points[i-1].speedup) / (p->numThreads - points[i-1].numThreads);
+			if (marginal < threshold)
+				knee = i - 1;
+		}
+	}
+	if (knee >= 0)
+		points[knee].knee = 1;
+}
+
+void writeCsv(FILE *f, int scaling, topologyPlacement placement, const scalingPoint *points, int count) {
+	for (int i = 0; i < count; i++) {
+		const scalingPoint *p = &points[i];
+		fprintf(f, "%s,%s,%" PRIdFAST64 ",%" PRIdFAST64 ",%d,%d,%.6f,%.0f,%.3f,%.3f,%d\n", scalingNames[scaling],
+		        placementNames[placement], scaling ? weakN : strongN, stepK, p->numThreads, repeats, p->seconds,
+		        p->rate, p->speedup, p->efficiency, p->knee);
+	}
+	fflush(f);
+}
+
+void printKnee(int scaling, topologyPlacement placement, const scalingPoint *points, int count) {
+	for (int i = 0; i < count; i++)
+		if (points[i].knee) {
+			fprintf(stderr, "%s scaling, %s: knee at %d threads (speedup %.2f, efficiency %.2f), "
+			        "%d threads only reach %.2f\n", scalingNames[scaling], placementNames[placement],
+			        points[i].numThreads, points[i].speedup, points[i].efficiency, points[i+1].numThreads,
+			        points[i+1].speedup);
+			return;
+		}
+	if (count > 1)
+		fprintf(stderr, "%s scaling, %s: no knee up to %d threads (efficiency %.2f)\n", scalingNames[scaling],
+		        placementNames[placement], points[count-1].numThreads, points[count-1].efficiency);
+}
+
+int main(int argc, char **argv) {
+	int_fast64_t threads[MAX_LIST + 1], placements[NUM_PLACEMENTS], n = 0, warmUpTests;
+	int numThreadCounts = 0, numPlacements = NUM_PLACEMENTS, strong = 1, weak = 1;
+	scalingPoint points[MAX_LIST + 1];
+	char *placementList = NULL, *p, *end;
+	const char *csvFile = NULL;
+	ponder_u128 value;
+	FILE *csv = stdout;
+	int c, count;
+
+	while ((c = getopt (argc, argv, "vSWn:w:s:t:p:m:k:r:e:o:")) != -1) {
+		switch (c) {
+			case 'v':
+				verbose = 1;
+				break;
+			case 'S':
+				weak = 0;
+				break;
+			case 'W':
+				strong = 0;
+				break;
+			case 'n':
+				n = strtoll(optarg, NULL, 10);
+				break;
+			case 'w':
+				work = strtoll(optarg, NULL, 10);
+				break;
+			case 's':
+				weakOffset = strtoull(optarg, NULL, 10);
+				break;
+			case 't':
+				numThreadCounts = parseList(optarg, threads, "thread counts");
+				break;
+			case 'p':
+				placementList = optarg;
+				break;
+			case 'm':
+				memSize = strtoll(optarg, NULL, 10);
+				break;
+			case 'k':
+				stepK = strtoll(optarg, NULL, 10);
+				break;
+			case 'r':
+				repeats = strtoll(optarg, NULL, 10);
+				if (repeats <= 0 || repeats > MAX_REPEATS) {
+					printf("Number of repeats has to be between 1 and %d.\n", MAX_REPEATS);
+					exit(1);
+				}
+				break;
+			case 'e':
+				threshold = strtod(optarg, NULL);
+				break;
+			case 'o':
+				csvFile = optarg;
+				break;
+			case '?':
+				if (optopt == 'n' || optopt == 'w' || optopt == 's' || optopt == 't' || optopt == 'p' ||
+				    optopt == 'm' || optopt == 'k' || optopt == 'r' || optopt == 'e' || optopt == 'o')
+					fprintf (stderr, "Option -%c requires an argument.\n", optopt);
+				else if (isprint (optopt))
+					fprintf (stderr, "Unknown option `-%c'.\n", optopt);
+				else
+					fprintf (stderr, "Unknown option character `\\x%x'.\n", optopt);
+				fprintf (stderr, "Usage: scaling [-v] [-S] [-W] [-n n] [-w work] [-s offset] [-t numThreads,...] "
+				                 "[-p placement,...] [-m memSize] [-k mult] [-r repeats] [-e threshold] [-o csvFile]\n");
+				return 1;
+			default:
+				abort();
+		}
+	}
+	if (!strong && !weak) {
+		printf("ERROR: -S and -W cannot be given together.\n");
+		exit(1);
+	}
+	if (n)
+		strongN = weakN = n;
+	if (work <= 0) {
+		printf("ERROR: the work per thread has to be positive.\n");
+		exit(1);
+	}
+	if (!topologyRead(&topology)) {
+		printf("ERROR: cannot read the CPUs of the process.\n");
+		exit(1);
+	}
+
+	/* Thread counts: sorted, starting with 1 */
+	if (!numThreadCounts) {
+		for (int t = 1; t < topology.numCpus && t < PONDER_MAX_THREADS; t *= 2)
+			threads[numThreadCounts++] = t;
+		threads[numThreadCounts++] = topology.numCpus < PONDER_MAX_THREADS ? topology.numCpus : PONDER_MAX_THREADS;
+	}
+	qsort(threads, numThreadCounts, sizeof(int_fast64_t), compareInts);
+	if (threads[0] != 1) {
+		memmove(threads + 1, threads, sizeof(int_fast64_t) * numThreadCounts++);
+		threads[0] = 1;
+	}
+	if (threads[numThreadCounts-1] > PONDER_MAX_THREADS) {
+		printf("ERROR: at most %d threads.\n", PONDER_MAX_THREADS);
+		exit(1);
+	}
+
+	if (placementList) {
+		numPlacements = 0;
+		for (p = placementList; *p; p = *end ? end + 1 : end) {
+			end = p + strcspn(p, ",");
+			int i;
+			for (i = 0; i < NUM_PLACEMENTS; i++)
+				if (strlen(placementNames[i]) == (size_t) (end - p) && !strncmp(p, placementNames[i], end - p))
+					break;
+			if (i == NUM_PLACEMENTS || numPlacements == NUM_PLACEMENTS) {
+				printf("ERROR: incorrect list of placements '%s'.\n", placementList);
+				exit(1);
+			}
+			placements[numPlacements++] = i;
+		}
+	} else
+		for (int i = 0; i < NUM_PLACEMENTS; i++)
+			placements[i] = i;
+
+	if (csvFile && !(csv = fopen(csvFile, "w"))) {
+		printf("ERROR: cannot write CSV file %s.\n", csvFile);
+		exit(1);
+	}
+	fprintf(stderr, "%d CPUs, %d cores, %d packages\n", topology.numCpus, topology.numCores, topology.numPackages);
+	fprintf(csv, "scaling,placement,n,k,threads,runs,median,candidatesPerSecond,speedup,efficiency,knee\n");
+	for (int scaling = strong ? 0 : 1; scaling <= (weak ? 1 : 0); scaling++) {
+		value = 0;
+		runOnce(scaling, 1, NULL, &value, &warmUpTests); // warm-up
+		for (int i = 0; i < numPlacements; i++) {
+			count = runCurve(scaling, placements[i], threads, numThreadCounts, points, &value);
+			analyzeCurve(scaling, points, count);
+			writeCsv(csv, scaling, placements[i], points, count);
+			printKnee(scaling, placements[i], points, count);
+		}
+	}
+	if (csv != stdout && fclose(csv)) {
+		printf("ERROR: cannot write CSV file %s.\n", csvFile);
+		exit(1);
+	}
+	return 0;
+}
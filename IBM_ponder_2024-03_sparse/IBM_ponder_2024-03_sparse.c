@@ -0,0 +1,375 @@
+/*********************************************************************
+ * This code solves the 'IBM Ponder this' challenge from March 2024
+ * See: research.ibm.com/haifa/ponderthis/challenges/March2024.html
+ *
+ * This version is meant for very large n, where the prime window of
+ *  the other versions (memSize + n(n-1)/2 bytes) does not fit in memory.
+ * Only the first terms of each sequence are checked in a prime window,
+ *  the deeper ones are tested one by one (small prime factors first,
+ *  then a deterministic Miller-Rabin test), so memory does not depend on n.
+ *
+ * The algorithm uses a prime generator library.
+ * It can be found at github.com/kimwalisch/primesieve/tree/master
+ * and has to be installed before compiling.
+ *
+ * Usage: Usage: IBM_ponder_2024-03_sparse [-v] [-t numThreads] [-m memSize]
+ *                                         [-D depth] [-k mult] [-s startValue]
+ *                                         [-x certFile] n
+ *	Options:
+ *	 -v
+ *		verbose mode. Print information during the search, and the counts
+ *		and rates of each tier at the end.
+ *
+ *	 -t numThreads
+ *		Uses numThreads threads to compute the results (default is 1)
+ *
+ *	 -m memSize
+ *		Number of tested integers in each window. Default is ten millions.
+ *
+ *	 -D depth
+ *		Number of terms checked in the prime window (default is 300).
+ *		The window is memSize bytes plus the span of these terms.
+ *
+ *	 -k mult
+ *		Step multiplier: the sequence is a_i = a_{i-1} + mult*f(i)
+ *		(default is 1). f is chosen when compiling, see common/ponder_step.h
+ *
+ *	 -s startValue
+ *		The search will start at the given startValue.
+ *
+ *	 -x certFile
+ *		Writes a compositeness certificate of the value found in certFile
+ *		(see common/ponder_cert.h and IBM_ponder_2024-03_certcheck).
+ *
+ ********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <time.h>
+#include <pthread.h>
+
+#define MAX_THREADS 1024 /* CPU_SETSIZE, as libponder */
+
+#include <primesieve.h>
+
+#include "../common/ponder_step.h"
+#include "../common/ponder_verify.h"
+#include "../common/ponder_cert.h"
+
+/* A bunch of global variables accessible by all threads on a read-only basis */
+int verbose = 0;
+char *primeArray = NULL;     /* Array of primes */
+int_fast64_t n ;             /* Which X_n do we want? */
+int_fast64_t memSize;        /* Size of the integers window */
+int_fast64_t denseDepth;     /* Number of terms checked in the window */
+int_fast64_t denseSpan;      /* Difference between a_0 and a_denseDepth-1 */
+int_fast64_t globalOffset;   /* Integers window offset, ie: index 0 represent true integer 'globalOffset' */
+int_fast64_t stepK = 1;      /* Step multiplier */
+
+int numThreads = 1;
+
+/* Best starting value found by a thread, see the multi-threaded version */
+volatile int_fast64_t bestValue = 0;
+pthread_mutex_t mutex;
+
+/* The iterator used to generate all primes. See the primesieve library */
+primesieve_iterator it;
+
+/* What each thread returns: its last tested value (or -1 if it reached
+ *  the end of the window) and how much work each tier has done.
+ */
+typedef struct {
+	int_fast64_t value;
+	int_fast64_t denseCandidates; /* values tested in the prime window */
+	int_fast64_t denseSurvivors;  /* values whose first denseDepth terms are composite */
+	int_fast64_t filteredTerms;   /* deep terms with a small prime factor */
+	int_fast64_t probedTerms;     /* deep terms tested with Miller-Rabin */
+	double totalTime;             /* seconds spent in the thread */
+	double deepTime;              /* seconds spent on deep terms */
+	double probeTime;             /* seconds spent in Miller-Rabin */
+} threadResult;
+
+/* Function prototypes */
+void fillArrayOfPrimes(int_fast64_t memSize);
+int isCorrectValue(int_fast64_t value, threadResult *stats);
+void *mainLoop(void *ptr);
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*********************************************************************/
+
+/* This function allocates (if not already done) an array of primes. The array
+ *  represents integers in the range [globalOffset - globalOffset+memSize].
+ *  Each prime integer is marked with a 1 in the array.
+ * The array only extends denseSpan past the window as only the first
+ *  denseDepth terms of each sequence are read from it.
+ */
+void fillArrayOfPrimes(int_fast64_t memSize) {
+	int_fast64_t lastPrime, pIndex;
+	int_fast64_t primeSize = memSize + denseSpan;
+	if (!primeArray) {
+		primeArray = malloc(sizeof(char) * primeSize);
+		if (!primeArray) {
+			printf("ERROR: cannot allocate enough memory for numbers array.\n");
+			exit(1);
+		}
+	}
+	if (verbose)
+		printf("Initializing numbers array from %" PRIdFAST64 "\n", globalOffset);
+	for (int_fast64_t i = 0; i < primeSize; i++)
+		primeArray[i] = 0;
+
+	// Start from the first prime after the offset and mark 1 for each prime
+	primesieve_jump_to(&it, globalOffset, globalOffset + primeSize);
+	lastPrime = primesieve_next_prime(&it);
+	while ((pIndex = lastPrime - globalOffset) < primeSize) {
+		primeArray[pIndex] = 1;
+		lastPrime = primesieve_next_prime(&it);
+	}
+	if (verbose)
+		printf("Primes marked !\n");
+}
+
+/* Test a value to see if it can be a starting one for the sequence.
+ * The first denseDepth terms are looked up in the prime window, which
+ *  rules out almost all values. For the few remaining ones, each deeper
+ *  term is computed and tested: a small prime factor proves it is
+ *  composite, otherwise Miller-Rabin decides.
+ * The deep terms and the Miller-Rabin tests are only timed in verbose
+ *  mode (for the tier statistics), clock_gettime() costing about as much
+ *  as a small prime test.
+ */
+int isCorrectValue(int_fast64_t value, threadResult *stats) {
+	int_fast64_t i = 1;
+	int_fast64_t valueOffset = value - globalOffset;
+	uint64_t term, p;
+	stepState step;
+	double start, probeStart;
+	int res = 1;
+
+	stats->denseCandidates++;
+	if (primeArray[valueOffset])
+		return 0;
+	stepInit(&step, stepK);
+	while (i < denseDepth) {
+		if (primeArray[(valueOffset += stepNext(&step))])
+			return 0;
+		i++;
+	}
+	stats->denseSurvivors++;
+
+	start = verbose ? now() : 0;
+	term = globalOffset + valueOffset;
+	for (; i < n; i++) {
+		term += stepNext(&step);
+		if ((p = smallPrimeFactor(term)) && p != term) {
+			stats->filteredTerms++;
+			continue;
+		}
+		stats->probedTerms++;
+		if (!verbose)
+			res = !millerRabin64(term);
+		else {
+			probeStart = now();
+			res = !millerRabin64(term);
+			stats->probeTime += now() - probeStart;
+		}
+		if (!res)
+			break;
+	}
+	if (verbose)
+		stats->deepTime += now() - start;
+	return res;
+}
+
+/* This is the main loop executed by each thread, exactly like in the
+ *  multi-threaded version: the thread tests values threadID, threadID +
+ *  numThreads... of the window, until it finds a correct value, another
+ *  thread has found a smaller one or the window is exhausted.
+ */
+void *mainLoop(void *ptr) {
+	int_fast64_t initialOffset = *(int_fast64_t *) ptr;
+	int_fast64_t threadID = initialOffset - globalOffset;
+	threadResult *result = calloc(1, sizeof(threadResult));
+	int_fast64_t startValue = initialOffset;
+	double start = now();
+	int res = 0;
+
+	while (startValue < memSize + globalOffset) {
+		res = isCorrectValue(startValue, result);
+		if (verbose && !(startValue & 0x7FFFFFF))
+			// print tested value once in a while
+			printf("Testing %" PRIdFAST64 "\n", startValue);
+		if (res || (bestValue && bestValue < startValue))
+			break;
+		startValue += numThreads;
+	}
+	result->totalTime = now() - start;
+	if (startValue >= memSize + globalOffset) {
+		if (verbose)
+			printf("Thread %" PRIdFAST64 " out of memory.\n", threadID);
+		result->value = -1;
+		return result;
+	}
+	result->value = startValue;
+	if (!res)
+		return result;
+	pthread_mutex_lock(&mutex);
+	if (!bestValue || startValue < bestValue) {
+		if (verbose)
+			printf("Thread %" PRIdFAST64 " updates best value.\n", threadID);
+		bestValue = startValue;
+	}
+	pthread_mutex_unlock(&mutex);
+	return result;
+}
+
+/* Prints how many items each tier has processed and at which rate (verbose
+ *  mode only, the tiers are not timed otherwise).
+ *  Rates are per thread-second, so they do not depend on the number of threads.
+ */
+void printTierStats(threadResult *total) {
+	double denseTime = total->totalTime - total->deepTime;
+	double filterTime = total->deepTime - total->probeTime;
+
+	printf("Dense tier (terms 0-%" PRIdFAST64 "): %" PRIdFAST64 " values, %" PRIdFAST64
+	       " survivors, %.3g values/s\n", denseDepth - 1, total->denseCandidates,
+	       total->denseSurvivors, denseTime > 0 ? total->denseCandidates / denseTime : 0.0);
+	printf("Small prime tier: %" PRIdFAST64 " terms ruled out, %.3g terms/s\n",
+	       total->filteredTerms,
+	       filterTime > 0 ? (total->filteredTerms + total->probedTerms) / filterTime : 0.0);
+	printf("Miller-Rabin tier: %" PRIdFAST64 " terms tested, %.3g tests/s\n",
+	       total->probedTerms, total->probeTime > 0 ? total->probedTerms / total->probeTime : 0.0);
+}
+
+/* The main function sets up the integer windows and launches the
+ *  threads, like the multi-threaded version.
+ */
+int main(int argc, char **argv) {
+	pthread_t *ID;
+	int_fast64_t *tab;
+	void *exitPtr;
+	threadResult total = { 0 };
+	int_fast64_t startValue = 0;
+	char *certFile = NULL;
+	int i;
+
+	memSize = 10000000L; // default memory size of 10 millions
+	denseDepth = 300;
+	int c;
+
+	while ((c = getopt (argc, argv, "vm:t:D:k:s:x:")) != -1) {
+		switch (c) {
+			case 'v':
+				verbose = 1;
+				break;
+			case 'm':
+				memSize = strtoll(optarg, NULL, 10);
+				break;
+			case 't':
+				numThreads = strtoll(optarg, NULL, 10);
+				if ((numThreads <= 0) || (numThreads > MAX_THREADS)) {
+					printf("Number of threads has to be between 1 and %d.\n", MAX_THREADS);
+					exit(1);
+				}
+				break;
+			case 'D':
+				denseDepth = strtoll(optarg, NULL, 10);
+				break;
+			case 'k':
+				stepK = strtoll(optarg, NULL, 10);
+				break;
+			case 's':
+				startValue = strtoll(optarg, NULL, 10);
+				break;
+			case 'x':
+				certFile = optarg;
+				break;
+			case '?':
+				if (optopt == 'm' || optopt == 't' || optopt == 'D' || optopt == 'k' || optopt == 's' || optopt == 'x')
+					fprintf (stderr, "Option -%c requires an argument.\n", optopt);
+				else if (isprint (optopt))
+					fprintf (stderr, "Unknown option `-%c'.\n", optopt);
+				else
+					fprintf (stderr, "Unknown option character `\\x%x'.\n", optopt);
+				fprintf (stderr, "Usage: sparse [-v] [-m memsize] [-t #threads] [-D depth] "
+				                 "[-k mult] [-s start] [-x cert] n\n");
+				return 1;
+			default:
+				abort();
+		}
+	}
+	if (optind+1 != argc) {
+		fprintf (stderr, "Usage: sparse [-v] [-m memsize] [-t #threads] [-D depth] "
+		                 "[-k mult] [-s start] [-x cert] n\n");
+		return 1;
+	}
+
+	n = strtoll(argv[optind], NULL, 10);
+	if (denseDepth < 1)
+		denseDepth = 1;
+	if (denseDepth > n)
+		denseDepth = n;
+	if ((denseSpan = stepSpan(denseDepth, stepK)) < 0 || stepSpan(n, stepK) < 0) {
+		printf("ERROR: the sequence span does not fit in 64 bits.\n");
+		exit(1);
+	}
+	ID = malloc(sizeof(pthread_t) * numThreads);
+	tab = malloc(sizeof(int_fast64_t) * numThreads);
+	if (!ID || !tab) {
+		printf("ERROR: cannot allocate the state of %d threads.\n", numThreads);
+		exit(1);
+	}
+	globalOffset = startValue;
+	primesieve_init(&it);
+	pthread_mutex_init(&mutex, NULL); /* initialize lock */
+
+	if (verbose)
+		printf("Looking for n=%" PRIdFAST64 ", first %" PRIdFAST64 " terms in a window of %"
+		       PRIdFAST64 " bytes\n", n, denseDepth, memSize + denseSpan);
+
+	while (!bestValue) {
+		fillArrayOfPrimes(memSize);
+		for (i = 0; i < numThreads; i++) {
+			tab[i] = i+globalOffset;
+			pthread_create(&ID[i], NULL, mainLoop, &tab[i]);
+		}
+		for (i = 0; i < numThreads; i++) {
+			threadResult *r;
+			pthread_join(ID[i], &exitPtr);
+			r = exitPtr;
+			total.denseCandidates += r->denseCandidates;
+			total.denseSurvivors += r->denseSurvivors;
+			total.filteredTerms += r->filteredTerms;
+			total.probedTerms += r->probedTerms;
+			total.totalTime += r->totalTime;
+			total.deepTime += r->deepTime;
+			total.probeTime += r->probeTime;
+			if (verbose)
+				printf("Le thread %d returns %" PRIdFAST64 ".\n", i, r->value);
+			free(exitPtr);
+		}
+		globalOffset += memSize;
+	}
+	pthread_mutex_destroy(&mutex); /* destroy lock */
+
+	printf("For n=%" PRIdFAST64 ", a start value of %" PRIdFAST64 " has been found\n", n, bestValue);
+	if (verbose)
+		printTierStats(&total);
+	verifySequence(bestValue, n, stepK, numThreads);
+	if (certFile)
+		emitCertificate(certFile, bestValue, n, stepK);
+
+	primesieve_free_iterator(&it);
+	free(primeArray);
+	free(ID);
+	free(tab);
+}
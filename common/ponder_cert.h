@@ -0,0 +1,345 @@
+/*********************************************************************
+ * Compositeness certificates.
+ *
+ * A certificate gives, for each term a_i of a sequence, a nontrivial
+ *  factor of a_i, or 0 for a term of 0 or 1 (not prime, with no factor). Checking it only needs one division per term, with no
+ *  prime generation and no primality test, so anybody can re-check a
+ *  published answer in a few milliseconds.
+ *
+ * Most terms have a factor below 100. The others are trial divided up
+ *  to CERT_TRIAL_LIMIT and then factored with Brent's variant of Pollard
+ *  rho. The factor kept is the smaller of the two cofactors, so it
+ *  always fits in 64 bits even for 128-bit terms.
+ *
+ * File format (all integers little endian, whatever the machine):
+ *	8 bytes   magic "PONDCRT1"
+ *	16 bytes  step policy name (STEP_NAME), zero padded
+ *	8 bytes   n
+ *	8 bytes   k
+ *	16 bytes  a_0
+ *	n factors (0 for a_i < 2), each one as a LEB128 varint (7 bits per
+ *	byte, high bit set on every byte but the last), ie: one byte for
+ *	factors below 128.
+ *
+ * Requires ponder_step.h to be included first (it gives the step policy).
+ ********************************************************************/
+
+#ifndef PONDER_CERT_H
+#define PONDER_CERT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "ponder_prime.h"
+
+#define CERT_MAGIC "PONDCRT1"
+#define CERT_POLICY_SIZE 16
+#define CERT_TRIAL_LIMIT 65536
+#define CERT_MIN_TERMS_PER_THREAD 4096
+#define CERT_MAX_THREADS 64
+
+typedef struct {
+	char policy[CERT_POLICY_SIZE];
+	int_fast64_t n;
+	int_fast64_t k;
+	ponder_u128 initialValue;
+	uint64_t *factors;     /* n factors, factors[i] divides a_i */
+} ponderCertificate;
+
+static inline ponder_u128 gcdU128(ponder_u128 a, ponder_u128 b) {
+	while (b) {
+		ponder_u128 t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/* x^2+c modulo value, x in Montgomery form */
+static inline ponder_u128 rhoStep(ponder_u128 x, ponder_u128 c, ponder_u128 value, ponder_u128 inv) {
+	x = montMul128(x, x, value, inv);
+	return (x >= value - c) ? x - (value - c) : x + c;
+}
+
+/* Brent's variant of Pollard rho on an odd composite 'value'. Returns a
+ *  nontrivial factor. Everything stays in Montgomery form: the polynomial
+ *  x^2+c is as good a pseudo-random map there.
+ */
+static inline ponder_u128 pollardRho(ponder_u128 value) {
+	ponder_u128 inv = montInverse((uint64_t) value);
+	inv *= 2 - value * inv; // from 64 to 128 correct bits
+
+	for (ponder_u128 c = 1; ; c++) {
+		ponder_u128 x, y = 2, ys = 2, q = 1, d = 1;
+		uint64_t r = 1, i, j;
+
+		do {
+			x = y;
+			for (i = 0; i < r; i++)
+				y = rhoStep(y, c, value, inv);
+			/* Products are accumulated in q, one gcd every 128 steps */
+			for (i = 0; i < r && d == 1; i += 128) {
+				ys = y;
+				for (j = 0; j < 128 && j < r - i; j++) {
+					y = rhoStep(y, c, value, inv);
+					q = montMul128(q, (x > y) ? x - y : y - x, value, inv);
+				}
+				d = gcdU128(q, value);
+			}
+			r <<= 1;
+		} while (d == 1);
+		if (d == value) {
+			/* The batch went too far, redo it one step at a time */
+			do {
+				ys = rhoStep(ys, c, value, inv);
+				d = gcdU128((x > ys) ? x - ys : ys - x, value);
+			} while (d == 1);
+		}
+		if (d != value)
+			return d;
+	}
+}
+
+/* Returns a nontrivial factor of 'value', at most its square root,
+ *  or 0 if 'value' is prime (or lower than 4).
+ */
+static inline uint64_t findFactor(ponder_u128 value) {
+	ponder_u128 d;
+
+	if (value < 4)
+		return 0;
+	if (!(value >> 64)) {
+		uint64_t v = (uint64_t) value, p;
+		if ((p = smallPrimeFactor(v)))
+			return (p == v) ? 0 : p;
+		for (p = 101; p < CERT_TRIAL_LIMIT && p * p <= v; p += 2)
+			if (!(v % p))
+				return p;
+	} else {
+		if (!(value & 1))
+			return 2;
+#define PONDER_TRY_DIVIDE(p) if (!(value % p)) return p;
+		PONDER_SMALL_PRIMES(PONDER_TRY_DIVIDE)
+#undef PONDER_TRY_DIVIDE
+	}
+	if (isPrime128(value))
+		return 0;
+	d = pollardRho(value);
+	if (d > value / d)
+		d = value / d;
+	return (uint64_t) d;
+}
+
+/* Fills a certificate for the sequence starting at initialValue. Returns
+ *  -1 on success, or the index of a term with no factor (a prime term).
+ */
+static inline int_fast64_t buildCertificate(ponderCertificate *cert, ponder_u128 initialValue,
+                                            int_fast64_t n, int_fast64_t k) {
+	ponder_u128 term = initialValue;
+	stepState step;
+
+	memset(cert->policy, 0, CERT_POLICY_SIZE);
+	snprintf(cert->policy, CERT_POLICY_SIZE, "%s", STEP_NAME);
+	cert->n = n;
+	cert->k = k;
+	cert->initialValue = initialValue;
+	if (!(cert->factors = malloc(n * sizeof(uint64_t)))) {
+		printf("ERROR: cannot allocate certificate.\n");
+		exit(1);
+	}
+	stepInit(&step, k);
+	for (int_fast64_t i = 0; i < n; i++) {
+		if (term < 2)
+			cert->factors[i] = 0;
+		else if (!(cert->factors[i] = findFactor(term)))
+			return i;
+		term += stepNext(&step);
+	}
+	return -1;
+}
+
+static inline void putLittleEndian(unsigned char *buffer, ponder_u128 value, int size) {
+	for (int i = 0; i < size; i++, value >>= 8)
+		buffer[i] = (unsigned char) value;
+}
+
+static inline ponder_u128 getLittleEndian(const unsigned char *buffer, int size) {
+	ponder_u128 value = 0;
+	for (int i = size - 1; i >= 0; i--)
+		value = (value << 8) | buffer[i];
+	return value;
+}
+
+#define CERT_HEADER_SIZE (8 + CERT_POLICY_SIZE + 8 + 8 + 16)
+
+/* Writes a certificate. Returns 1 on success, 0 otherwise. */
+static inline int writeCertificate(const char *fileName, const ponderCertificate *cert) {
+	unsigned char header[CERT_HEADER_SIZE];
+	FILE *f;
+	int ok;
+
+	memcpy(header, CERT_MAGIC, 8);
+	memcpy(header + 8, cert->policy, CERT_POLICY_SIZE);
+	putLittleEndian(header + 8 + CERT_POLICY_SIZE, cert->n, 8);
+	putLittleEndian(header + 16 + CERT_POLICY_SIZE, cert->k, 8);
+	putLittleEndian(header + 24 + CERT_POLICY_SIZE, cert->initialValue, 16);
+	if (!(f = fopen(fileName, "wb")))
+		return 0;
+	ok = (fwrite(header, CERT_HEADER_SIZE, 1, f) == 1);
+	for (int_fast64_t i = 0; i < cert->n && ok; i++) {
+		uint64_t v = cert->factors[i];
+		while (v >= 0x80) {
+			putc((int) (v & 0x7F) | 0x80, f);
+			v >>= 7;
+		}
+		ok = (putc((int) v, f) != EOF);
+	}
+	ok = !fclose(f) && ok;
+	return ok;
+}
+
+/* Reads a certificate. Returns 1 on success, 0 if the file cannot be read
+ *  or is not a certificate. The factors have to be freed by the caller.
+ */
+static inline int readCertificate(const char *fileName, ponderCertificate *cert) {
+	unsigned char header[CERT_HEADER_SIZE];
+	FILE *f;
+	int ok = 1;
+
+	cert->factors = NULL;
+	if (!(f = fopen(fileName, "rb")))
+		return 0;
+	if (fread(header, CERT_HEADER_SIZE, 1, f) != 1 || memcmp(header, CERT_MAGIC, 8)) {
+		fclose(f);
+		return 0;
+	}
+	memcpy(cert->policy, header + 8, CERT_POLICY_SIZE);
+	cert->policy[CERT_POLICY_SIZE - 1] = 0;
+	cert->n = (int_fast64_t) getLittleEndian(header + 8 + CERT_POLICY_SIZE, 8);
+	cert->k = (int_fast64_t) getLittleEndian(header + 16 + CERT_POLICY_SIZE, 8);
+	cert->initialValue = getLittleEndian(header + 24 + CERT_POLICY_SIZE, 16);
+	if (cert->n <= 0 || !(cert->factors = malloc(cert->n * sizeof(uint64_t)))) {
+		fclose(f);
+		return 0;
+	}
+	for (int_fast64_t i = 0; i < cert->n && ok; i++) {
+		uint64_t v = 0;
+		int c, shift = 0;
+		do {
+			if ((c = getc(f)) == EOF || shift > 63) {
+				ok = 0;
+				break;
+			}
+			v |= (uint64_t) (c & 0x7F) << shift;
+			shift += 7;
+		} while (c & 0x80);
+		cert->factors[i] = v;
+	}
+	if (ok && getc(f) != EOF)
+		ok = 0; // trailing garbage
+	fclose(f);
+	if (!ok) {
+		free(cert->factors);
+		cert->factors = NULL;
+	}
+	return ok;
+}
+
+typedef struct {
+	const ponderCertificate *cert;
+	int_fast64_t first, last;     /* terms [first, last) are checked */
+	atomic_int_fast64_t *failed;  /* smallest index of a wrong factor, or n */
+} certChunk;
+
+/* Checks factors [first, last): each one has to be in ]1, a_i[ and divide
+ *  a_i, or to be 0 for a_i < 2
+ */
+static void *certChunkLoop(void *ptr) {
+	certChunk *chunk = ptr;
+	const ponderCertificate *cert = chunk->cert;
+	ponder_u128 term = cert->initialValue;
+	int_fast64_t i;
+	stepState step;
+
+	stepInit(&step, cert->k);
+	for (i = 1; i <= chunk->first; i++)
+		term += stepNext(&step);
+	for (i = chunk->first; i < chunk->last; i++) {
+		uint64_t f = cert->factors[i];
+		int ok = (term < 2) ? !f : (f > 1 && f < term);
+		if (ok && term >= 2)
+			ok = (term >> 64) ? !(term % f) : !((uint64_t) term % f);
+		if (!ok) {
+			int_fast64_t failed = atomic_load(chunk->failed);
+			while (i < failed && !atomic_compare_exchange_weak(chunk->failed, &failed, i))
+				;
+			break;
+		}
+		if (!(i & 0xFFF) && atomic_load_explicit(chunk->failed, memory_order_relaxed) < i)
+			break;
+		term += stepNext(&step);
+	}
+	return NULL;
+}
+
+/* Checks every factor of a certificate with up to numThreads threads
+ *  (0 means one per online processor). Returns the index of the first
+ *  wrong factor, or n if the certificate is valid.
+ */
+static inline int_fast64_t checkCertificate(const ponderCertificate *cert, int numThreads) {
+	pthread_t ID[CERT_MAX_THREADS];
+	certChunk chunks[CERT_MAX_THREADS];
+	atomic_int_fast64_t failed;
+	int i;
+
+	if (numThreads <= 0)
+		numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (numThreads > cert->n / CERT_MIN_TERMS_PER_THREAD)
+		numThreads = cert->n / CERT_MIN_TERMS_PER_THREAD;
+	if (numThreads > CERT_MAX_THREADS)
+		numThreads = CERT_MAX_THREADS;
+	if (numThreads < 1)
+		numThreads = 1;
+
+	atomic_init(&failed, cert->n);
+	for (i = 0; i < numThreads; i++) {
+		chunks[i].cert = cert;
+		chunks[i].first = cert->n * i / numThreads;
+		chunks[i].last = cert->n * (i+1) / numThreads;
+		chunks[i].failed = &failed;
+	}
+	if (numThreads == 1)
+		certChunkLoop(&chunks[0]);
+	else {
+		for (i = 0; i < numThreads; i++)
+			pthread_create(&ID[i], NULL, certChunkLoop, &chunks[i]);
+		for (i = 0; i < numThreads; i++)
+			pthread_join(ID[i], NULL);
+	}
+	return atomic_load(&failed);
+}
+
+/* Builds the certificate of a found value and writes it, printing what
+ *  happened. Used by the searches when asked for a certificate.
+ */
+static inline void emitCertificate(const char *fileName, ponder_u128 initialValue,
+                                   int_fast64_t n, int_fast64_t k) {
+	ponderCertificate cert;
+	int_fast64_t prime;
+
+	if ((prime = buildCertificate(&cert, initialValue, n, k)) >= 0)
+		printf("ERROR: no certificate, term %" PRIdFAST64 " is prime.\n", prime);
+	else if (!writeCertificate(fileName, &cert))
+		printf("ERROR: cannot write certificate file %s.\n", fileName);
+	else
+		printf("Certificate written in %s\n", fileName);
+	free(cert.factors);
+}
+
+#endif /* PONDER_CERT_H */
@@ -0,0 +1,179 @@
+/*********************************************************************
+ * Checkpoints for long searches.
+ *
+ * A checkpoint is a small text file of 'key=value' lines recording the
+ *  search parameters and how far the search went: every integer below
+ *  'offset' + 'carry' has been ruled out. 'offset' is the start of the
+ *  first window not completed and 'carry' the part of that window already
+ *  proven (the searches give an exact offset and leave it at 0, it is kept
+ *  for checkpoints written by older versions of Algorithm 1).
+ *
+ * The file is first written under a temporary name, synced to disk and
+ *  then renamed, so a crash at any time leaves either the previous or the
+ *  new checkpoint, never a partial one.
+ *
+ * SIGINT and SIGTERM only set 'stopRequested': the search notices it,
+ *  writes a last checkpoint and exits.
+ *
+ * Requires ponder_step.h to be included first (it gives the step policy).
+ ********************************************************************/
+
+#ifndef PONDER_CHECKPOINT_H
+#define PONDER_CHECKPOINT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <libgen.h>
+
+#include "ponder_u128.h"
+
+#define CHECKPOINT_FORMAT 1
+
+typedef struct {
+	char engine[32];       /* which program wrote it */
+	char policy[32];       /* STEP_NAME */
+	int_fast64_t n;
+	int_fast64_t k;
+	int_fast64_t memSize;
+	int_fast64_t threads;
+	ponder_u128 offset;    /* first window not completed */
+	int_fast64_t carry;    /* already ruled out part of that window */
+	int found;             /* set when the search is over */
+	ponder_u128 bestValue; /* the answer if found is set */
+} ponderCheckpoint;
+
+/* Set by the signal handler, read by the searches */
+static volatile sig_atomic_t stopRequested = 0;
+
+static void checkpointSignalHandler(int sig) {
+	(void) sig;
+	stopRequested = 1;
+}
+
+/* Installs the handler for SIGINT and SIGTERM */
+static inline void installCheckpointSignals(void) {
+	struct sigaction action;
+
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = checkpointSignalHandler;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+}
+
+/* Writes the checkpoint atomically. Returns 1 on success, 0 otherwise
+ *  (the previous checkpoint, if any, is then left untouched).
+ */
+static inline int writeCheckpoint(const char *fileName, const ponderCheckpoint *cp) {
+	char tmpName[4096], dirName[4096];
+	char offset[U128_STRING_SIZE], best[U128_STRING_SIZE];
+	FILE *f;
+	int fd, ok;
+
+	snprintf(tmpName, sizeof(tmpName), "%s.tmp", fileName);
+	if (!(f = fopen(tmpName, "w")))
+		return 0;
+	fprintf(f, "format=%d\n", CHECKPOINT_FORMAT);
+	fprintf(f, "engine=%s\n", cp->engine);
+	fprintf(f, "policy=%s\n", cp->policy);
+	fprintf(f, "n=%" PRIdFAST64 "\n", cp->n);
+	fprintf(f, "k=%" PRIdFAST64 "\n", cp->k);
+	fprintf(f, "memSize=%" PRIdFAST64 "\n", cp->memSize);
+	fprintf(f, "threads=%" PRIdFAST64 "\n", cp->threads);
+	fprintf(f, "offset=%s\n", u128ToString(cp->offset, offset));
+	fprintf(f, "carry=%" PRIdFAST64 "\n", cp->carry);
+	fprintf(f, "found=%d\n", cp->found);
+	fprintf(f, "bestValue=%s\n", u128ToString(cp->bestValue, best));
+	ok = !ferror(f) && !fflush(f) && !fsync(fileno(f));
+	ok = !fclose(f) && ok;
+	if (!ok || rename(tmpName, fileName)) {
+		unlink(tmpName);
+		return 0;
+	}
+	/* Make the rename itself durable */
+	snprintf(dirName, sizeof(dirName), "%s", fileName);
+	if ((fd = open(dirname(dirName), O_RDONLY)) >= 0) {
+		fsync(fd);
+		close(fd);
+	}
+	return 1;
+}
+
+/* Reads a checkpoint. Returns 1 on success, 0 if the file cannot be read
+ *  or is not a complete checkpoint.
+ */
+static inline int readCheckpoint(const char *fileName, ponderCheckpoint *cp) {
+	char line[256], *value;
+	int fields = 0;
+	FILE *f;
+
+	memset(cp, 0, sizeof(*cp));
+	if (!(f = fopen(fileName, "r")))
+		return 0;
+	while (fgets(line, sizeof(line), f)) {
+		line[strcspn(line, "\n")] = 0;
+		if (!(value = strchr(line, '=')))
+			continue;
+		*value++ = 0;
+		fields++;
+		if (!strcmp(line, "format")) {
+			if (atoi(value) != CHECKPOINT_FORMAT)
+				fields = -100;
+		} else if (!strcmp(line, "engine"))
+			snprintf(cp->engine, sizeof(cp->engine), "%s", value);
+		else if (!strcmp(line, "policy"))
+			snprintf(cp->policy, sizeof(cp->policy), "%s", value);
+		else if (!strcmp(line, "n"))
+			cp->n = strtoll(value, NULL, 10);
+		else if (!strcmp(line, "k"))
+			cp->k = strtoll(value, NULL, 10);
+		else if (!strcmp(line, "memSize"))
+			cp->memSize = strtoll(value, NULL, 10);
+		else if (!strcmp(line, "threads"))
+			cp->threads = strtoll(value, NULL, 10);
+		else if (!strcmp(line, "offset"))
+			fields -= !parseU128(value, &cp->offset);
+		else if (!strcmp(line, "carry"))
+			cp->carry = strtoll(value, NULL, 10);
+		else if (!strcmp(line, "found"))
+			cp->found = atoi(value);
+		else if (!strcmp(line, "bestValue"))
+			fields -= !parseU128(value, &cp->bestValue);
+		else
+			fields--;
+	}
+	fclose(f);
+	return fields == 11;
+}
+
+/* Checks that a checkpoint was written by the same engine for the same
+ *  sequence. Prints an error and exits otherwise.
+ */
+static inline void checkCheckpoint(const ponderCheckpoint *cp, const char *engine,
+                                   int_fast64_t n, int_fast64_t k) {
+	if (strcmp(cp->engine, engine) || strcmp(cp->policy, STEP_NAME) || cp->n != n || cp->k != k) {
+		printf("ERROR: the checkpoint is for %s, %s step, n=%" PRIdFAST64 ", k=%" PRIdFAST64 ".\n",
+		       cp->engine, cp->policy, cp->n, cp->k);
+		exit(1);
+	}
+}
+
+/* Returns 1 if at least 'interval' seconds have passed since *last
+ *  (and then updates it).
+ */
+static inline int checkpointDue(time_t *last, int interval) {
+	time_t now = time(NULL);
+	if (now - *last < interval)
+		return 0;
+	*last = now;
+	return 1;
+}
+
+#endif /* PONDER_CHECKPOINT_H */
@@ -0,0 +1,274 @@
+/*********************************************************************
+ * Live metrics of a running search.
+ *
+ * The progress callbacks of the searches give the last state of the search
+ *  to metricsUpdate() after each window (or block for Algorithm 1). A
+ *  thread started by metricsStart() then:
+ *  - rewrites a metrics file in the Prometheus text format every
+ *    METRICS_INTERVAL seconds, under a temporary name renamed afterwards, as
+ *    expected by the textfile collector of the node exporter (the file name
+ *    has to end with .prom for it);
+ *  - prints a snapshot on stderr when the process receives SIGUSR1.
+ * Both keep going when a window takes long: the age of the last update
+ *  (ponder_last_progress_timestamp_seconds) shows a stalled search.
+ *
+ * The rates are measured over the windows completed between the previous
+ *  file (or snapshot) and the last one, so a window longer than the
+ *  interval does not show a rate of 0. The ETA is given when a target is known: the end of
+ *  the range or an estimate of the answer given on the command line.
+ *
+ * Requires ponder_step.h to be included first (it gives the step policy).
+ ********************************************************************/
+
+#ifndef PONDER_METRICS_H
+#define PONDER_METRICS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "ponder_u128.h"
+#include "../libponder/ponder.h"
+
+#define METRICS_INTERVAL 10    /* seconds between two writes of the file */
+#define METRICS_POLL_MS 200    /* how often the thread looks for SIGUSR1 */
+
+typedef struct {
+	double time;               /* CLOCK_MONOTONIC */
+	ponder_u128 watermark;
+	ponderStats stats;
+} metricsSample;
+
+typedef struct {
+	const char *fileName;      /* metrics file, NULL for the snapshots only */
+	const char *program;
+	ponderParams params;
+	int proven;                /* every value below params.startValue is ruled out */
+	ponder_u128 target;        /* end of the range or estimated answer, 0 if unknown */
+	int done;
+	pthread_mutex_t lock;
+	pthread_t thread;
+	double startTime;
+	time_t lastProgress;
+	metricsSample current;     /* last update */
+	metricsSample file[2];     /* updates used for the rates of the file: [0] to [1] */
+	metricsSample snap[2];     /* same for the snapshots */
+} ponderMetrics;
+
+/* Set by the SIGUSR1 handler, read by the metrics thread */
+static volatile sig_atomic_t snapshotRequested = 0;
+
+static void metricsSignalHandler(int sig) {
+	(void) sig;
+	snapshotRequested = 1;
+}
+
+static inline double metricsClock(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/* Rate of start values tested, over all threads or for one of them (thread >= 0) */
+static inline double metricsRate(const metricsSample *from, const metricsSample *to, int thread) {
+	double seconds = to->time - from->time;
+	int_fast64_t tests;
+
+	if (thread < 0)
+		tests = to->stats.tests - from->stats.tests;
+	else if (thread < to->stats.numThreads) // the first sample has no thread yet
+		tests = to->stats.threads[thread].tests
+		        - (thread < from->stats.numThreads ? from->stats.threads[thread].tests : 0);
+	else
+		tests = 0;
+	return seconds > 0 ? tests / seconds : 0.0;
+}
+
+/* Copies a sample with its own thread statistics */
+static inline void metricsCopySample(metricsSample *to, const metricsSample *from) {
+	to->time = from->time;
+	to->watermark = from->watermark;
+	ponderCopyStats(&to->stats, &from->stats);
+}
+
+/* Moves the interval of the rates to end at the last update, if there is a new one */
+static inline void metricsAdvance(const ponderMetrics *m, metricsSample *interval) {
+	if (m->current.time > interval[1].time) {
+		metricsCopySample(&interval[0], &interval[1]);
+		metricsCopySample(&interval[1], &m->current);
+	}
+}
+
+/* Seconds left to reach the target at the given rate, -1 if unknown */
+static inline double metricsEta(const ponderMetrics *m, double rate) {
+	if (!m->target || rate <= 0)
+		return -1;
+	if (m->current.watermark >= m->target)
+		return 0;
+	return (double) (m->target - m->current.watermark) / rate;
+}
+
+/* Writes the metrics file. Called with the lock held. */
+static inline void writeMetrics(ponderMetrics *m) {
+	static const char *engines[] = { "", "backward", "window", "threaded" };
+	const ponderStats *s = &m->current.stats;
+	char tmpName[4096], value[U128_STRING_SIZE];
+	double rate, eta;
+	FILE *f;
+
+	metricsAdvance(m, m->file);
+	rate = metricsRate(&m->file[0], &m->file[1], -1);
+	eta = metricsEta(m, rate);
+
+	snprintf(tmpName, sizeof(tmpName), "%s.tmp", m->fileName);
+	if (!(f = fopen(tmpName, "w")))
+		return;
+	fprintf(f, "# TYPE ponder_search_info gauge\n");
+	fprintf(f, "ponder_search_info{program=\"%s\",engine=\"%s\",step=\"%s\",n=\"%" PRIdFAST64 "\",k=\"%" PRIdFAST64
+	        "\",start=\"%s\"} 1\n", m->program, engines[m->params.engine], STEP_NAME, m->params.n, m->params.k,
+	        u128ToString(m->params.startValue, value));
+	fprintf(f, "# TYPE ponder_offset gauge\n# HELP ponder_offset Next start value to be tested.\n");
+	fprintf(f, "ponder_offset %.17g\n", (double) m->current.watermark);
+	if (m->proven) {
+		fprintf(f, "# TYPE ponder_lower_bound gauge\n# HELP ponder_lower_bound Every value below is ruled out.\n");
+		fprintf(f, "ponder_lower_bound %.17g\n", (double) m->current.watermark);
+	}
+	fprintf(f, "# TYPE ponder_windows_total counter\nponder_windows_total %" PRIdFAST64 "\n", s->windows);
+	fprintf(f, "# TYPE ponder_candidates_total counter\nponder_candidates_total %" PRIdFAST64 "\n", s->tests);
+	fprintf(f, "# TYPE ponder_primes_total counter\nponder_primes_total %" PRIdFAST64 "\n", s->primes);
+	fprintf(f, "# TYPE ponder_candidates_per_second gauge\nponder_candidates_per_second %.0f\n", rate);
+	if (s->numThreads) {
+		fprintf(f, "# TYPE ponder_thread_candidates_per_second gauge\n");
+		for (int i = 0; i < s->numThreads; i++)
+			fprintf(f, "ponder_thread_candidates_per_second{thread=\"%d\"} %.0f\n", i,
+			        metricsRate(&m->file[0], &m->file[1], i));
+	}
+	fprintf(f, "# TYPE ponder_fill_seconds_total counter\nponder_fill_seconds_total %.3f\n", s->fillSeconds);
+	fprintf(f, "# TYPE ponder_test_seconds_total counter\nponder_test_seconds_total %.3f\n", s->testSeconds);
+	if (m->target) {
+		fprintf(f, "# TYPE ponder_target gauge\nponder_target %.17g\n", (double) m->target);
+		if (eta >= 0)
+			fprintf(f, "# TYPE ponder_eta_seconds gauge\nponder_eta_seconds %.0f\n", eta);
+	}
+	fprintf(f, "# TYPE ponder_elapsed_seconds gauge\nponder_elapsed_seconds %.3f\n", metricsClock() - m->startTime);
+	fprintf(f, "# TYPE ponder_last_progress_timestamp_seconds gauge\n");
+	fprintf(f, "ponder_last_progress_timestamp_seconds %lld\n", (long long) m->lastProgress);
+	fprintf(f, "# TYPE ponder_done gauge\nponder_done %d\n", m->done);
+	if (fclose(f) || rename(tmpName, m->fileName))
+		unlink(tmpName);
+}
+
+/* Prints a snapshot on stderr. Called with the lock held. */
+static inline void printSnapshot(ponderMetrics *m) {
+	const ponderStats *s = &m->current.stats;
+	char value[U128_STRING_SIZE];
+	double rate, eta;
+
+	metricsAdvance(m, m->snap);
+	rate = metricsRate(&m->snap[0], &m->snap[1], -1);
+	eta = metricsEta(m, rate);
+
+	fprintf(stderr, "[%s n=%" PRIdFAST64 " k=%" PRIdFAST64 "] %.0f s, offset %s%s, %" PRIdFAST64 " windows, %"
+	        PRIdFAST64 " candidates, %.0f candidates/s", m->program, m->params.n, m->params.k,
+	        metricsClock() - m->startTime, u128ToString(m->current.watermark, value),
+	        m->proven ? " (lower bound)" : "", s->windows, s->tests, rate);
+	if (eta >= 0)
+		fprintf(stderr, ", ETA %.0f s", eta);
+	fprintf(stderr, ", last progress %lld s ago\n", (long long) (time(NULL) - m->lastProgress));
+	if (s->numThreads > 1) {
+		fprintf(stderr, "  per thread:");
+		for (int i = 0; i < s->numThreads; i++)
+			fprintf(stderr, " %.0f", metricsRate(&m->snap[0], &m->snap[1], i));
+		fprintf(stderr, " candidates/s\n");
+	}
+}
+
+static void *metricsThread(void *arg) {
+	ponderMetrics *m = arg;
+	struct timespec pause = { 0, METRICS_POLL_MS * 1000000L };
+	time_t lastWrite = 0;
+
+	while (1) {
+		pthread_mutex_lock(&m->lock);
+		if (snapshotRequested) {
+			snapshotRequested = 0;
+			printSnapshot(m);
+		}
+		if (m->fileName && (m->done || time(NULL) - lastWrite >= METRICS_INTERVAL)) {
+			writeMetrics(m);
+			lastWrite = time(NULL);
+		}
+		if (m->done) {
+			pthread_mutex_unlock(&m->lock);
+			return NULL;
+		}
+		pthread_mutex_unlock(&m->lock);
+		nanosleep(&pause, NULL);
+	}
+}
+
+/* Installs the SIGUSR1 handler and starts the metrics thread.
+ *  'fileName' may be NULL (snapshots only). Returns 1 on success.
+ */
+static inline int metricsStart(ponderMetrics *m, const char *fileName, const char *program,
+                               const ponderParams *params, int proven, ponder_u128 target) {
+	struct sigaction action;
+
+	memset(m, 0, sizeof(*m));
+	m->fileName = fileName;
+	m->program = program;
+	m->params = *params;
+	m->proven = proven;
+	m->target = target ? target : params->endValue;
+	m->startTime = m->current.time = metricsClock();
+	m->current.watermark = params->startValue;
+	m->file[0] = m->file[1] = m->snap[0] = m->snap[1] = m->current;
+	m->lastProgress = time(NULL);
+	pthread_mutex_init(&m->lock, NULL);
+
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = metricsSignalHandler;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGUSR1, &action, NULL);
+	return !pthread_create(&m->thread, NULL, metricsThread, m);
+}
+
+/* Called by the progress callbacks with the state of the search */
+static inline void metricsUpdate(ponderMetrics *m, ponder_u128 watermark, const ponderStats *stats) {
+	pthread_mutex_lock(&m->lock);
+	m->current.time = metricsClock();
+	m->current.watermark = watermark;
+	ponderCopyStats(&m->current.stats, stats);
+	m->lastProgress = time(NULL);
+	pthread_mutex_unlock(&m->lock);
+}
+
+/* Writes the file a last time, with the final state of the search and
+ *  ponder_done 1, stops the thread and frees the samples.
+ */
+static inline void metricsStop(ponderMetrics *m, const ponderContext *ctx) {
+	ponderStats stats = { 0 };
+
+	ponderGetStats(ctx, &stats);
+	metricsUpdate(m, ponderWatermark(ctx), &stats);
+	ponderFreeStats(&stats);
+	pthread_mutex_lock(&m->lock);
+	m->done = 1;
+	pthread_mutex_unlock(&m->lock);
+	pthread_join(m->thread, NULL);
+	pthread_mutex_destroy(&m->lock);
+	ponderFreeStats(&m->current.stats);
+	for (int i = 0; i < 2; i++) {
+		ponderFreeStats(&m->file[i].stats);
+		ponderFreeStats(&m->snap[i].stats);
+	}
+}
+
+#endif /* PONDER_METRICS_H */
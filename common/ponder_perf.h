@@ -0,0 +1,115 @@
+/*********************************************************************
+ * Hardware performance counters (Linux perf events).
+ *
+ * A perfGroup counts the events of ponderPerfCounters for the calling
+ *  thread, user space only (allowed with the default perf_event_paranoid
+ *  setting of 2), from perfStart() to perfStop(). With 'inherit', the
+ *  threads it creates meanwhile are counted too once they are over.
+ * Events the host does not have (or which cannot be opened, for example in
+ *  a container) are left at -1; if the kernel multiplexes the counters,
+ *  counts are scaled by the time each event was really counted.
+ ********************************************************************/
+
+#ifndef PONDER_PERF_H
+#define PONDER_PERF_H
+
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "../libponder/ponder.h"
+
+typedef struct {
+	int fd[PONDER_PERF_EVENTS];
+} perfGroup;
+
+/* Name of an event in the reports */
+static inline const char *perfEventName(int event) {
+	static const char *names[PONDER_PERF_EVENTS] = {
+		"cycles", "instructions", "llcMisses", "dtlbMisses", "branchMisses", "nodeLoads", "remoteLoads"
+	};
+	return names[event];
+}
+
+static inline void perfEventAttr(int event, struct perf_event_attr *attr) {
+	memset(attr, 0, sizeof(*attr));
+	attr->size = sizeof(*attr);
+	attr->type = PERF_TYPE_HARDWARE;
+	switch (event) {
+		case PONDER_PERF_CYCLES:
+			attr->config = PERF_COUNT_HW_CPU_CYCLES;
+			break;
+		case PONDER_PERF_INSTRUCTIONS:
+			attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+			break;
+		case PONDER_PERF_LLC_MISSES:
+			attr->config = PERF_COUNT_HW_CACHE_MISSES;
+			break;
+		case PONDER_PERF_DTLB_MISSES:
+			attr->type = PERF_TYPE_HW_CACHE;
+			attr->config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+			               (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+			break;
+		case PONDER_PERF_NODE_LOADS:
+		case PONDER_PERF_NODE_MISSES:
+			attr->type = PERF_TYPE_HW_CACHE;
+			attr->config = PERF_COUNT_HW_CACHE_NODE | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+			               ((uint64_t) (event == PONDER_PERF_NODE_LOADS ? PERF_COUNT_HW_CACHE_RESULT_ACCESS
+			                                                            : PERF_COUNT_HW_CACHE_RESULT_MISS) << 16);
+			break;
+		default:
+			attr->config = PERF_COUNT_HW_BRANCH_MISSES;
+	}
+	attr->exclude_kernel = 1;
+	attr->exclude_hv = 1;
+	attr->read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+}
+
+/* Opens the counters, which start counting at once */
+static inline void perfStart(perfGroup *g, int inherit) {
+	struct perf_event_attr attr;
+
+	for (int i = 0; i < PONDER_PERF_EVENTS; i++) {
+		perfEventAttr(i, &attr);
+		attr.inherit = inherit;
+		g->fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+}
+
+/* Adds the counts since perfStart() to 'sum' and closes the counters */
+static inline void perfStop(perfGroup *g, ponderPerfCounters *sum) {
+	uint64_t values[3]; /* count, time enabled, time running */
+
+	for (int i = 0; i < PONDER_PERF_EVENTS; i++) {
+		if (g->fd[i] < 0)
+			continue;
+		if (read(g->fd[i], values, sizeof(values)) == sizeof(values) && values[2]) {
+			if (sum->count[i] < 0)
+				sum->count[i] = 0;
+			sum->count[i] += (values[2] < values[1]) ? (int_fast64_t) ((double) values[0] * values[1] / values[2])
+			                                         : (int_fast64_t) values[0];
+		}
+		close(g->fd[i]);
+	}
+}
+
+/* Counters not measured yet */
+static inline void perfClear(ponderPerfCounters *c) {
+	for (int i = 0; i < PONDER_PERF_EVENTS; i++)
+		c->count[i] = -1;
+}
+
+/* sum += c, for the events measured in c */
+static inline void perfAdd(ponderPerfCounters *sum, const ponderPerfCounters *c) {
+	for (int i = 0; i < PONDER_PERF_EVENTS; i++) {
+		if (c->count[i] < 0)
+			continue;
+		if (sum->count[i] < 0)
+			sum->count[i] = 0;
+		sum->count[i] += c->count[i];
+	}
+}
+
+#endif /* PONDER_PERF_H */
@@ -0,0 +1,213 @@
+/*********************************************************************
+ * Primality test for 64-bit integers, used where building a window of
+ *  primes with primesieve would cost too much (very large n, isolated
+ *  values...).
+ *
+ * isPrime64() first looks for a small prime factor and then runs a
+ *  Miller-Rabin test with a set of bases known to have no pseudoprime
+ *  below 2^64, so the answer is exact (no probabilistic error).
+ * The modular multiplications use the Montgomery representation so no
+ *  128-bit division is needed inside the exponentiation.
+ *
+ * isPrime128() extends the test past 2^64 with 128-bit Montgomery
+ *  arithmetic. There, the bases are the first 13 primes, which is known
+ *  to be exact below 3.3*10^24; above, a "prime" answer is only probable
+ *  but a "composite" answer is always a proof, which is what verifying
+ *  a sequence needs.
+ ********************************************************************/
+
+#ifndef PONDER_PRIME_H
+#define PONDER_PRIME_H
+
+#include <stdint.h>
+
+#include "ponder_u128.h"
+
+/* Small primes used for trial division before Miller-Rabin.
+ *  Division by a constant is turned into a multiplication by the compiler.
+ */
+#define PONDER_SMALL_PRIMES(X) \
+	X(3) X(5) X(7) X(11) X(13) X(17) X(19) X(23) X(29) X(31) X(37) X(41) \
+	X(43) X(47) X(53) X(59) X(61) X(67) X(71) X(73) X(79) X(83) X(89) X(97)
+
+/* Returns the smallest prime factor of 'value' below 100, or 0 if there is
+ *  none. A small prime is its own factor.
+ */
+static inline uint64_t smallPrimeFactor(uint64_t value) {
+	if (!(value & 1))
+		return 2;
+#define PONDER_TRY_DIVIDE(p) if (!(value % p)) return p;
+	PONDER_SMALL_PRIMES(PONDER_TRY_DIVIDE)
+#undef PONDER_TRY_DIVIDE
+	return 0;
+}
+
+/* Montgomery arithmetic modulo an odd 'mod', with R = 2^64.
+ * 'inv' is mod^-1 modulo 2^64.
+ */
+static inline uint64_t montInverse(uint64_t mod) {
+	uint64_t inv = mod; /* correct on 3 bits, each step doubles it */
+	for (int i = 0; i < 5; i++)
+		inv *= 2 - mod * inv;
+	return inv;
+}
+
+/* Returns a*b/R modulo mod, for a and b lower than mod */
+static inline uint64_t montMul(uint64_t a, uint64_t b, uint64_t mod, uint64_t inv) {
+	unsigned __int128 t = (unsigned __int128) a * b;
+	uint64_t m = (uint64_t) t * inv;
+	uint64_t hi = (uint64_t) (t >> 64);
+	uint64_t mHi = (uint64_t) (((unsigned __int128) m * mod) >> 64);
+	return (hi >= mHi) ? hi - mHi : hi - mHi + mod;
+}
+
+/* One Miller-Rabin round with the given base. 'one' and 'minusOne' are 1 and
+ *  mod-1 in Montgomery form, 'r2' is R^2 modulo mod, mod-1 = d*2^s.
+ */
+static inline int millerRabinRound(uint64_t base, uint64_t mod, uint64_t inv, uint64_t one,
+                                   uint64_t minusOne, uint64_t r2, uint64_t d, int s) {
+	uint64_t x, b;
+
+	base %= mod;
+	if (!base)
+		return 1; // nothing to learn from a multiple of mod
+	b = montMul(base, r2, mod, inv);
+	x = one;
+	for (; d; d >>= 1) {
+		if (d & 1)
+			x = montMul(x, b, mod, inv);
+		b = montMul(b, b, mod, inv);
+	}
+	if (x == one || x == minusOne)
+		return 1;
+	while (--s) {
+		x = montMul(x, x, mod, inv);
+		if (x == minusOne)
+			return 1;
+	}
+	return 0;
+}
+
+/* Deterministic Miller-Rabin test for an integer with no prime
+ *  factor below 100 (see smallPrimeFactor()).
+ */
+static inline int millerRabin64(uint64_t value) {
+	static const uint64_t bases32[] = { 2, 7, 61 };
+	static const uint64_t bases64[] = { 2, 325, 9375, 28178, 450775, 9780504, 1795265022 };
+	const uint64_t *bases;
+	int nbBases, s = 0;
+	uint64_t d, inv, one, minusOne, r2;
+
+	if (value < 101 * 101)
+		return value > 1;
+
+	d = value - 1;
+	while (!(d & 1)) {
+		d >>= 1;
+		s++;
+	}
+	inv = montInverse(value);
+	one = (0 - value) % value; // R mod value
+	minusOne = value - one;
+	r2 = (uint64_t) (((unsigned __int128) one * one) % value);
+
+	if (value >> 32) {
+		bases = bases64;
+		nbBases = sizeof(bases64) / sizeof(bases64[0]);
+	} else {
+		bases = bases32;
+		nbBases = sizeof(bases32) / sizeof(bases32[0]);
+	}
+	for (int i = 0; i < nbBases; i++)
+		if (!millerRabinRound(bases[i], value, inv, one, minusOne, r2, d, s))
+			return 0;
+	return 1;
+}
+
+/* Deterministic primality test for any 64-bit integer */
+static inline int isPrime64(uint64_t value) {
+	uint64_t p;
+
+	if (value < 2)
+		return 0;
+	if ((p = smallPrimeFactor(value)))
+		return p == value;
+	return millerRabin64(value);
+}
+
+/* Full 256-bit product of two 128-bit integers */
+static inline void mulU128(ponder_u128 a, ponder_u128 b, ponder_u128 *hi, ponder_u128 *lo) {
+	uint64_t a0 = (uint64_t) a, a1 = (uint64_t) (a >> 64);
+	uint64_t b0 = (uint64_t) b, b1 = (uint64_t) (b >> 64);
+	ponder_u128 p00 = (ponder_u128) a0 * b0, p01 = (ponder_u128) a0 * b1;
+	ponder_u128 p10 = (ponder_u128) a1 * b0, p11 = (ponder_u128) a1 * b1;
+	ponder_u128 mid = (p00 >> 64) + (uint64_t) p01 + (uint64_t) p10;
+
+	*lo = (mid << 64) | (uint64_t) p00;
+	*hi = p11 + (p01 >> 64) + (p10 >> 64) + (mid >> 64);
+}
+
+/* Same as montMul() with R = 2^128, 'inv' being mod^-1 modulo 2^128 */
+static inline ponder_u128 montMul128(ponder_u128 a, ponder_u128 b, ponder_u128 mod, ponder_u128 inv) {
+	ponder_u128 tHi, tLo, mHi, mLo;
+
+	mulU128(a, b, &tHi, &tLo);
+	mulU128(tLo * inv, mod, &mHi, &mLo);
+	return (tHi >= mHi) ? tHi - mHi : tHi - mHi + mod;
+}
+
+/* Returns 2*a modulo mod, for a lower than mod (2*a may not fit in 128 bits) */
+static inline ponder_u128 doubleMod128(ponder_u128 a, ponder_u128 mod) {
+	return (a >= mod - a) ? a - (mod - a) : a + a;
+}
+
+/* Primality test for 128-bit integers, see the header comment */
+static inline int isPrime128(ponder_u128 value) {
+	static const uint64_t bases[] = { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41 };
+	ponder_u128 d, inv, one, minusOne, r2, x, b;
+	int s = 0, j;
+
+	if (!(value >> 64))
+		return isPrime64((uint64_t) value);
+	if (!(value & 1))
+		return 0;
+#define PONDER_TRY_DIVIDE(p) if (!(value % p)) return 0;
+	PONDER_SMALL_PRIMES(PONDER_TRY_DIVIDE)
+#undef PONDER_TRY_DIVIDE
+
+	d = value - 1;
+	while (!(d & 1)) {
+		d >>= 1;
+		s++;
+	}
+	inv = montInverse((uint64_t) value);
+	inv *= 2 - value * inv; // from 64 to 128 correct bits
+	one = (0 - value) % value; // R mod value
+	minusOne = value - one;
+	r2 = one;
+	for (j = 0; j < 128; j++)
+		r2 = doubleMod128(r2, value);
+
+	for (unsigned i = 0; i < sizeof(bases) / sizeof(bases[0]); i++) {
+		ponder_u128 e = d;
+		b = montMul128(bases[i], r2, value, inv);
+		x = one;
+		for (; e; e >>= 1) {
+			if (e & 1)
+				x = montMul128(x, b, value, inv);
+			b = montMul128(b, b, value, inv);
+		}
+		if (x == one || x == minusOne)
+			continue;
+		for (j = 1; j < s; j++) {
+			x = montMul128(x, x, value, inv);
+			if (x == minusOne)
+				break;
+		}
+		if (j == s)
+			return 0;
+	}
+	return 1;
+}
+
+#endif /* PONDER_PRIME_H */
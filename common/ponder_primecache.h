@@ -0,0 +1,413 @@
+/*********************************************************************
+ * Persistent prime bitmap cache.
+ *
+ * Every search sieves the integers from its start value again, and for
+ *  small n the sieve is most of the time spent. The cache keeps the
+ *  primes already sieved in a file, as a bitmap compressed with the
+ *  mod-30 wheel: one byte for 30 integers, one bit for each residue
+ *  prime to 30 (1, 7, 11, 13, 17, 19, 23, 29), 2, 3 and 5 being known.
+ *
+ * The file is made of segments of PRIME_CACHE_SEGMENT_BYTES bytes (about
+ *  31 millions integers), each one preceded by a header page giving its
+ *  index and a checksum of its bitmap. Segments are appended in any order
+ *  when a search needs integers which are not cached yet (under an
+ *  exclusive lock, so several processes can share the file), and mapped
+ *  with mmap when used, with a readahead hint. At most
+ *  PRIME_CACHE_MAX_MAPPED segments stay mapped, the least recently used
+ *  one being unmapped for a new one: a long search would otherwise reach
+ *  the limit of mappings of a process (vm.max_map_count). The checksum of
+ *  a segment is checked the first time a process uses it, a wrong one
+ *  being ignored (the segment is sieved and appended again).
+ * Integers are stored in the byte order of the machine: the cache is
+ *  meant to stay on the machine which wrote it.
+ *
+ * File format:
+ *	page 0       magic "PONDPBM1", segment size in bytes (uint64)
+ *	then records of one header page and PRIME_CACHE_SEGMENT_BYTES bytes:
+ *	             magic "PONDSEG1", segment index, checksum (uint64 each),
+ *	             the segment covering [index*SEGMENT_INTEGERS, (index+1)*SEGMENT_INTEGERS)
+ *
+ * It only covers integers below 2^64 (primesieve's limit). The segments
+ *  are sieved by a function given by the caller, so that programs only
+ *  reading the cache (the verifier) do not need primesieve.
+ ********************************************************************/
+
+#ifndef PONDER_PRIMECACHE_H
+#define PONDER_PRIMECACHE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define PRIME_CACHE_MAGIC "PONDPBM1"
+#define PRIME_CACHE_SEGMENT_MAGIC "PONDSEG1"
+#define PRIME_CACHE_PAGE 4096
+#define PRIME_CACHE_SEGMENT_BYTES (1 << 20)
+#define PRIME_CACHE_SEGMENT_INTEGERS ((uint64_t) 30 * PRIME_CACHE_SEGMENT_BYTES)
+#define PRIME_CACHE_RECORD (PRIME_CACHE_PAGE + PRIME_CACHE_SEGMENT_BYTES)
+#define PRIME_CACHE_LIMIT (UINT64_MAX - PRIME_CACHE_SEGMENT_INTEGERS - 10000)
+#define PRIME_CACHE_MAX_MAPPED 1024 /* segments, 1 GB of address space */
+
+typedef struct {
+	uint64_t index;             /* covers [index*SEGMENT_INTEGERS, (index+1)*SEGMENT_INTEGERS) */
+	off_t offset;               /* of its header page in the file */
+	const unsigned char *data;  /* mapped bitmap, NULL until used or once unmapped */
+	int checked;                /* checksum verified */
+	uint64_t lastUse;           /* of the mapping, for unmapping the least recently used */
+} primeCacheSegment;
+
+/* Sieves [low, low+PRIME_CACHE_SEGMENT_INTEGERS) into a zeroed bitmap,
+ *  calling primeCacheMark() for each prime.
+ */
+typedef void (*primeCacheSieveFunc)(uint64_t low, unsigned char *bitmap);
+
+typedef struct {
+	int fd;
+	int writable;
+	off_t scanned;              /* file records read up to there */
+	primeCacheSegment *segments; /* sorted by index */
+	int_fast64_t numSegments, maxSegments;
+	int_fast64_t numMapped;     /* segments with data, at most PRIME_CACHE_MAX_MAPPED */
+	uint64_t useClock;
+	unsigned char *buffer;      /* for sieving a new segment */
+	pthread_mutex_t mutex;
+} primeCache;
+
+/* wheelBit[r]: bit of residue r mod 30 in a byte, -1 if r is not prime to 30 */
+static const signed char primeCacheWheelBit[30] = {
+	-1, 0, -1, -1, -1, -1, -1, 1, -1, -1, -1, 2, -1, 3, -1, -1, -1, 4, -1, 5, -1, -1, -1, 6, -1, -1, -1, -1, -1, 7
+};
+
+/* The 30 bytes of window (1 for a prime) given by a bitmap byte */
+static char primeCacheExpand[256][30];
+
+static inline void primeCacheMark(unsigned char *bitmap, uint64_t low, uint64_t prime) {
+	if (primeCacheWheelBit[(prime - low) % 30] >= 0)
+		bitmap[(prime - low) / 30] |= 1 << primeCacheWheelBit[(prime - low) % 30];
+}
+
+static uint64_t primeCacheChecksum(const unsigned char *data) {
+	uint64_t h = 0xcbf29ce484222325ULL, w;
+	for (size_t i = 0; i < PRIME_CACHE_SEGMENT_BYTES; i += 8) {
+		memcpy(&w, data + i, 8);
+		h = (h ^ w) * 0x100000001b3ULL;
+	}
+	return h;
+}
+
+/* Adds a segment to the sorted index, unless it is already there */
+static int primeCacheInsert(primeCache *cache, uint64_t index, off_t offset) {
+	int_fast64_t low = 0, high = cache->numSegments;
+
+	while (low < high) {
+		int_fast64_t mid = (low + high) / 2;
+		if (cache->segments[mid].index < index)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	if (low < cache->numSegments && cache->segments[low].index == index)
+		return 1;
+	if (cache->numSegments == cache->maxSegments) {
+		primeCacheSegment *s;
+		cache->maxSegments = cache->maxSegments ? 2 * cache->maxSegments : 256;
+		if (!(s = realloc(cache->segments, cache->maxSegments * sizeof(primeCacheSegment))))
+			return 0;
+		cache->segments = s;
+	}
+	memmove(&cache->segments[low + 1], &cache->segments[low], (cache->numSegments - low) * sizeof(primeCacheSegment));
+	cache->segments[low].index = index;
+	cache->segments[low].offset = offset;
+	cache->segments[low].data = NULL;
+	cache->segments[low].checked = 0;
+	cache->segments[low].lastUse = 0;
+	cache->numSegments++;
+	return 1;
+}
+
+static primeCacheSegment *primeCacheFind(primeCache *cache, uint64_t index) {
+	int_fast64_t low = 0, high = cache->numSegments;
+
+	while (low < high) {
+		int_fast64_t mid = (low + high) / 2;
+		if (cache->segments[mid].index < index)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return (low < cache->numSegments && cache->segments[low].index == index) ? &cache->segments[low] : NULL;
+}
+
+/* Reads the record headers written since the last scan (by us or by
+ *  another process).
+ */
+static void primeCacheScan(primeCache *cache) {
+	unsigned char header[24];
+	struct stat st;
+	uint64_t index;
+
+	if (fstat(cache->fd, &st))
+		return;
+	for (; cache->scanned + PRIME_CACHE_RECORD <= st.st_size; cache->scanned += PRIME_CACHE_RECORD) {
+		if (pread(cache->fd, header, sizeof(header), cache->scanned) != sizeof(header) ||
+		    memcmp(header, PRIME_CACHE_SEGMENT_MAGIC, 8))
+			continue; // unfinished or broken record
+		memcpy(&index, header + 8, 8);
+		if (index <= PRIME_CACHE_LIMIT / PRIME_CACHE_SEGMENT_INTEGERS)
+			primeCacheInsert(cache, index, cache->scanned);
+	}
+}
+
+/* Opens (creating it if needed) a cache file. Returns NULL if it cannot
+ *  be used. A cache which cannot be written is only read. With 'readOnly',
+ *  the file is neither created nor locked, and never written.
+ */
+static inline primeCache *primeCacheOpenMode(const char *fileName, int readOnly) {
+	unsigned char header[16];
+	primeCache *cache;
+	uint64_t segmentBytes;
+	struct stat st;
+
+	if (!primeCacheExpand[1][1]) {
+		for (int b = 0; b < 256; b++)
+			for (int r = 0; r < 30; r++)
+				primeCacheExpand[b][r] = primeCacheWheelBit[r] >= 0 && ((b >> primeCacheWheelBit[r]) & 1);
+	}
+	if (!(cache = calloc(1, sizeof(primeCache))))
+		return NULL;
+	cache->writable = !readOnly;
+	if (readOnly || (cache->fd = open(fileName, O_RDWR | O_CREAT, 0644)) < 0) {
+		cache->writable = 0;
+		if ((cache->fd = open(fileName, O_RDONLY)) < 0) {
+			free(cache);
+			return NULL;
+		}
+	}
+	if (!readOnly)
+		flock(cache->fd, cache->writable ? LOCK_EX : LOCK_SH);
+	if (!fstat(cache->fd, &st) && !st.st_size && cache->writable) {
+		unsigned char page[PRIME_CACHE_PAGE];
+		memset(page, 0, sizeof(page));
+		memcpy(page, PRIME_CACHE_MAGIC, 8);
+		segmentBytes = PRIME_CACHE_SEGMENT_BYTES;
+		memcpy(page + 8, &segmentBytes, 8);
+		if (pwrite(cache->fd, page, sizeof(page), 0) != sizeof(page))
+			cache->writable = 0;
+	}
+	if (!readOnly)
+		flock(cache->fd, LOCK_UN);
+	if (pread(cache->fd, header, sizeof(header), 0) != sizeof(header) || memcmp(header, PRIME_CACHE_MAGIC, 8) ||
+	    (memcpy(&segmentBytes, header + 8, 8), segmentBytes != PRIME_CACHE_SEGMENT_BYTES)) {
+		close(cache->fd);
+		free(cache);
+		return NULL;
+	}
+	cache->scanned = PRIME_CACHE_PAGE;
+	pthread_mutex_init(&cache->mutex, NULL);
+	primeCacheScan(cache);
+	return cache;
+}
+
+static inline primeCache *primeCacheOpen(const char *fileName) {
+	return primeCacheOpenMode(fileName, 0);
+}
+
+static inline primeCache *primeCacheOpenReadOnly(const char *fileName) {
+	return primeCacheOpenMode(fileName, 1);
+}
+
+static inline void primeCacheClose(primeCache *cache) {
+	if (!cache)
+		return;
+	for (int_fast64_t i = 0; i < cache->numSegments; i++)
+		if (cache->segments[i].data)
+			munmap((void *) cache->segments[i].data, PRIME_CACHE_SEGMENT_BYTES);
+	close(cache->fd);
+	pthread_mutex_destroy(&cache->mutex);
+	free(cache->segments);
+	free(cache->buffer);
+	free(cache);
+}
+
+/* Unmaps the least recently used segment */
+static void primeCacheUnmapOldest(primeCache *cache) {
+	primeCacheSegment *oldest = NULL;
+
+	for (int_fast64_t i = 0; i < cache->numSegments; i++)
+		if (cache->segments[i].data && (!oldest || cache->segments[i].lastUse < oldest->lastUse))
+			oldest = &cache->segments[i];
+	if (oldest) {
+		munmap((void *) oldest->data, PRIME_CACHE_SEGMENT_BYTES);
+		oldest->data = NULL;
+		cache->numMapped--;
+	}
+}
+
+/* Maps a segment, checking it the first time. Returns NULL if it is broken
+ *  (and drops it from the index) or cannot be mapped (it stays in the
+ *  index).
+ */
+static const unsigned char *primeCacheMap(primeCache *cache, primeCacheSegment *s) {
+	unsigned char header[24];
+	uint64_t checksum;
+	void *data;
+
+	if (!s->data) {
+		if (cache->numMapped >= PRIME_CACHE_MAX_MAPPED)
+			primeCacheUnmapOldest(cache);
+		data = mmap(NULL, PRIME_CACHE_SEGMENT_BYTES, PROT_READ, MAP_SHARED, cache->fd, s->offset + PRIME_CACHE_PAGE);
+		if (data == MAP_FAILED)
+			return NULL;
+		madvise(data, PRIME_CACHE_SEGMENT_BYTES, MADV_WILLNEED);
+		s->data = data;
+		cache->numMapped++;
+	}
+	s->lastUse = ++cache->useClock;
+	if (!s->checked) {
+		if (pread(cache->fd, header, sizeof(header), s->offset) != sizeof(header) ||
+		    (memcpy(&checksum, header + 16, 8), checksum != primeCacheChecksum(s->data))) {
+			munmap((void *) s->data, PRIME_CACHE_SEGMENT_BYTES);
+			cache->numMapped--;
+			memmove(s, s + 1, (cache->segments + cache->numSegments - s - 1) * sizeof(primeCacheSegment));
+			cache->numSegments--;
+			return NULL;
+		}
+		s->checked = 1;
+	}
+	return s->data;
+}
+
+/* Sieves a segment and appends it to the file */
+static const unsigned char *primeCacheExtend(primeCache *cache, uint64_t index, primeCacheSieveFunc sieve) {
+	unsigned char page[PRIME_CACHE_PAGE];
+	uint64_t checksum;
+	struct stat st;
+	off_t offset;
+	int ok;
+
+	if (!cache->writable || (!cache->buffer && !(cache->buffer = malloc(PRIME_CACHE_SEGMENT_BYTES))))
+		return NULL;
+	memset(cache->buffer, 0, PRIME_CACHE_SEGMENT_BYTES);
+	sieve(index * PRIME_CACHE_SEGMENT_INTEGERS, cache->buffer);
+
+	memset(page, 0, sizeof(page));
+	memcpy(page, PRIME_CACHE_SEGMENT_MAGIC, 8);
+	memcpy(page + 8, &index, 8);
+	checksum = primeCacheChecksum(cache->buffer);
+	memcpy(page + 16, &checksum, 8);
+	flock(cache->fd, LOCK_EX);
+	ok = !fstat(cache->fd, &st);
+	// After the last complete record (a process may have died writing one)
+	offset = PRIME_CACHE_PAGE + (st.st_size - PRIME_CACHE_PAGE + PRIME_CACHE_RECORD - 1) / PRIME_CACHE_RECORD * PRIME_CACHE_RECORD;
+	ok = ok && pwrite(cache->fd, cache->buffer, PRIME_CACHE_SEGMENT_BYTES, offset + PRIME_CACHE_PAGE) == PRIME_CACHE_SEGMENT_BYTES &&
+	     pwrite(cache->fd, page, sizeof(page), offset) == sizeof(page);
+	flock(cache->fd, LOCK_UN);
+	if (!ok || !primeCacheInsert(cache, index, offset)) {
+		cache->writable = 0; // disk full or the like, do not try again
+		return NULL;
+	}
+	return primeCacheMap(cache, primeCacheFind(cache, index));
+}
+
+/* Returns the bitmap of a segment, mapping it, or sieving it with 'sieve'
+ *  (if not NULL) if it is not in the file or is broken. NULL if it cannot
+ *  be had: a segment of the file which cannot be mapped is not appended
+ *  again.
+ */
+static const unsigned char *primeCacheSegmentData(primeCache *cache, uint64_t index, primeCacheSieveFunc sieve) {
+	primeCacheSegment *s;
+	const unsigned char *data;
+
+	if (!(s = primeCacheFind(cache, index))) {
+		primeCacheScan(cache);
+		s = primeCacheFind(cache, index);
+	}
+	if (s && ((data = primeCacheMap(cache, s)) || primeCacheFind(cache, index)))
+		return data;
+	return sieve ? primeCacheExtend(cache, index, sieve) : NULL;
+}
+
+/* Writes len bytes (1 for a prime) for integers low+from... of a segment */
+static void primeCacheExpandRange(const unsigned char *data, uint64_t from, int_fast64_t len, char *out) {
+	for (; len && from % 30; len--, from++)
+		*out++ = primeCacheExpand[data[from / 30]][from % 30];
+	for (; len >= 30; len -= 30, from += 30, out += 30)
+		memcpy(out, primeCacheExpand[data[from / 30]], 30);
+	for (; len; len--, from++)
+		*out++ = primeCacheExpand[data[from / 30]][from % 30];
+}
+
+/* Fills array[0..size) with 1 for the primes of [offset, offset+size) and
+ *  0 for the other integers, from the cache, sieving and appending the
+ *  segments it does not have. Returns 0 if it cannot (the caller then
+ *  sieves by itself).
+ */
+static inline int primeCacheFill(primeCache *cache, uint64_t offset, char *array, int_fast64_t size,
+                                 primeCacheSieveFunc sieve) {
+	static const uint64_t wheelPrimes[3] = { 2, 3, 5 };
+	uint64_t first = offset / PRIME_CACHE_SEGMENT_INTEGERS, pos, end;
+	int ok = 1;
+
+	if (offset > PRIME_CACHE_LIMIT - size)
+		return 0;
+	pthread_mutex_lock(&cache->mutex);
+	// Map them all first so that the readahead of each one is started
+	for (uint64_t s = first; ok && s <= (offset + size - 1) / PRIME_CACHE_SEGMENT_INTEGERS; s++)
+		ok = primeCacheSegmentData(cache, s, sieve) != NULL;
+	for (pos = offset; ok && pos < offset + size; pos = end) {
+		uint64_t index = pos / PRIME_CACHE_SEGMENT_INTEGERS, low = index * PRIME_CACHE_SEGMENT_INTEGERS;
+		const unsigned char *data = primeCacheSegmentData(cache, index, sieve);
+		end = (low + PRIME_CACHE_SEGMENT_INTEGERS < offset + size) ? low + PRIME_CACHE_SEGMENT_INTEGERS : offset + size;
+		if (!(ok = data != NULL))
+			break;
+		primeCacheExpandRange(data, pos - low, end - pos, array + (pos - offset));
+	}
+	pthread_mutex_unlock(&cache->mutex);
+	for (int i = 0; ok && i < 3; i++) // not in the wheel
+		if (wheelPrimes[i] >= offset && wheelPrimes[i] < offset + size)
+			array[wheelPrimes[i] - offset] = 1;
+	return ok;
+}
+
+/* Maps the cached segments covering [low, high), without sieving the
+ *  others, so that primeCacheIsPrime() can then be called from several
+ *  threads. Only the last PRIME_CACHE_MAX_MAPPED of them stay mapped.
+ */
+static inline void primeCacheMapRange(primeCache *cache, uint64_t low, uint64_t high) {
+	pthread_mutex_lock(&cache->mutex);
+	for (uint64_t s = low / PRIME_CACHE_SEGMENT_INTEGERS; s <= (high - 1) / PRIME_CACHE_SEGMENT_INTEGERS; s++)
+		primeCacheSegmentData(cache, s, NULL);
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+/* Returns 1 if value is prime, 0 if not, -1 if its segment is not
+ *  mapped (see primeCacheMapRange()).
+ */
+static inline int primeCacheIsPrime(const primeCache *cache, uint64_t value) {
+	int_fast64_t low = 0, high = cache->numSegments;
+	uint64_t index = value / PRIME_CACHE_SEGMENT_INTEGERS, rel;
+
+	if (value <= 5)
+		return value == 2 || value == 3 || value == 5;
+	while (low < high) {
+		int_fast64_t mid = (low + high) / 2;
+		if (cache->segments[mid].index < index)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	if (low == cache->numSegments || cache->segments[low].index != index || !cache->segments[low].checked ||
+	    !cache->segments[low].data)
+		return -1;
+	rel = value - index * PRIME_CACHE_SEGMENT_INTEGERS;
+	return primeCacheExpand[cache->segments[low].data[rel / 30]][rel % 30];
+}
+
+#endif /* PONDER_PRIMECACHE_H */
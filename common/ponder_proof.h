@@ -0,0 +1,297 @@
+/*********************************************************************
+ * Minimality proofs.
+ *
+ * A proof shows that no start value in [start, end) gives a correct
+ *  sequence: for each of them it names the index i of a prime term a_i.
+ *  Algorithm 1 gets it for free, the prime that rules out an integer
+ *  being exactly such a term. Checking a proof only needs one primality
+ *  test per value (no prime generation), so it can be done on a laptop,
+ *  in parallel. Together with the certificate or the verification of
+ *  'end' itself, a proof starting at 0 shows that 'end' is X_n.
+ *
+ * The indices are small in practice (the smallest prime term is found
+ *  after a few steps) and are stored as LEB128 varints, so about one
+ *  byte per value. For the same reason, the primes named in a block are
+ *  close to it and each one is named by many values: the checker keeps a
+ *  bitmap of the primes of the block already tested, so that a prime is
+ *  only tested once (about 15 times fewer tests for n=1000).
+ *
+ * File format (all integers little endian, whatever the machine):
+ *	8 bytes   magic "PONDPRF1"
+ *	16 bytes  step policy name (STEP_NAME), zero padded
+ *	8 bytes   n
+ *	8 bytes   k
+ *	16 bytes  start
+ *	blocks, each one being
+ *		4 bytes   number of values in the block (at most PROOF_BLOCK_SIZE)
+ *		4 bytes   size in bytes of the indices that follow
+ *		the indices, one varint per value
+ *  Values are consecutive from 'start', block after block, so threads can
+ *  check blocks independently once their headers have been scanned.
+ *
+ * Requires ponder_step.h to be included first (it gives the step policy).
+ ********************************************************************/
+
+#ifndef PONDER_PROOF_H
+#define PONDER_PROOF_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ponder_prime.h"
+#include "ponder_cert.h"
+
+#define PROOF_MAGIC "PONDPRF1"
+#define PROOF_HEADER_SIZE (8 + CERT_POLICY_SIZE + 8 + 8 + 16)
+#define PROOF_BLOCK_SIZE 65536
+#define PROOF_MAX_THREADS 64
+#define PROOF_MEMO_SIZE (PROOF_BLOCK_SIZE + (1 << 20)) /* terms remembered after a block start */
+
+/* Creates a proof file for values starting at 'start'. Returns NULL if it
+ *  cannot be written.
+ */
+static inline FILE *createProof(const char *fileName, int_fast64_t n, int_fast64_t k, ponder_u128 start) {
+	unsigned char header[PROOF_HEADER_SIZE];
+	FILE *f;
+
+	memset(header, 0, sizeof(header));
+	memcpy(header, PROOF_MAGIC, 8);
+	snprintf((char *) header + 8, CERT_POLICY_SIZE, "%s", STEP_NAME);
+	putLittleEndian(header + 8 + CERT_POLICY_SIZE, n, 8);
+	putLittleEndian(header + 16 + CERT_POLICY_SIZE, k, 8);
+	putLittleEndian(header + 24 + CERT_POLICY_SIZE, start, 16);
+	if (!(f = fopen(fileName, "wb")))
+		return NULL;
+	if (fwrite(header, PROOF_HEADER_SIZE, 1, f) != 1) {
+		fclose(f);
+		return NULL;
+	}
+	return f;
+}
+
+/* Appends the indices of the next 'count' values. Returns 1 on success. */
+static inline int appendProof(FILE *f, const uint32_t *indices, int_fast64_t count) {
+	static unsigned char block[8 + 5 * PROOF_BLOCK_SIZE];
+
+	while (count > 0) {
+		int_fast64_t blockCount = (count < PROOF_BLOCK_SIZE) ? count : PROOF_BLOCK_SIZE;
+		size_t size = 8;
+		for (int_fast64_t i = 0; i < blockCount; i++) {
+			uint32_t v = indices[i];
+			while (v >= 0x80) {
+				block[size++] = (unsigned char) ((v & 0x7F) | 0x80);
+				v >>= 7;
+			}
+			block[size++] = (unsigned char) v;
+		}
+		putLittleEndian(block, blockCount, 4);
+		putLittleEndian(block + 4, size - 8, 4);
+		if (fwrite(block, size, 1, f) != 1)
+			return 0;
+		indices += blockCount;
+		count -= blockCount;
+	}
+	return 1;
+}
+
+typedef struct {
+	const unsigned char *data;    /* the indices of the block */
+	uint32_t count, size;
+	ponder_u128 start;            /* first value of the block */
+} proofBlock;
+
+typedef struct {
+	char policy[CERT_POLICY_SIZE];
+	int_fast64_t n, k;
+	proofBlock *blocks;
+	int_fast64_t numBlocks;
+	const int_fast64_t *spans;    /* spans[i] = a_i - a_0 */
+	atomic_int_fast64_t nextBlock;
+	atomic_int_fast64_t failedBlock; /* smallest block with a wrong index, or numBlocks */
+} proofCheck;
+
+/* Checks the blocks taken one after the other: each index must be lower
+ *  than n and point to a prime term.
+ */
+static void *proofCheckLoop(void *ptr) {
+	proofCheck *check = ptr;
+	uint64_t *memo; /* bit i set if block start + i is known to be prime */
+	int_fast64_t b;
+
+	if (!(memo = malloc(PROOF_MEMO_SIZE / 8))) {
+		printf("ERROR: cannot allocate proof bitmap.\n");
+		exit(1);
+	}
+
+	while ((b = atomic_fetch_add(&check->nextBlock, 1)) < check->numBlocks) {
+		const proofBlock *block = &check->blocks[b];
+		const unsigned char *p = block->data, *end = block->data + block->size;
+		ponder_u128 value = block->start;
+		int ok = 1;
+
+		if (b > atomic_load_explicit(&check->failedBlock, memory_order_relaxed))
+			break;
+		memset(memo, 0, PROOF_MEMO_SIZE / 8);
+		for (uint32_t i = 0; i < block->count && ok; i++, value++) {
+			uint64_t index = 0;
+			int shift = 0;
+			do {
+				if (p == end || shift > 28) {
+					ok = 0;
+					break;
+				}
+				index |= (uint64_t) (*p & 0x7F) << shift;
+				shift += 7;
+			} while (*p++ & 0x80);
+			if (!ok || index >= (uint64_t) check->n) {
+				ok = 0;
+				break;
+			}
+			int_fast64_t rel = i + check->spans[index];
+			if (rel < PROOF_MEMO_SIZE && (memo[rel >> 6] >> (rel & 63)) & 1)
+				continue;
+			ponder_u128 term = value + check->spans[index];
+			ok = (term >> 64) ? isPrime128(term) : isPrime64((uint64_t) term);
+			if (ok && rel < PROOF_MEMO_SIZE)
+				memo[rel >> 6] |= (uint64_t) 1 << (rel & 63);
+		}
+		if (ok && p != end)
+			ok = 0;
+		if (!ok) {
+			int_fast64_t failed = atomic_load(&check->failedBlock);
+			while (b < failed && !atomic_compare_exchange_weak(&check->failedBlock, &failed, b))
+				;
+		}
+	}
+	free(memo);
+	return NULL;
+}
+
+/* Checks a proof file with up to numThreads threads (0 means one per
+ *  online processor). Returns 1 if the proof is valid, 0 otherwise, after
+ *  printing the reason. 'n', 'k', 'start' and 'end' are set to the sequence
+ *  and the range of start values it covers.
+ */
+static inline int checkProof(const char *fileName, int numThreads, int_fast64_t *n, int_fast64_t *k,
+                             ponder_u128 *start, ponder_u128 *end) {
+	pthread_t ID[PROOF_MAX_THREADS];
+	const unsigned char *data;
+	struct stat st;
+	proofCheck check;
+	int_fast64_t *spans, maxBlocks = 0;
+	stepState step;
+	size_t pos;
+	int fd, ok = 1, i;
+	char value[U128_STRING_SIZE];
+
+	if ((fd = open(fileName, O_RDONLY)) < 0 || fstat(fd, &st) || st.st_size < PROOF_HEADER_SIZE) {
+		printf("ERROR: cannot read proof file %s.\n", fileName);
+		if (fd >= 0)
+			close(fd);
+		return 0;
+	}
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED || memcmp(data, PROOF_MAGIC, 8)) {
+		printf("ERROR: %s is not a proof file.\n", fileName);
+		if (data != MAP_FAILED)
+			munmap((void *) data, st.st_size);
+		return 0;
+	}
+	memset(&check, 0, sizeof(check));
+	memcpy(check.policy, data + 8, CERT_POLICY_SIZE);
+	check.policy[CERT_POLICY_SIZE - 1] = 0;
+	*n = check.n = (int_fast64_t) getLittleEndian(data + 8 + CERT_POLICY_SIZE, 8);
+	*k = check.k = (int_fast64_t) getLittleEndian(data + 16 + CERT_POLICY_SIZE, 8);
+	*start = *end = getLittleEndian(data + 24 + CERT_POLICY_SIZE, 16);
+	if (strcmp(check.policy, STEP_NAME)) {
+		printf("ERROR: %s is for the %s step, this checker was compiled for the %s step.\n",
+		       fileName, check.policy, STEP_NAME);
+		munmap((void *) data, st.st_size);
+		return 0;
+	}
+	if (stepSpan(check.n, check.k) < 0) {
+		printf("ERROR: %s, incorrect n or k.\n", fileName);
+		munmap((void *) data, st.st_size);
+		return 0;
+	}
+
+	/* Offsets of the terms */
+	if (!(spans = malloc(check.n * sizeof(int_fast64_t)))) {
+		printf("ERROR: cannot allocate spans.\n");
+		exit(1);
+	}
+	stepInit(&step, check.k);
+	spans[0] = 0;
+	for (int_fast64_t j = 1; j < check.n; j++)
+		spans[j] = spans[j-1] + stepNext(&step);
+	check.spans = spans;
+
+	/* Scan the block headers */
+	for (pos = PROOF_HEADER_SIZE; pos < (size_t) st.st_size; ) {
+		proofBlock block;
+		if (st.st_size - pos < 8) {
+			ok = 0;
+			break;
+		}
+		block.count = (uint32_t) getLittleEndian(data + pos, 4);
+		block.size = (uint32_t) getLittleEndian(data + pos + 4, 4);
+		block.data = data + pos + 8;
+		block.start = *end;
+		if (st.st_size - pos - 8 < block.size || block.count > PROOF_BLOCK_SIZE) {
+			ok = 0;
+			break;
+		}
+		if (check.numBlocks == maxBlocks) {
+			maxBlocks = maxBlocks ? 2 * maxBlocks : 1024;
+			if (!(check.blocks = realloc(check.blocks, maxBlocks * sizeof(proofBlock)))) {
+				printf("ERROR: cannot allocate proof blocks.\n");
+				exit(1);
+			}
+		}
+		check.blocks[check.numBlocks++] = block;
+		*end += block.count;
+		pos += 8 + block.size;
+	}
+	if (!ok) {
+		printf("ERROR: %s is truncated.\n", fileName);
+		free(spans);
+		free(check.blocks);
+		munmap((void *) data, st.st_size);
+		return 0;
+	}
+
+	if (numThreads <= 0)
+		numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (numThreads > PROOF_MAX_THREADS)
+		numThreads = PROOF_MAX_THREADS;
+	if (numThreads > check.numBlocks)
+		numThreads = check.numBlocks;
+	atomic_init(&check.nextBlock, 0);
+	atomic_init(&check.failedBlock, check.numBlocks);
+	for (i = 0; i < numThreads; i++)
+		pthread_create(&ID[i], NULL, proofCheckLoop, &check);
+	for (i = 0; i < numThreads; i++)
+		pthread_join(ID[i], NULL);
+
+	if (atomic_load(&check.failedBlock) < check.numBlocks) {
+		printf("ERROR: %s, wrong index in the block starting at %s.\n", fileName,
+		       u128ToString(check.blocks[atomic_load(&check.failedBlock)].start, value));
+		ok = 0;
+	}
+	free(spans);
+	free(check.blocks);
+	munmap((void *) data, st.st_size);
+	return ok;
+}
+
+#endif /* PONDER_PROOF_H */
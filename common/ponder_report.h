@@ -0,0 +1,179 @@
+/*********************************************************************
+ * End of run reports.
+ *
+ * With -j reportFile, the searches write a JSON report when they are over,
+ *  for scripts comparing runs: the parameters, the result, wall and CPU
+ *  times of each phase (filling windows, testing start values, verifying
+ *  the answer), the counters of libponder (see ponderStats), the work of
+ *  each thread and its idle time at the end of windows, and the peak
+ *  resident memory. "-" writes the report on the standard output.
+ * With params.perfCounters, the hardware counters of each phase and of
+ *  each thread are added (see common/ponder_perf.h), null for the events
+ *  the host does not give.
+ * Integers which may not fit in a double (start values) are written as
+ *  strings.
+ *
+ * Requires ponder_step.h to be included first (it gives the step policy).
+ ********************************************************************/
+
+#ifndef PONDER_REPORT_H
+#define PONDER_REPORT_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "ponder_verify.h"
+#include "ponder_perf.h"
+#include "../libponder/ponder.h"
+
+typedef struct {
+	const char *program;
+	const char *mode;           /* "search", "enumerate" or "batch" */
+	ponderParams params;
+	int batchSize;              /* parameter sets of a batch */
+	const char *status;         /* "found", "not found", "cancelled", "error" or "complete" (enumerate) */
+	ponder_u128 value;          /* if found */
+	int_fast64_t count;         /* values written in enumerate mode */
+	ponderStats stats;
+	double verifySeconds, verifyCpuSeconds;
+	ponderPerfCounters verifyPerf; /* set by reportInit() and reportVerify() */
+} ponderReport;
+
+static inline void reportInit(ponderReport *report) {
+	memset(report, 0, sizeof(*report));
+	perfClear(&report->verifyPerf);
+}
+
+/* Verifies a value with verifySequence(), adding the time it takes to the
+ *  verify phase of the report.
+ */
+static inline int reportVerify(ponderReport *report, ponder_u128 value, int_fast64_t n, int_fast64_t k,
+                               int numThreads) {
+	struct timespec start, end, cpuStart, cpuEnd;
+	perfGroup perf;
+	int ok;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpuStart);
+	if (report->params.perfCounters)
+		perfStart(&perf, 1); // with the verification threads
+	ok = verifySequence(value, n, k, numThreads);
+	if (report->params.perfCounters)
+		perfStop(&perf, &report->verifyPerf);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpuEnd);
+	report->verifySeconds += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+	report->verifyCpuSeconds += (cpuEnd.tv_sec - cpuStart.tv_sec) + (cpuEnd.tv_nsec - cpuStart.tv_nsec) * 1e-9;
+	return ok;
+}
+
+static inline const char *reportStatus(ponderStatus status) {
+	switch (status) {
+		case PONDER_FOUND: return "found";
+		case PONDER_NOT_FOUND: return "not found";
+		case PONDER_CANCELLED: return "cancelled";
+		default: return "error";
+	}
+}
+
+/* Writes the counters as a JSON object */
+static inline void writePerf(FILE *f, const ponderPerfCounters *c) {
+	fprintf(f, "{");
+	for (int i = 0; i < PONDER_PERF_EVENTS; i++) {
+		fprintf(f, "%s \"%s\": ", i ? "," : "", perfEventName(i));
+		if (c->count[i] < 0)
+			fprintf(f, "null");
+		else
+			fprintf(f, "%" PRIdFAST64, c->count[i]);
+	}
+	/* Loads served by the memory of the node of the thread */
+	if (c->count[PONDER_PERF_NODE_LOADS] >= 0 && c->count[PONDER_PERF_NODE_MISSES] >= 0)
+		fprintf(f, ", \"localLoads\": %" PRIdFAST64,
+		        c->count[PONDER_PERF_NODE_LOADS] - c->count[PONDER_PERF_NODE_MISSES]);
+	fprintf(f, " }");
+}
+
+/* Writes the report. Returns 1 on success. */
+static inline int writeReport(const char *fileName, const ponderReport *r) {
+	static const char *engines[] = { "", "backward", "window", "threaded" };
+	const ponderStats *s = &r->stats;
+	const int probes = r->params.detailedStats && r->params.engine != PONDER_ENGINE_BACKWARD;
+	char start[U128_STRING_SIZE], end[U128_STRING_SIZE], value[U128_STRING_SIZE];
+	struct rusage usage;
+	FILE *f;
+	int ok;
+
+	if (!strcmp(fileName, "-"))
+		f = stdout;
+	else if (!(f = fopen(fileName, "w")))
+		return 0;
+	getrusage(RUSAGE_SELF, &usage);
+	fprintf(f, "{\n");
+	fprintf(f, "  \"program\": \"%s\",\n  \"mode\": \"%s\",\n  \"engine\": \"%s\",\n  \"step\": \"%s\",\n",
+	        r->program, r->mode, engines[r->params.engine], STEP_NAME);
+	if (r->batchSize)
+		fprintf(f, "  \"parameterSets\": %d,\n", r->batchSize);
+	else
+		fprintf(f, "  \"n\": %" PRIdFAST64 ",\n  \"k\": %" PRIdFAST64 ",\n", r->params.n, r->params.k);
+	fprintf(f, "  \"threads\": %d,\n  \"memSize\": %" PRIdFAST64 ",\n  \"startValue\": \"%s\",\n  \"endValue\": \"%s\",\n",
+	        s->numThreads ? s->numThreads : r->params.numThreads, r->params.memSize,
+	        u128ToString(r->params.startValue, start), u128ToString(r->params.endValue, end));
+	fprintf(f, "  \"result\": { \"status\": \"%s\"", r->status);
+	if (!strcmp(r->status, "found") && !r->batchSize)
+		fprintf(f, ", \"value\": \"%s\"", u128ToString(r->value, value));
+	if (!strcmp(r->mode, "enumerate"))
+		fprintf(f, ", \"count\": %" PRIdFAST64, r->count);
+	fprintf(f, " },\n");
+	fprintf(f, "  \"phases\": {\n");
+	fprintf(f, "    \"fill\": { \"wall\": %.6f, \"cpu\": %.6f },\n", s->fillSeconds, s->fillCpuSeconds);
+	fprintf(f, "    \"test\": { \"wall\": %.6f, \"cpu\": %.6f },\n", s->testSeconds, s->testCpuSeconds);
+	fprintf(f, "    \"verify\": { \"wall\": %.6f, \"cpu\": %.6f },\n", r->verifySeconds, r->verifyCpuSeconds);
+	fprintf(f, "    \"search\": { \"wall\": %.6f },\n", s->totalSeconds);
+	fprintf(f, "    \"process\": { \"cpu\": %.6f }\n  },\n",
+	        usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6);
+	fprintf(f, "  \"windows\": %" PRIdFAST64 ",\n  \"candidates\": %" PRIdFAST64 ",\n", s->windows, s->tests);
+	if (probes)
+		fprintf(f, "  \"probes\": %" PRIdFAST64 ",\n", s->probes);
+	fprintf(f, "  \"primesGenerated\": %" PRIdFAST64 ",\n", s->primes);
+	fprintf(f, "  \"candidatesPerSecond\": %.0f,\n", s->totalSeconds > 0 ? s->tests / s->totalSeconds : 0.0);
+	fprintf(f, "  \"peakRssKB\": %ld,\n", usage.ru_maxrss);
+	fprintf(f, "  \"arrayPageSize\": %" PRIdFAST64 ",\n", s->arrayPageSize);
+	if (s->numaNodes)
+		fprintf(f, "  \"numaReplicas\": %d,\n", s->numaNodes);
+	if (r->params.perfCounters) {
+		fprintf(f, "  \"perf\": {\n    \"fill\": ");
+		writePerf(f, &s->fillPerf);
+		fprintf(f, ",\n    \"test\": ");
+		writePerf(f, &s->testPerf);
+		fprintf(f, ",\n    \"eliminate\": ");
+		writePerf(f, &s->eliminatePerf);
+		fprintf(f, ",\n    \"verify\": ");
+		writePerf(f, &r->verifyPerf);
+		fprintf(f, "\n  },\n");
+	}
+	fprintf(f, "  \"perThread\": [");
+	for (int i = 0; i < s->numThreads; i++) {
+		fprintf(f, "%s\n    { \"candidates\": %" PRIdFAST64, i ? "," : "", s->threads[i].tests);
+		if (probes)
+			fprintf(f, ", \"probes\": %" PRIdFAST64, s->threads[i].probes);
+		fprintf(f, ", \"idleSeconds\": %.6f", s->threads[i].idleSeconds);
+		if (r->params.perfCounters) {
+			fprintf(f, ", \"perf\": ");
+			writePerf(f, &s->threads[i].perf);
+		}
+		fprintf(f, " }");
+	}
+	fprintf(f, "%s]\n}\n", s->numThreads ? "\n  " : "");
+	ok = !ferror(f);
+	if (f != stdout)
+		ok = !fclose(f) && ok;
+	else
+		fflush(f);
+	return ok;
+}
+
+#endif /* PONDER_REPORT_H */
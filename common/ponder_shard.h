@@ -0,0 +1,76 @@
+/*********************************************************************
+ * Results of a range-scan worker (shard).
+ *
+ * A worker searches [start, end) and reports one text line:
+ *	SHARD <start> <end> <watermark> <found|none>
+ *  Every integer in [start, watermark) has been ruled out. If 'found',
+ *  the watermark itself is the first correct start value of the shard,
+ *  otherwise the watermark is 'end'.
+ *
+ * Results of consecutive shards can be merged: the merge of a prefix of
+ *  the search space is a result of the same kind, so a coordinator only
+ *  needs to keep the merge of the shards completed in order, whichever
+ *  machine or process computed them.
+ * Lines not starting with 'SHARD ' are ignored, so a worker can still
+ *  print some information on the same stream.
+ ********************************************************************/
+
+#ifndef PONDER_SHARD_H
+#define PONDER_SHARD_H
+
+#include <stdio.h>
+#include <string.h>
+
+#include "ponder_u128.h"
+
+typedef struct {
+	ponder_u128 start;
+	ponder_u128 end;
+	ponder_u128 watermark; /* everything below has been ruled out */
+	int found;             /* the watermark is a correct start value */
+} shardResult;
+
+/* Writes the result line and flushes it (the stream is usually a socket) */
+static inline void writeShardResult(FILE *f, const shardResult *r) {
+	char start[U128_STRING_SIZE], end[U128_STRING_SIZE], watermark[U128_STRING_SIZE];
+
+	fprintf(f, "SHARD %s %s %s %s\n", u128ToString(r->start, start), u128ToString(r->end, end),
+	        u128ToString(r->watermark, watermark), r->found ? "found" : "none");
+	fflush(f);
+}
+
+/* Parses a result line. Returns 1 on success, 0 if the line is not a
+ *  valid result.
+ */
+static inline int parseShardResult(const char *line, shardResult *r) {
+	char start[U128_STRING_SIZE], end[U128_STRING_SIZE], watermark[U128_STRING_SIZE], state[8];
+
+	if (sscanf(line, "SHARD %39s %39s %39s %7s", start, end, watermark, state) != 4)
+		return 0;
+	if (!parseU128(start, &r->start) || !parseU128(end, &r->end) || !parseU128(watermark, &r->watermark))
+		return 0;
+	if (!strcmp(state, "found"))
+		r->found = 1;
+	else if (!strcmp(state, "none"))
+		r->found = 0;
+	else
+		return 0;
+	return r->start <= r->watermark && r->watermark <= r->end && (r->found || r->watermark == r->end);
+}
+
+/* Merges 'next' into 'acc' when it starts where 'acc' ends. Once 'acc'
+ *  has found a value, the following shards do not matter anymore.
+ * Returns 1 if the shards were merged, 0 if they are not consecutive.
+ */
+static inline int mergeShardResult(shardResult *acc, const shardResult *next) {
+	if (acc->found)
+		return 1;
+	if (acc->end != next->start)
+		return 0;
+	acc->end = next->end;
+	acc->watermark = next->watermark;
+	acc->found = next->found;
+	return 1;
+}
+
+#endif /* PONDER_SHARD_H */
@@ -0,0 +1,113 @@
+/*********************************************************************
+ * Step policies for the 'IBM Ponder this' March 2024 sequences.
+ *
+ * The original problem uses a_i = a_{i-1} + i. This header generalizes
+ *  it to a_i = a_{i-1} + k*f(i) where k is a (runtime) multiplier and
+ *  f is chosen at compile time, so that each variant gets its own
+ *  specialized kernels, with no test or indirect call in the inner loops.
+ *
+ * Compile with -DSTEP_POLICY=<policy> where policy is one of:
+ *   STEP_TRIANGULAR  f(i) = i (default, the original problem)
+ *   STEP_SQUARE      f(i) = i^2
+ *   STEP_FIBONACCI   f(i) = F(i), the Fibonacci numbers 1, 1, 2, 3, 5...
+ *
+ * Usage in a kernel:
+ *	stepState step;
+ *	stepInit(&step, k);
+ *	offset += stepNext(&step); // gives k*f(1), then k*f(2), ...
+ ********************************************************************/
+
+#ifndef PONDER_STEP_H
+#define PONDER_STEP_H
+
+#include <stdint.h>
+
+#define STEP_TRIANGULAR 1
+#define STEP_SQUARE     2
+#define STEP_FIBONACCI  3
+
+#ifndef STEP_POLICY
+#define STEP_POLICY STEP_TRIANGULAR
+#endif
+
+/* The generator state. It is small enough to stay in registers
+ *  inside the kernels.
+ */
+typedef struct {
+	int_fast64_t step;  /* last returned value, ie: k*f(i) */
+	int_fast64_t delta; /* what is needed to compute the next one */
+	int_fast64_t k;
+} stepState;
+
+#if STEP_POLICY == STEP_TRIANGULAR
+
+#define STEP_NAME "triangular"
+
+static inline void stepInit(stepState *s, int_fast64_t k) {
+	s->step = 0;
+	s->delta = s->k = k;
+}
+
+/* k*i = k*(i-1) + k */
+static inline int_fast64_t stepNext(stepState *s) {
+	return s->step += s->delta;
+}
+
+#elif STEP_POLICY == STEP_SQUARE
+
+#define STEP_NAME "square"
+
+static inline void stepInit(stepState *s, int_fast64_t k) {
+	s->step = 0;
+	s->delta = s->k = k;
+}
+
+/* k*i^2 = k*(i-1)^2 + k*(2i-1) */
+static inline int_fast64_t stepNext(stepState *s) {
+	s->step += s->delta;
+	s->delta += 2 * s->k;
+	return s->step;
+}
+
+#elif STEP_POLICY == STEP_FIBONACCI
+
+#define STEP_NAME "fibonacci"
+
+/* 'delta' holds k*F(i+1), 'step' k*F(i), starting with F(0) = 0 */
+static inline void stepInit(stepState *s, int_fast64_t k) {
+	s->step = 0;
+	s->delta = s->k = k;
+}
+
+static inline int_fast64_t stepNext(stepState *s) {
+	int_fast64_t next = s->step + s->delta;
+	s->step = s->delta;
+	s->delta = next;
+	return s->step;
+}
+
+#else
+#error "Unknown STEP_POLICY"
+#endif
+
+/* Returns the difference between the last and the first term of a sequence
+ *  of n terms, ie: k*(f(1) + ... + f(n-1)), or -1 if it is too large.
+ *  This is how far past a tested value the primes must be known.
+ * With every policy a step is at most 4 times the previous one, so keeping
+ *  the span below 2^60 guarantees no computation ever wraps around.
+ */
+static inline int_fast64_t stepSpan(int_fast64_t n, int_fast64_t k) {
+	stepState s;
+	int_fast64_t span = 0;
+	if (k <= 0 || n <= 0)
+		return -1;
+	stepInit(&s, k);
+	for (int_fast64_t i = 1; i < n; i++) {
+		span += stepNext(&s);
+		if (span > (INT64_MAX >> 3))
+			return -1;
+	}
+	return span;
+}
+
+#endif /* PONDER_STEP_H */
@@ -0,0 +1,253 @@
+/*********************************************************************
+ * CPU topology and thread placement (Linux).
+ *
+ * topologyRead() lists the CPUs the process may run on, with their core,
+ *  package and NUMA node from /sys/devices/system/cpu, and the rank of
+ *  each one among the hardware threads (SMT siblings) of its core.
+ * topologyPlace() then gives the CPUs of the test threads of a search
+ *  (see params.cpus in libponder/ponder.h):
+ *  - TOPOLOGY_CORES: one thread per physical core, ie: SMT off, so at most
+ *    as many threads as cores;
+ *  - TOPOLOGY_SMT: the siblings of a core are filled before the next core,
+ *    ie: SMT on, two threads sharing each core;
+ *  - TOPOLOGY_BALANCED: one thread per core first, then a second sibling
+ *    on each core and so on, the threads of a core having adjacent
+ *    numbers: they test neighbour start values, whose terms are on the
+ *    same lines of the window, shared in the L1 and L2 caches of the core.
+ * Without /sys, each CPU is its own core, all of them on node 0.
+ * topologyUsableCpus() is the thread count which keeps the process busy:
+ *  the CPUs of its affinity (cpuset), or fewer with a CPU quota of its
+ *  cgroup (cpu.max of cgroup v2, cpu.cfs_quota_us of v1, for containers).
+ *
+ * Requires _GNU_SOURCE to be defined before the first include (for the
+ *  CPU sets of sched.h).
+ ********************************************************************/
+
+#ifndef PONDER_TOPOLOGY_H
+#define PONDER_TOPOLOGY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <dirent.h>
+
+#define TOPOLOGY_MAX_CPUS CPU_SETSIZE
+
+typedef enum {
+	TOPOLOGY_OS,    /* no placement, the system puts the threads */
+	TOPOLOGY_CORES, /* one thread per core */
+	TOPOLOGY_SMT,   /* siblings first */
+	TOPOLOGY_BALANCED /* spread over the cores, siblings adjacent */
+} topologyPlacement;
+
+typedef struct {
+	int cpu;
+	int core;
+	int package;
+	int node;       /* NUMA node */
+	int sibling;    /* rank among the hardware threads of its core */
+} topologyCpu;
+
+typedef struct {
+	int numCpus;
+	int numCores;
+	int numPackages;    /* highest package number + 1 */
+	int numNodes;       /* highest NUMA node number + 1 */
+	topologyCpu cpus[TOPOLOGY_MAX_CPUS];
+} cpuTopology;
+
+/* Reads an integer of the topology directory of a CPU, -1 if there is none */
+static inline int topologyValue(int cpu, const char *name) {
+	char fileName[128];
+	FILE *f;
+	int value = -1;
+
+	snprintf(fileName, sizeof(fileName), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+	if ((f = fopen(fileName, "r"))) {
+		if (fscanf(f, "%d", &value) != 1)
+			value = -1;
+		fclose(f);
+	}
+	return value;
+}
+
+/* NUMA node of a CPU: the nodeN entry of its directory, 0 if there is none */
+static inline int topologyNode(int cpu) {
+	char dirName[128];
+	struct dirent *entry;
+	DIR *dir;
+	int node = 0;
+
+	snprintf(dirName, sizeof(dirName), "/sys/devices/system/cpu/cpu%d", cpu);
+	if (!(dir = opendir(dirName)))
+		return 0;
+	while ((entry = readdir(dir)))
+		if (sscanf(entry->d_name, "node%d", &node) == 1)
+			break;
+	closedir(dir);
+	return entry ? node : 0;
+}
+
+/* Reads the topology of the CPUs allowed to the process. Returns 0 on failure. */
+static inline int topologyRead(cpuTopology *t) {
+	cpu_set_t allowed;
+	topologyCpu *c;
+
+	t->numCpus = t->numCores = t->numPackages = t->numNodes = 0;
+	if (sched_getaffinity(0, sizeof(allowed), &allowed))
+		return 0;
+	for (int cpu = 0; cpu < TOPOLOGY_MAX_CPUS; cpu++) {
+		if (!CPU_ISSET(cpu, &allowed))
+			continue;
+		c = &t->cpus[t->numCpus++];
+		c->cpu = cpu;
+		if ((c->core = topologyValue(cpu, "core_id")) < 0)
+			c->core = cpu;
+		if ((c->package = topologyValue(cpu, "physical_package_id")) < 0)
+			c->package = 0;
+		c->node = topologyNode(cpu);
+		c->sibling = 0;
+		for (int i = 0; i < t->numCpus - 1; i++)
+			if (t->cpus[i].core == c->core && t->cpus[i].package == c->package)
+				c->sibling++;
+		if (!c->sibling)
+			t->numCores++;
+		if (c->package >= t->numPackages)
+			t->numPackages = c->package + 1;
+		if (c->node >= t->numNodes)
+			t->numNodes = c->node + 1;
+	}
+	return t->numCpus > 0;
+}
+
+/* Order of the CPUs for TOPOLOGY_CORES: the first sibling of every core, by package and core */
+static inline int topologyCompareCores(const void *a, const void *b) {
+	const topologyCpu *x = a, *y = b;
+	if (x->sibling != y->sibling)
+		return x->sibling - y->sibling;
+	if (x->package != y->package)
+		return x->package - y->package;
+	return x->core != y->core ? x->core - y->core : x->cpu - y->cpu;
+}
+
+/* Order of the CPUs for TOPOLOGY_SMT: all the siblings of a core, then the next core */
+static inline int topologyCompareSmt(const void *a, const void *b) {
+	const topologyCpu *x = a, *y = b;
+	if (x->package != y->package)
+		return x->package - y->package;
+	if (x->core != y->core)
+		return x->core - y->core;
+	return x->sibling - y->sibling;
+}
+
+/* Sets cpus[0..numThreads) for a placement. Returns 0 if the placement
+ *  cannot hold that many threads (or is TOPOLOGY_OS, which has none).
+ */
+static inline int topologyPlace(const cpuTopology *t, topologyPlacement placement, int numThreads, int *cpus) {
+	topologyCpu sorted[TOPOLOGY_MAX_CPUS];
+	char chosen[TOPOLOGY_MAX_CPUS];
+	int count = 0;
+
+	if (placement == TOPOLOGY_OS || numThreads > t->numCpus ||
+	    (placement == TOPOLOGY_CORES && numThreads > t->numCores))
+		return 0;
+	memcpy(sorted, t->cpus, sizeof(topologyCpu) * t->numCpus);
+	qsort(sorted, t->numCpus, sizeof(topologyCpu),
+	      placement == TOPOLOGY_CORES ? topologyCompareCores : topologyCompareSmt);
+	if (placement != TOPOLOGY_BALANCED) {
+		for (int i = 0; i < numThreads; i++)
+			cpus[i] = sorted[i].cpu;
+		return 1;
+	}
+	/* Sibling r of each core at round r, the CPUs chosen then taken in SMT order */
+	memset(chosen, 0, sizeof(chosen));
+	for (int round = 0; count < numThreads; round++)
+		for (int i = 0; i < t->numCpus && count < numThreads; i++)
+			if (sorted[i].sibling == round) {
+				chosen[i] = 1;
+				count++;
+			}
+	for (int i = 0, j = 0; i < t->numCpus; i++)
+		if (chosen[i])
+			cpus[j++] = sorted[i].cpu;
+	return 1;
+}
+
+/* CPUs of the quota of a cgroup directory, rounded up, 0 if it has none */
+static inline int topologyQuotaOf(const char *dir, int version2) {
+	char fileName[4096 + 32], max[32];
+	long long quota = -1, period = 0;
+	FILE *f;
+
+	if (version2) {
+		snprintf(fileName, sizeof(fileName), "%s/cpu.max", dir);
+		if ((f = fopen(fileName, "r"))) {
+			// "max 100000" without a quota
+			if (fscanf(f, "%31s %lld", max, &period) == 2 && strcmp(max, "max"))
+				quota = strtoll(max, NULL, 10);
+			fclose(f);
+		}
+	} else {
+		snprintf(fileName, sizeof(fileName), "%s/cpu.cfs_quota_us", dir);
+		if ((f = fopen(fileName, "r"))) {
+			if (fscanf(f, "%lld", &quota) != 1)
+				quota = -1;
+			fclose(f);
+		}
+		snprintf(fileName, sizeof(fileName), "%s/cpu.cfs_period_us", dir);
+		if ((f = fopen(fileName, "r"))) {
+			if (fscanf(f, "%lld", &period) != 1)
+				period = 0;
+			fclose(f);
+		}
+	}
+	return quota > 0 && period > 0 ? (int) ((quota + period - 1) / period) : 0;
+}
+
+/* Smallest CPU quota of the cgroup of the process and of its parents, 0
+ *  if there is none. The cgroup of /proc/self/cgroup may not be visible in
+ *  a container: its parents up to the root of /sys/fs/cgroup are then read.
+ */
+static inline int topologyQuota(void) {
+	char line[4096], dir[4096], *controllers, *path, *slash;
+	int quota = 0, q, version2, rootLength;
+	FILE *f = fopen("/proc/self/cgroup", "r");
+
+	if (!f)
+		return 0;
+	while (fgets(line, sizeof(line), f)) {
+		// "0::/path" for cgroup v2, "3:cpu,cpuacct:/path" for v1
+		line[strcspn(line, "\n")] = 0;
+		if (!(controllers = strchr(line, ':')) || !(path = strchr(++controllers, ':')))
+			continue;
+		*path++ = 0;
+		version2 = !*controllers;
+		if (!version2) {
+			char *c;
+			for (c = strtok(controllers, ","); c && strcmp(c, "cpu"); c = strtok(NULL, ","))
+				;
+			if (!c)
+				continue;
+		}
+		rootLength = snprintf(dir, sizeof(dir), "/sys/fs/cgroup%s", version2 ? "" : "/cpu");
+		snprintf(dir + rootLength, sizeof(dir) - rootLength, "%s", strcmp(path, "/") ? path : "");
+		while (1) {
+			if ((q = topologyQuotaOf(dir, version2)) && (!quota || q < quota))
+				quota = q;
+			if (!(slash = strrchr(dir + rootLength, '/')))
+				break;
+			*slash = 0;
+		}
+	}
+	fclose(f);
+	return quota;
+}
+
+/* Threads keeping the process busy: its CPUs, fewer with a cgroup quota */
+static inline int topologyUsableCpus(const cpuTopology *t) {
+	int quota = topologyQuota();
+	return quota && quota < t->numCpus ? quota : t->numCpus;
+}
+
+#endif /* PONDER_TOPOLOGY_H */
@@ -0,0 +1,245 @@
+/*********************************************************************
+ * Autotuning of the search settings.
+ *
+ * The best window size depends on the caches of the host and on n: small
+ *  windows spend most of their time on the span past their end (the
+ *  primes up to offset+memSize+span are needed), large ones make the
+ *  probes miss in the last level cache. And for small n, Algorithm 1 can
+ *  beat the window engines.
+ * tuneCalibrate() runs a short search (two windows, cut after
+ *  TUNE_SECONDS once one is done) for each engine and window size, the
+ *  sizes growing 4 times at each step while two windows take less than
+ *  TUNE_MAX_SECONDS, and keeps the setting covering the most start values
+ *  per second.
+ * Algorithm 1 is only tried when the caller allows it: it is single
+ *  threaded, only handles values below 2^62 and has no worker mode.
+ * The settings are kept in a profile file, $PONDER_TUNE_PROFILE or else
+ *  ~/.ponder_tune, one line per key: CPU model (from /proc/cpuinfo), step
+ *  policy, k, thread count and range of n (powers of 2, [256, 512) for
+ *  n=300 for example). A later run with the same key finds its setting
+ *  with tuneLookup(), which the caller should only apply as is when the
+ *  engine suits the run (see tuneBackwardAllowed()).
+ *
+ * Requires ponder_step.h to be included first (it gives the step policy).
+ ********************************************************************/
+
+#ifndef PONDER_TUNE_H
+#define PONDER_TUNE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "ponder_u128.h"
+#include "../libponder/ponder.h"
+
+#define TUNE_SECONDS 2.0         /* calibration of a setting, once a window is done */
+#define TUNE_MAX_SECONDS 10.0    /* estimated time of two windows of the largest size */
+#define TUNE_FIRST_SIZE 1000000L
+#define TUNE_MAX_LINES 256
+#define TUNE_LINE_SIZE 512
+
+typedef struct {
+	ponderEngine engine;
+	int_fast64_t memSize;
+	double rate;                 /* start values ruled out per second */
+} tuneSetting;
+
+/* Key of a profile line, tab separated (the CPU model has spaces) */
+typedef struct {
+	char text[TUNE_LINE_SIZE];
+} tuneKey;
+
+static inline const char *tuneEngineName(ponderEngine engine) {
+	return engine == PONDER_ENGINE_BACKWARD ? "backward" : "threaded";
+}
+
+/* Name of the profile file, NULL if there is no home directory */
+static inline const char *tuneProfileName(void) {
+	static char fileName[4096];
+	const char *name = getenv("PONDER_TUNE_PROFILE"), *home = getenv("HOME");
+
+	if (name && *name)
+		return name;
+	if (!home || !*home)
+		return NULL;
+	snprintf(fileName, sizeof(fileName), "%s/.ponder_tune", home);
+	return fileName;
+}
+
+/* Model name of the first CPU of /proc/cpuinfo, "unknown" if there is none */
+static inline void tuneCpuModel(char *model, size_t size) {
+	char line[TUNE_LINE_SIZE], *p;
+	FILE *f = fopen("/proc/cpuinfo", "r");
+
+	snprintf(model, size, "unknown");
+	if (!f)
+		return;
+	while (fgets(line, sizeof(line), f))
+		if (!strncmp(line, "model name", 10) && (p = strchr(line, ':'))) {
+			for (p++; *p == ' '; p++)
+				;
+			p[strcspn(p, "\t\n")] = 0;
+			snprintf(model, size, "%s", p);
+			break;
+		}
+	fclose(f);
+}
+
+/* Range of n of a profile line: [low, 2*low) with low a power of 2 */
+static inline int_fast64_t tuneRangeLow(int_fast64_t n) {
+	int_fast64_t low = 1;
+	while (low <= n / 2)
+		low *= 2;
+	return low;
+}
+
+static inline void tuneMakeKey(const ponderParams *params, tuneKey *key) {
+	char model[256];
+	int_fast64_t low = tuneRangeLow(params->n);
+
+	tuneCpuModel(model, sizeof(model));
+	snprintf(key->text, sizeof(key->text), "%s\t%s\t%" PRIdFAST64 "\t%d\t%" PRIdFAST64 "\t%" PRIdFAST64,
+	         model, STEP_NAME, params->k, params->numThreads, low, 2 * low);
+}
+
+/* Looks up the setting of the key of 'params' in the profile. Returns 1 if found. */
+static inline int tuneLookup(const ponderParams *params, tuneSetting *s) {
+	const char *fileName = tuneProfileName();
+	char line[TUNE_LINE_SIZE], engine[16];
+	size_t keyLength;
+	tuneKey key;
+	FILE *f;
+	int found = 0;
+
+	if (!fileName || !(f = fopen(fileName, "r")))
+		return 0;
+	tuneMakeKey(params, &key);
+	keyLength = strlen(key.text);
+	while (!found && fgets(line, sizeof(line), f))
+		if (!strncmp(line, key.text, keyLength) && line[keyLength] == '\t' &&
+		    sscanf(line + keyLength + 1, "%15s %" SCNdFAST64 " %lf", engine, &s->memSize, &s->rate) == 3 &&
+		    s->memSize > 0) {
+			s->engine = strcmp(engine, "backward") ? PONDER_ENGINE_THREADED : PONDER_ENGINE_BACKWARD;
+			found = 1;
+		}
+	fclose(f);
+	return found;
+}
+
+/* Writes the setting of the key of 'params' in the profile, replacing the
+ *  previous one. Returns 0 on failure.
+ */
+static inline int tuneSave(const ponderParams *params, const tuneSetting *s) {
+	static char lines[TUNE_MAX_LINES][TUNE_LINE_SIZE];
+	const char *fileName = tuneProfileName();
+	char tmpName[4096];
+	int numLines = 0, ok;
+	size_t keyLength;
+	tuneKey key;
+	FILE *f;
+
+	if (!fileName)
+		return 0;
+	tuneMakeKey(params, &key);
+	keyLength = strlen(key.text);
+	if ((f = fopen(fileName, "r"))) {
+		while (numLines < TUNE_MAX_LINES - 1 && fgets(lines[numLines], TUNE_LINE_SIZE, f))
+			if (lines[numLines][0] != '#' &&
+			    (strncmp(lines[numLines], key.text, keyLength) || lines[numLines][keyLength] != '\t'))
+				numLines++;
+		fclose(f);
+	}
+	snprintf(tmpName, sizeof(tmpName), "%s.tmp", fileName);
+	if (!(f = fopen(tmpName, "w")))
+		return 0;
+	fprintf(f, "# cpu\tstep\tk\tthreads\tnLow\tnHigh\tengine\tmemSize\tvaluesPerSecond\n");
+	for (int i = 0; i < numLines; i++)
+		fputs(lines[i], f);
+	fprintf(f, "%s\t%s\t%" PRIdFAST64 "\t%.0f\n", key.text, tuneEngineName(s->engine), s->memSize, s->rate);
+	ok = !ferror(f);
+	if (fclose(f) || !ok || rename(tmpName, fileName)) {
+		unlink(tmpName);
+		return 0;
+	}
+	return 1;
+}
+
+/* Calibration runs stop once a window is done and TUNE_SECONDS are over */
+static int tuneProgress(void *userData, ponder_u128 watermark, const ponderStats *stats) {
+	(void) userData;
+	(void) watermark;
+	return stats->fillSeconds + stats->testSeconds >= TUNE_SECONDS;
+}
+
+/* Start values ruled out per second by a short search with a setting, 0
+ *  on error (for example Algorithm 1 past 2^62).
+ */
+static inline double tuneMeasure(const ponderParams *params, ponderEngine engine, int_fast64_t memSize) {
+	ponderParams p = *params;
+	ponderContext *ctx;
+	ponderStats stats = { 0 };
+	ponderStatus status;
+	ponder_u128 value;
+	double rate = 0;
+
+	p.engine = engine;
+	p.memSize = memSize;
+	p.endValue = p.startValue + 2 * (ponder_u128) memSize;
+	if (params->endValue && params->endValue < p.endValue)
+		p.endValue = params->endValue;
+	p.stopFlag = NULL;
+	p.progress = tuneProgress;
+	p.proof = NULL;
+	p.detailedStats = p.perfCounters = 0;
+	if (!(ctx = ponderCreate(&p)))
+		return 0;
+	status = ponderSearch(ctx, &value);
+	ponderGetStats(ctx, &stats);
+	if (status != PONDER_ERROR && stats.totalSeconds > 0)
+		rate = (double) (ponderWatermark(ctx) - p.startValue) / stats.totalSeconds;
+	ponderFreeStats(&stats);
+	ponderDestroy(ctx);
+	return rate;
+}
+
+/* Algorithm 1 can replace the threaded engine of a search starting at
+ *  'startValue' (it stops at 2^62)
+ */
+static inline int tuneBackwardAllowed(ponder_u128 startValue) {
+	return startValue < ((ponder_u128) 1 << 62);
+}
+
+/* Tries the settings for 'params' (Algorithm 1 only if 'allowBackward')
+ *  and returns the fastest one
+ */
+static inline tuneSetting tuneCalibrate(const ponderParams *params, int allowBackward, int verbose) {
+	static const ponderEngine engines[] = { PONDER_ENGINE_THREADED, PONDER_ENGINE_BACKWARD };
+	tuneSetting best = { PONDER_ENGINE_THREADED, TUNE_FIRST_SIZE, 0 };
+	double rate, fastest;
+
+	for (size_t e = 0; e < (allowBackward ? 2 : 1); e++) {
+		fastest = 0;
+		for (int_fast64_t memSize = TUNE_FIRST_SIZE;
+		     memSize == TUNE_FIRST_SIZE || (fastest > 0 && 2 * memSize / fastest < TUNE_MAX_SECONDS);
+		     memSize *= 4) {
+			rate = tuneMeasure(params, engines[e], memSize);
+			if (verbose)
+				printf("Calibration: %s engine, memSize %" PRIdFAST64 ": %.0f values/s\n",
+				       tuneEngineName(engines[e]), memSize, rate);
+			if (rate > fastest)
+				fastest = rate;
+			if (rate > best.rate) {
+				best.engine = engines[e];
+				best.memSize = memSize;
+				best.rate = rate;
+			}
+		}
+	}
+	return best;
+}
+
+#endif /* PONDER_TUNE_H */
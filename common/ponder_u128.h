@@ -0,0 +1,69 @@
+/*********************************************************************
+ * Unsigned 128-bit integers, used for start values past 2^64.
+ *
+ * Only the base offset of a window needs 128 bits: indices inside a
+ *  window and spans of sequences stay in 64-bit registers.
+ * printf and strtoll do not know about 128-bit integers, hence the
+ *  conversion functions below.
+ ********************************************************************/
+
+#ifndef PONDER_U128_H
+#define PONDER_U128_H
+
+#include <stdint.h>
+
+typedef unsigned __int128 ponder_u128;
+
+#define PONDER_U128_MAX (~(ponder_u128) 0)
+
+/* Size of a buffer able to hold any 128-bit integer in decimal */
+#define U128_STRING_SIZE 40
+
+/* Parses a decimal string. Returns 1 on success, 0 if the string is not
+ *  a number or does not fit in 128 bits.
+ */
+static inline int parseU128(const char *str, ponder_u128 *value) {
+	ponder_u128 v = 0;
+
+	if (!*str)
+		return 0;
+	for (; *str; str++) {
+		if (*str < '0' || *str > '9')
+			return 0;
+		if (__builtin_mul_overflow(v, 10, &v) || __builtin_add_overflow(v, *str - '0', &v))
+			return 0;
+	}
+	*value = v;
+	return 1;
+}
+
+/* Writes value in decimal in the buffer (of at least U128_STRING_SIZE
+ *  characters) and returns it, so it can be used directly with printf("%s").
+ */
+static inline char *u128ToString(ponder_u128 value, char *buffer) {
+	char digits[U128_STRING_SIZE];
+	int i = 0, j = 0;
+
+	do {
+		digits[i++] = '0' + (int) (value % 10);
+		value /= 10;
+	} while (value);
+	while (i)
+		buffer[j++] = digits[--i];
+	buffer[j] = 0;
+	return buffer;
+}
+
+/* Integer square root: the largest r such that r*r <= value */
+static inline uint64_t isqrtU128(ponder_u128 value) {
+	ponder_u128 r = (ponder_u128) __builtin_sqrtl((long double) value);
+	if (r > UINT64_MAX)
+		r = UINT64_MAX;
+	while (r * r > value)
+		r--;
+	while (r < UINT64_MAX && (r + 1) * (r + 1) <= value)
+		r++;
+	return (uint64_t) r;
+}
+
+#endif /* PONDER_U128_H */
@@ -0,0 +1,160 @@
+/*********************************************************************
+ * Verification of a sequence found by one of the searches.
+ *
+ * Instead of iterating over every prime between a_0 and a_n-1, each of
+ *  the n terms is tested with isPrime64() (small prime factors, then
+ *  deterministic Miller-Rabin). The terms are split in contiguous chunks
+ *  tested by several threads; the smallest index of a prime term is
+ *  shared so that threads working past it can stop.
+ * Terms past 2^64 are tested with isPrime128().
+ * If the PONDER_PRIME_CACHE environment variable names a prime cache file
+ *  (see ponder_primecache.h), terms in the segments it has are read from
+ *  it instead of being tested. The file is only read: it is not created
+ *  or locked by a verification. Its checksums only catch torn writes, so
+ *  a checker which must not trust the searches which wrote it tests every
+ *  term by setting verifyIgnoreCache (IBM_ponder_2024-03_proofcheck -i).
+ *
+ * Requires ponder_step.h to be included first (it gives the step policy).
+ ********************************************************************/
+
+#ifndef PONDER_VERIFY_H
+#define PONDER_VERIFY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "ponder_prime.h"
+#include "ponder_primecache.h"
+
+/* Under this number of terms, starting threads costs more than it saves */
+#define VERIFY_MIN_TERMS_PER_THREAD 2048
+#define VERIFY_MAX_THREADS 64
+
+/* Set to ignore $PONDER_PRIME_CACHE */
+static int verifyIgnoreCache = 0;
+
+typedef struct {
+	ponder_u128 initialValue;
+	int_fast64_t k;
+	int_fast64_t first, last;     /* terms [first, last) are tested */
+	const primeCache *cache;      /* may be NULL */
+	atomic_int_fast64_t *failed;  /* smallest index of a prime term, or n */
+} verifyChunk;
+
+/* Tests terms [first, last) of the sequence. Stops at the first prime term
+ *  or when another thread has found a prime term with a smaller index.
+ */
+static void *verifyChunkLoop(void *ptr) {
+	verifyChunk *chunk = ptr;
+	ponder_u128 term = chunk->initialValue;
+	int_fast64_t i;
+	stepState step;
+
+	stepInit(&step, chunk->k);
+	for (i = 1; i <= chunk->first; i++)
+		term += stepNext(&step);
+	for (i = chunk->first; i < chunk->last; i++) {
+		if (!(i & 0xFF) && atomic_load_explicit(chunk->failed, memory_order_relaxed) < i)
+			break;
+		int prime = (chunk->cache && !(term >> 64)) ? primeCacheIsPrime(chunk->cache, (uint64_t) term) : -1;
+		if (prime < 0)
+			prime = (term >> 64) ? isPrime128(term) : isPrime64((uint64_t) term);
+		if (prime) {
+			int_fast64_t failed = atomic_load(chunk->failed);
+			while (i < failed && !atomic_compare_exchange_weak(chunk->failed, &failed, i))
+				;
+			break;
+		}
+		term += stepNext(&step);
+	}
+	return NULL;
+}
+
+/* Given an initial value A, checks that no member of the sequence A,
+ *  A+k*f(1), A+k*f(1)+k*f(2),... of length n is a prime, using up to
+ *  numThreads threads (0 means one per online processor).
+ * It returns 0 if the sequence is correct and the first prime term otherwise,
+ *  'termIndex' is then set to its index i (ie: a_i is prime).
+ */
+static inline ponder_u128 checkSequence(ponder_u128 initialValue, int_fast64_t n, int_fast64_t k,
+                                        int numThreads, int_fast64_t *termIndex) {
+	pthread_t ID[VERIFY_MAX_THREADS];
+	verifyChunk chunks[VERIFY_MAX_THREADS];
+	atomic_int_fast64_t failed;
+	ponder_u128 term = initialValue, lastTerm = initialValue + stepSpan(n, k);
+	const char *cacheName = getenv("PONDER_PRIME_CACHE");
+	primeCache *cache = NULL;
+	stepState step;
+	int i;
+
+	if (numThreads <= 0)
+		numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (numThreads > n / VERIFY_MIN_TERMS_PER_THREAD)
+		numThreads = n / VERIFY_MIN_TERMS_PER_THREAD;
+	if (numThreads > VERIFY_MAX_THREADS)
+		numThreads = VERIFY_MAX_THREADS;
+	if (numThreads < 1)
+		numThreads = 1;
+
+	if (!verifyIgnoreCache && cacheName && *cacheName && lastTerm < PRIME_CACHE_LIMIT &&
+	    (cache = primeCacheOpenReadOnly(cacheName)))
+		primeCacheMapRange(cache, (uint64_t) initialValue, (uint64_t) lastTerm + 1);
+	atomic_init(&failed, n);
+	for (i = 0; i < numThreads; i++) {
+		chunks[i].initialValue = initialValue;
+		chunks[i].k = k;
+		chunks[i].first = n * i / numThreads;
+		chunks[i].last = n * (i+1) / numThreads;
+		chunks[i].failed = &failed;
+		chunks[i].cache = cache;
+	}
+	if (numThreads == 1)
+		verifyChunkLoop(&chunks[0]);
+	else {
+		for (i = 0; i < numThreads; i++)
+			pthread_create(&ID[i], NULL, verifyChunkLoop, &chunks[i]);
+		for (i = 0; i < numThreads; i++)
+			pthread_join(ID[i], NULL);
+	}
+
+	primeCacheClose(cache);
+	*termIndex = atomic_load(&failed);
+	if (*termIndex == n)
+		return 0;
+	stepInit(&step, k);
+	for (int_fast64_t j = 1; j <= *termIndex; j++)
+		term += stepNext(&step);
+	return term;
+}
+
+/* Verifies a sequence with checkSequence() and prints the result
+ *  and the time it took. Returns 1 if the sequence is correct.
+ */
+static inline int verifySequence(ponder_u128 initialValue, int_fast64_t n, int_fast64_t k, int numThreads) {
+	struct timespec start, end;
+	int_fast64_t termIndex;
+	ponder_u128 res;
+	char value[U128_STRING_SIZE], prime[U128_STRING_SIZE];
+
+	printf("Verifying...\n");
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	res = checkSequence(initialValue, n, k, numThreads, &termIndex);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	u128ToString(initialValue, value);
+	if (res) // iterations are counted from 1, as a_0 is the first one
+		printf("ERROR: %s is prime (%s) at iteration %" PRIdFAST64 "\n",
+		       value, u128ToString(res, prime), termIndex + 1);
+	else
+		printf("SUCCESS! %s is the correct answer.\n", value);
+	printf("Verification of %" PRIdFAST64 " terms took %.0f microseconds.\n", n,
+	       (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) * 1e-3);
+	return !res;
+}
+
+#endif /* PONDER_VERIFY_H */
@@ -0,0 +1,1668 @@
+/*********************************************************************
+ * libponder implementation, see ponder.h.
+ *
+ * The engines are the ones of the IBM_ponder_2024-03_1, _2 and _2_MT
+ *  codes (see the README for how they work), with their globals moved
+ *  to the context:
+ *  - Algorithm 1 rules out start values backwards from each prime, one
+ *    block of memSize values at a time.
+ *  - Algorithms 2 and 3 fill a window of primes and test each start value
+ *    in it; Algorithm 2 is Algorithm 3 with one thread, run in the caller
+ *    thread. Windows past 2^64 are sieved with the primes up to their
+ *    square root since primesieve stops at 2^64. With a prime cache file,
+ *    windows below it are copied from the cache (and the cache extended
+ *    with primesieve when it does not cover them).
+ *  - Point queries test the terms of each start value one by one.
+ ********************************************************************/
+
+#define _GNU_SOURCE /* thread affinity */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <primesieve.h>
+
+#include "../common/ponder_step.h"
+#include "../common/ponder_prime.h"
+#include "../common/ponder_primecache.h"
+#include "../common/ponder_perf.h"
+#include "../common/ponder_topology.h"
+#include "ponder.h"
+
+#define DEFAULT_MEMSIZE_BACKWARD 10000000L
+#define DEFAULT_MEMSIZE_WINDOW   10000000L
+#define DEFAULT_MEMSIZE_THREADED 100000000L
+#define MAX_BATCH 64
+
+/* Window buffers: explicit huge pages when the system has some reserved,
+ *  otherwise normal pages with transparent huge pages asked for.
+ */
+#define HUGE_PAGE_2MB (1L << 21)
+#define HUGE_PAGE_1GB (1L << 30)
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+/* Enumerate mode: the threads push every value they want written into a
+ *  bounded multi-producer / single-consumer queue and a writer thread
+ *  pops them and gives them to the result callback. The queue is a ring
+ *  of slots, each with a sequence number telling whether it is free or
+ *  full for the current lap, so that no lock is taken while it flows.
+ * The writer sleeps on a condition variable while the queue is empty, up
+ *  to WRITER_WAIT_MS, and a pushing thread while it is full (the writer is
+ *  lagging). They are woken when the queue is half full or half empty
+ *  again, so that a flood of results does not cost a wake-up each.
+ */
+#define QUEUE_SIZE (1 << 16) /* must be a power of 2 */
+#define WRITER_WAIT_MS 1
+
+typedef struct {
+	atomic_size_t sequence;
+	ponder_u128 value;
+	int_fast64_t depth;
+} queueSlot;
+
+/* Batch mode: each parameter set has its own best value */
+typedef struct {
+	int_fast64_t n;
+	int_fast64_t k;
+	volatile int_fast64_t bestIndex; /* -1 until a correct value is found in the window */
+	int done;                        /* set once its window has been completed */
+} batchState;
+
+struct ponderContext {
+	ponderParams params;
+	char error[256];
+	primesieve_iterator it;
+	primeCache *cache;           /* opened by the first search with params.primeCache */
+	char *array;                 /* window of primes, or start values for Algorithm 1 */
+	uint32_t *killers;           /* Algorithm 1 proof: index of the term which ruled out each value */
+	int_fast64_t arraySize;      /* allocated size of the arrays */
+	int_fast64_t arrayMapSize;   /* size of the mapping of 'array' */
+	int_fast64_t memSize;        /* number of start values in a window */
+	int_fast64_t span;           /* difference between a_0 and a_n-1, see stepSpan() */
+	ponder_u128 offset;          /* window offset, ie: index 0 represents integer 'offset' */
+	ponder_u128 watermark;
+	int numThreads;
+	volatile sig_atomic_t cancelled;
+	atomic_int interrupted;      /* a thread stopped before the end of its window */
+
+	/* Single search: best starting value found by a thread, as an index in
+	 *  the current window, protected by the mutex.
+	 */
+	volatile int_fast64_t bestIndex;
+	pthread_mutex_t mutex;
+
+	/* Enumerate mode */
+	queueSlot *queue;
+	atomic_size_t queueHead;     /* Next slot to be pushed */
+	atomic_size_t queueTail;     /* Next slot to be popped (writer only) */
+	atomic_int producersDone;    /* Set when the search is over */
+	pthread_mutex_t queueMutex;  /* for the two conditions below */
+	pthread_cond_t queueFilled;  /* the writer waits on it for an element */
+	pthread_cond_t queueFreed;   /* the threads wait on it for a free slot */
+	atomic_int writerWaiting;
+	atomic_int producersWaiting;
+	ponderResultFunc result;
+	int_fast64_t minDepth;
+	int_fast64_t enumerateEnd;   /* end of the enumeration in the current window */
+
+	/* Batch mode */
+	batchState batch[MAX_BATCH];
+	int batchSize;
+
+	/* NUMA replicas of the window (params.numaReplicas): the threads of
+	 *  each node copy the window to the replica of the node, placed on it
+	 *  by their first touch, wait for each other and probe the replica.
+	 */
+	int numNodes;                /* 0 without replicas */
+	int threadNode[PONDER_MAX_THREADS];
+	char *replicas[PONDER_MAX_THREADS];
+	int numReplicas;             /* replicas mapped, for the nodes of the search which mapped them */
+	int_fast64_t replicaSize;    /* allocated size of each replica */
+	int_fast64_t replicaMapSize;
+	pthread_barrier_t nodeBarrier[PONDER_MAX_THREADS];
+	pthread_cond_t startCond;    /* the threads wait for all of them to be started, under the mutex */
+	int startGate;               /* 0 until then, 1 once started, -1 if one could not be */
+
+	/* State of the test threads, allocated for the largest thread count used */
+	struct threadArgs *threads;
+	pthread_t *threadIDs;
+	int threadSlots;
+	int statsSlots;              /* entries of stats.threads */
+
+	ponderStats stats;
+};
+
+/* Arguments of a worker thread. The counters are kept in local variables
+ *  by the loops and only stored here at the end of a window.
+ */
+typedef struct threadArgs {
+	ponderContext *ctx;
+	int_fast64_t threadID;
+	void *(*loop)(void *);
+	const char *array;           /* window probed: ctx->array or the replica of its node */
+	int_fast64_t tests;          /* values (or pairs in batch mode) tested */
+	int_fast64_t probes;         /* terms looked up, with detailedStats */
+	int_fast64_t count;          /* values pushed in enumerate mode */
+	struct timespec endTime;     /* when the loop was over */
+	ponderPerfCounters perf;     /* with params.perfCounters */
+} threadArgs;
+
+/*********************************************************************/
+
+static double elapsed(const struct timespec *start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+static double seconds(clockid_t clock) {
+	struct timespec now;
+	clock_gettime(clock, &now);
+	return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+static ponderStatus setError(ponderContext *ctx, const char *format, ...) {
+	va_list args;
+	va_start(args, format);
+	vsnprintf(ctx->error, sizeof(ctx->error), format, args);
+	va_end(args);
+	return PONDER_ERROR;
+}
+
+static inline int stopping(const ponderContext *ctx) {
+	return ctx->cancelled || (ctx->params.stopFlag && *ctx->params.stopFlag);
+}
+
+/* Calls the progress callback, if any. Returns 1 if the search has to stop. */
+static int progress(ponderContext *ctx) {
+	if (ctx->params.progress && ctx->params.progress(ctx->params.userData, ctx->watermark, &ctx->stats))
+		ctx->cancelled = 1;
+	return stopping(ctx);
+}
+
+/* Prefaulting: each thread touches the pages of its part of the buffer,
+ *  from the CPU of the test thread with the same index if params.cpus is
+ *  given, so that the fill of the first window does not take the faults.
+ */
+typedef struct {
+	char *start;
+	int_fast64_t size;
+	int cpu;                     /* -1 for anywhere */
+} prefaultArgs;
+
+static void *prefaultThread(void *ptr) {
+	prefaultArgs *args = ptr;
+	long pageSize = sysconf(_SC_PAGESIZE);
+	cpu_set_t cpus;
+
+	if (args->cpu >= 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(args->cpu, &cpus);
+		pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+	}
+	for (int_fast64_t i = 0; i < args->size; i += pageSize)
+		((volatile char *) args->start)[i] = 0;
+	return NULL;
+}
+
+static void prefault(ponderContext *ctx, char *buffer, int_fast64_t size, int_fast64_t pageSize) {
+	int numThreads = ctx->numThreads > 1 ? ctx->numThreads : 1;
+	prefaultArgs *args = malloc(sizeof(prefaultArgs) * numThreads);
+	pthread_t *ID = malloc(sizeof(pthread_t) * numThreads);
+	int_fast64_t part;
+
+	if (!args || !ID) {
+		// touched by the caller thread alone
+		prefaultArgs all = { buffer, size, -1 };
+		prefaultThread(&all);
+		free(args);
+		free(ID);
+		return;
+	}
+	part = (size / numThreads + pageSize - 1) / pageSize * pageSize;
+	for (int i = 0; i < numThreads; i++) {
+		args[i].start = buffer + i * part;
+		args[i].size = (i + 1) * part <= size ? part : (i * part < size ? size - i * part : 0);
+		args[i].cpu = ctx->params.cpus ? ctx->params.cpus[i] : -1;
+	}
+	if (numThreads == 1 && !ctx->params.cpus) {
+		prefaultThread(&args[0]);
+		free(args);
+		free(ID);
+		return;
+	}
+	for (int i = 0; i < numThreads; i++)
+		if (pthread_create(&ID[i], NULL, prefaultThread, &args[i]))
+			args[i].cpu = -2; // not started, touched below
+	for (int i = 0; i < numThreads; i++) {
+		if (args[i].cpu == -2) {
+			args[i].cpu = -1;
+			prefaultThread(&args[i]);
+		} else
+			pthread_join(ID[i], NULL);
+	}
+	free(args);
+	free(ID);
+}
+
+/* Maps a buffer of 'size' bytes: with 1 GB or 2 MB pages if the system
+ *  has them reserved (hugetlbfs), else with normal pages marked for
+ *  transparent huge pages. The buffer reads as zeros, its pages being
+ *  placed by their first touch. Returns NULL on failure.
+ */
+static char *mapBuffer(int_fast64_t size, int_fast64_t *mapSize, int_fast64_t *pageSize) {
+	static const struct { int_fast64_t pageSize; int flags; } huge[] = {
+		{ HUGE_PAGE_1GB, MAP_HUGETLB | MAP_HUGE_1GB },
+		{ HUGE_PAGE_2MB, MAP_HUGETLB | MAP_HUGE_2MB }
+	};
+	void *buffer;
+
+	for (int i = 0; i < 2; i++) {
+		if (size < huge[i].pageSize)
+			continue;
+		*mapSize = (size + huge[i].pageSize - 1) / huge[i].pageSize * huge[i].pageSize;
+		buffer = mmap(NULL, *mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | huge[i].flags, -1, 0);
+		if (buffer != MAP_FAILED) {
+			*pageSize = huge[i].pageSize;
+			return buffer;
+		}
+	}
+	*mapSize = (size + HUGE_PAGE_2MB - 1) / HUGE_PAGE_2MB * HUGE_PAGE_2MB;
+	buffer = mmap(NULL, *mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buffer == MAP_FAILED)
+		return NULL;
+#ifdef MADV_HUGEPAGE
+	madvise(buffer, *mapSize, MADV_HUGEPAGE);
+#endif
+	*pageSize = sysconf(_SC_PAGESIZE);
+	return buffer;
+}
+
+/* Maps the window buffer and prefaults it */
+static char *mapArray(ponderContext *ctx, int_fast64_t size) {
+	char *buffer = mapBuffer(size, &ctx->arrayMapSize, &ctx->stats.arrayPageSize);
+
+	if (buffer)
+		prefault(ctx, buffer, ctx->arrayMapSize, ctx->stats.arrayPageSize);
+	return buffer;
+}
+
+static void unmapArray(ponderContext *ctx) {
+	if (ctx->array)
+		munmap(ctx->array, ctx->arrayMapSize);
+	ctx->array = NULL;
+}
+
+static void unmapReplicas(ponderContext *ctx) {
+	for (int i = 0; i < PONDER_MAX_THREADS; i++) {
+		if (ctx->replicas[i])
+			munmap(ctx->replicas[i], ctx->replicaMapSize);
+		ctx->replicas[i] = NULL;
+	}
+	ctx->replicaSize = 0;
+	ctx->numReplicas = 0;
+}
+
+/* Maps (if not already done) a replica of 'size' bytes for each node.
+ *  They are not prefaulted: the first copy places them.
+ */
+static int allocReplicas(ponderContext *ctx, int_fast64_t size) {
+	int_fast64_t pageSize;
+
+	if (ctx->replicaSize >= size && ctx->numReplicas >= ctx->numNodes)
+		return 1;
+	unmapReplicas(ctx);
+	for (int i = 0; i < ctx->numNodes; i++)
+		if (!(ctx->replicas[i] = mapBuffer(size, &ctx->replicaMapSize, &pageSize))) {
+			unmapReplicas(ctx);
+			setError(ctx, "cannot allocate the NUMA replicas of the window");
+			return 0;
+		}
+	ctx->replicaSize = size;
+	ctx->numReplicas = ctx->numNodes;
+	return 1;
+}
+
+/* With params.numaReplicas, numbers the NUMA nodes of the CPUs of the
+ *  threads. One node needs no replica.
+ */
+static void setupNuma(ponderContext *ctx) {
+	int nodes[PONDER_MAX_THREADS], node, j;
+
+	ctx->numNodes = 0;
+	if (ctx->params.numaReplicas && ctx->params.cpus && ctx->numThreads > 1) {
+		for (int i = 0; i < ctx->numThreads; i++) {
+			node = topologyNode(ctx->params.cpus[i]);
+			for (j = 0; j < ctx->numNodes && nodes[j] != node; j++)
+				;
+			if (j == ctx->numNodes)
+				nodes[ctx->numNodes++] = node;
+			ctx->threadNode[i] = j;
+		}
+		if (ctx->numNodes == 1)
+			ctx->numNodes = 0;
+	}
+	ctx->stats.numaNodes = ctx->numNodes;
+}
+
+/* Allocates (if not already done) the arrays, of size 'size'. A buffer
+ *  large enough is kept from one search (or window) to the next.
+ */
+static int allocArray(ponderContext *ctx, int_fast64_t size, int withKillers) {
+	if (ctx->array && ctx->arraySize >= size && (ctx->killers || !withKillers))
+		return 1;
+	unmapArray(ctx);
+	free(ctx->killers);
+	ctx->killers = NULL;
+	ctx->arraySize = size;
+	if (!(ctx->array = mapArray(ctx, size)) ||
+	    (withKillers && !(ctx->killers = malloc(sizeof(uint32_t) * size)))) {
+		setError(ctx, "cannot allocate enough memory for numbers array");
+		return 0;
+	}
+	return 1;
+}
+
+/* Sets the window size for a search starting at startValue. A search
+ *  with an end does not need windows larger than its range.
+ */
+static void setMemSize(ponderContext *ctx, int_fast64_t defaultSize) {
+	ctx->memSize = ctx->params.memSize > 0 ? ctx->params.memSize : defaultSize;
+	if (ctx->params.endValue > ctx->params.startValue &&
+	    ctx->params.endValue - ctx->params.startValue < (ponder_u128) ctx->memSize)
+		ctx->memSize = ctx->params.endValue - ctx->params.startValue;
+}
+
+/* Moves the window to the next integers range */
+static int nextWindow(ponderContext *ctx) {
+	if (__builtin_add_overflow(ctx->offset, (ponder_u128) ctx->memSize, &ctx->offset)) {
+		setError(ctx, "the integers window goes past 2^128");
+		return 0;
+	}
+	ctx->watermark = ctx->offset;
+	if (ctx->params.endValue && ctx->watermark > ctx->params.endValue)
+		ctx->watermark = ctx->params.endValue;
+	ctx->stats.windows++;
+	return 1;
+}
+
+/*********************************************************************
+ * Timeline tracing
+ *
+ * Each lane is a ring of events written by a single thread, without any
+ *  lock: 'written' counts the events ever recorded, the ring keeps the
+ *  last 'traceSize' ones. The events are complete intervals, so a ring
+ *  which has wrapped around never holds a begin without its end. The
+ *  rings are allocated when a lane records its first event.
+ *********************************************************************/
+
+typedef struct {
+	const char *name;
+	uint64_t start, end;
+	int_fast64_t arg;
+} traceEvent;
+
+typedef struct {
+	traceEvent *events;
+	int_fast64_t written;
+} traceLane;
+
+static traceLane *traceLanes;      /* NULL while tracing is off */
+static int_fast64_t traceSize;
+static uint64_t traceEpoch;
+static pthread_mutex_t traceMutex = PTHREAD_MUTEX_INITIALIZER;
+
+uint64_t ponderTraceClock(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* Start of an event of the library, 0 when tracing is off */
+static inline uint64_t traceBegin(void) {
+	return traceLanes ? ponderTraceClock() : 0;
+}
+
+int ponderTraceStart(int_fast64_t eventsPerLane) {
+	if (traceLanes || eventsPerLane <= 0)
+		return traceLanes != NULL;
+	traceSize = eventsPerLane;
+	traceEpoch = ponderTraceClock();
+	return (traceLanes = calloc(PONDER_TRACE_LANES, sizeof(traceLane))) != NULL;
+}
+
+void ponderTraceEvent(int lane, const char *name, uint64_t start, int_fast64_t arg) {
+	traceLane *l;
+	traceEvent *e;
+
+	if (!traceLanes || lane < 0 || lane >= PONDER_TRACE_LANES)
+		return;
+	l = &traceLanes[lane];
+	if (!l->events) {
+		pthread_mutex_lock(&traceMutex);
+		l->events = malloc(sizeof(traceEvent) * traceSize);
+		pthread_mutex_unlock(&traceMutex);
+		if (!l->events)
+			return;
+	}
+	e = &l->events[l->written++ % traceSize];
+	e->name = name;
+	e->start = start;
+	e->end = ponderTraceClock();
+	e->arg = arg;
+}
+
+int ponderTraceWrite(const char *fileName) {
+	FILE *f;
+	int first = 1, ok;
+
+	if (!traceLanes || !(f = fopen(fileName, "w")))
+		return 0;
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+	for (int lane = 0; lane < PONDER_TRACE_LANES; lane++) {
+		traceLane *l = &traceLanes[lane];
+		int_fast64_t i = l->written > traceSize ? l->written - traceSize : 0;
+		if (!l->events)
+			continue;
+		if (lane)
+			fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+			        first ? "" : ",", lane, lane - 1);
+		else
+			fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"caller\"}}",
+			        first ? "" : ",");
+		first = 0;
+		for (; i < l->written; i++) {
+			const traceEvent *e = &l->events[i % traceSize];
+			fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+			        e->name, lane, (e->start - traceEpoch) / 1e3, (e->end - e->start) / 1e3);
+			if (e->arg >= 0)
+				fprintf(f, ",\"args\":{\"window\":%" PRIdFAST64 "}", e->arg);
+			fprintf(f, "}");
+		}
+	}
+	fprintf(f, "\n]}\n");
+	ok = !ferror(f);
+	return !fclose(f) && ok;
+}
+
+/*********************************************************************
+ * Algorithm 1
+ *********************************************************************/
+
+/* Eliminates the start values of the block [offset, offset+size) that
+ *  cannot be correct, by generating primes and working backwards: if p is
+ *  prime, p-k*f(1), p-k*f(1)-k*f(2)... cannot be a correct start value.
+ * If a correct start value is found (ie: no tested prime has eliminated
+ *  it), returns its index in the block. If all values have been ruled out,
+ *  returns -1. If the search has to stop, returns -2 and sets the
+ *  watermark to the smallest value not ruled out.
+ */
+static int_fast64_t processArray(ponderContext *ctx, int_fast64_t size) {
+	char *numberArray = ctx->array;
+	uint32_t *killerArray = ctx->killers;
+	int_fast64_t offset = (int_fast64_t) ctx->offset;
+	int_fast64_t possibleStartIndex = 0;
+	int_fast64_t primeCounter = 0;
+	int_fast64_t upperBoundDiff = ctx->span; // no need to test above
+	int_fast64_t n = ctx->params.n - 1; /* There are in fact n-1 additions to do */
+	int_fast64_t lastPrime, offsetPrime, initialOffsetPrime, i;
+	stepState step;
+
+	for (i = 0; i < size; i++)
+		numberArray[i] = 1;
+	// Start from the first prime after the initial value (which is offset)
+	primesieve_jump_to(&ctx->it, offset, offset + size + 2*upperBoundDiff);
+
+	do {
+		primeCounter++;
+		lastPrime = primesieve_next_prime(&ctx->it);
+		if (!(primeCounter & 0xFFFF) && stopping(ctx)) {
+			ctx->stats.primes += primeCounter;
+			ctx->watermark = offset + possibleStartIndex;
+			return -2;
+		}
+		offsetPrime = initialOffsetPrime = lastPrime - offset;
+		if (offsetPrime < size) {
+			if (killerArray && numberArray[offsetPrime])
+				killerArray[offsetPrime] = 0;
+			numberArray[offsetPrime] = 0;
+		}
+		stepInit(&step, ctx->params.k);
+		i = 0;
+		while (i++ < n) { // rule out integers backwards
+			offsetPrime -= stepNext(&step);
+			if (offsetPrime < 0)
+				break;
+			if (offsetPrime >= size)
+				continue;
+			if (killerArray && numberArray[offsetPrime])
+				killerArray[offsetPrime] = i;
+			numberArray[offsetPrime] = 0;
+		}
+		// If the possible correct value has been rules out, find the smallest new one
+		if (!numberArray[possibleStartIndex]) {
+			do {
+				possibleStartIndex++;
+			} while ((possibleStartIndex < size) && !numberArray[possibleStartIndex]);
+			if (possibleStartIndex == size) {
+				ctx->stats.primes += primeCounter;
+				return -1; // We have cleared all array
+			}
+		}
+	} while ((possibleStartIndex + upperBoundDiff) >= initialOffsetPrime);
+	ctx->stats.primes += primeCounter;
+	return possibleStartIndex;
+}
+
+static ponderStatus backwardSearch(ponderContext *ctx, ponder_u128 *value) {
+	const ponder_u128 limit = (ponder_u128) 1 << 62;
+	int_fast64_t size, res;
+	double start, cpuStart;
+	uint64_t trace;
+	perfGroup perf;
+
+	if (ctx->params.startValue >= limit || ctx->params.endValue >= limit)
+		return setError(ctx, "Algorithm 1 only handles values below 2^62");
+	setMemSize(ctx, DEFAULT_MEMSIZE_BACKWARD);
+	if (!allocArray(ctx, ctx->memSize, ctx->params.proof != NULL))
+		return PONDER_ERROR;
+	ctx->stats.numThreads = 1;
+
+	while (1) {
+		if (ctx->params.endValue && ctx->offset >= ctx->params.endValue)
+			return PONDER_NOT_FOUND;
+		size = ctx->memSize;
+		if (ctx->params.endValue && ctx->params.endValue - ctx->offset < (ponder_u128) size)
+			size = ctx->params.endValue - ctx->offset;
+		start = seconds(CLOCK_MONOTONIC);
+		cpuStart = seconds(CLOCK_PROCESS_CPUTIME_ID);
+		if (ctx->params.perfCounters)
+			perfStart(&perf, 0);
+		trace = traceBegin();
+		res = processArray(ctx, size);
+		ponderTraceEvent(0, "eliminate", trace, ctx->stats.windows);
+		if (ctx->params.perfCounters)
+			perfStop(&perf, &ctx->stats.eliminatePerf);
+		ctx->stats.testSeconds += seconds(CLOCK_MONOTONIC) - start;
+		ctx->stats.testCpuSeconds += seconds(CLOCK_PROCESS_CPUTIME_ID) - cpuStart;
+		ctx->stats.tests += (res >= 0) ? res + 1 : size;
+		ctx->stats.threads[0].tests = ctx->stats.tests;
+		ctx->stats.threads[0].perf = ctx->stats.eliminatePerf;
+		if (res == -2)
+			return PONDER_CANCELLED;
+		if (ctx->params.proof)
+			ctx->params.proof(ctx->params.userData, ctx->killers, res >= 0 ? res : size);
+		if (res >= 0) { // Value is found!
+			ctx->watermark = *value = ctx->offset + res;
+			return PONDER_FOUND;
+		}
+		ctx->offset += size;
+		ctx->watermark = ctx->offset;
+		ctx->stats.windows++;
+		if (progress(ctx))
+			return PONDER_CANCELLED;
+	}
+}
+
+/*********************************************************************
+ * Algorithms 2 and 3
+ *********************************************************************/
+
+/* Fills the window of primes for a window past 2^64 with a sieve of
+ *  Eratosthenes: every integer is marked as a prime and the multiples of
+ *  each prime up to the square root of the window end are crossed out.
+ *  As the window starts above 2^64, no sieving prime lies inside it.
+ */
+static void sieveArrayOfPrimes(ponderContext *ctx, int_fast64_t primeSize) {
+	primesieve_iterator sievingIt;
+	uint64_t limit = isqrtU128(ctx->offset + primeSize);
+	uint64_t p, r;
+
+	for (int_fast64_t i = 0; i < primeSize; i++)
+		ctx->array[i] = 1;
+	primesieve_init(&sievingIt);
+	primesieve_jump_to(&sievingIt, 2, limit);
+	while ((p = primesieve_next_prime(&sievingIt)) <= limit) {
+		r = (uint64_t) (ctx->offset % p);
+		for (int_fast64_t j = r ? p - r : 0; j < primeSize; j += p)
+			ctx->array[j] = 0;
+	}
+	primesieve_free_iterator(&sievingIt);
+}
+
+/* Sieves a segment of the prime cache */
+static void sieveCacheSegment(uint64_t low, unsigned char *bitmap) {
+	primesieve_iterator it;
+	uint64_t p;
+
+	primesieve_init(&it);
+	primesieve_jump_to(&it, low, low + PRIME_CACHE_SEGMENT_INTEGERS);
+	while ((p = primesieve_next_prime(&it)) < low + PRIME_CACHE_SEGMENT_INTEGERS)
+		primeCacheMark(bitmap, low, p);
+	primesieve_free_iterator(&it);
+}
+
+/* Fills the window of primes: it represents integers in the range
+ *  [offset - offset+memSize] but it is in fact larger because to be able
+ *  to test integers up to offset+memSize, we need to check primes up to
+ *  offset+memSize + span. Each prime integer is marked with a 1.
+ */
+static int fillArrayOfPrimes(ponderContext *ctx) {
+	struct timespec start;
+	double cpuStart = seconds(CLOCK_THREAD_CPUTIME_ID);
+	uint64_t lastPrime;
+	int_fast64_t pIndex, primes = 0, gapStart = 0;
+	ponder_u128 windowEnd;
+	int_fast64_t primeSize = ctx->memSize + ctx->span;
+	uint64_t trace = traceBegin();
+	perfGroup perf;
+
+	if (__builtin_add_overflow(ctx->offset, (ponder_u128) primeSize, &windowEnd)) {
+		setError(ctx, "the integers window goes past 2^128");
+		return 0;
+	}
+	if (!allocArray(ctx, primeSize, 0))
+		return 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (ctx->params.perfCounters)
+		perfStart(&perf, 0);
+	if (ctx->params.window && ctx->params.window(ctx->params.userData, ctx->offset, ctx->array, primeSize))
+		; // given by the caller
+	else if (ctx->cache && windowEnd < PRIME_CACHE_LIMIT &&
+	         primeCacheFill(ctx->cache, (uint64_t) ctx->offset, ctx->array, primeSize, sieveCacheSegment))
+		; // copied from the cache
+	/* Past 2^64 (keeping room for the next prime after the window) */
+	else if (windowEnd > UINT64_MAX - 10000)
+		sieveArrayOfPrimes(ctx, primeSize);
+	else {
+		/* Start from the first prime after the offset and mark 1 for each
+		 *  prime, the gaps being cleared on the way (the buffer still holds
+		 *  the previous window): each byte is written once.
+		 */
+		primesieve_jump_to(&ctx->it, (uint64_t) ctx->offset, (uint64_t) windowEnd);
+		lastPrime = primesieve_next_prime(&ctx->it);
+		while ((pIndex = lastPrime - (uint64_t) ctx->offset) < primeSize) {
+			memset(ctx->array + gapStart, 0, pIndex - gapStart);
+			ctx->array[pIndex] = 1;
+			gapStart = pIndex + 1;
+			primes++;
+			lastPrime = primesieve_next_prime(&ctx->it);
+		}
+		memset(ctx->array + gapStart, 0, primeSize - gapStart);
+		ctx->stats.primes += primes;
+	}
+	if (ctx->params.perfCounters)
+		perfStop(&perf, &ctx->stats.fillPerf);
+	ponderTraceEvent(0, "fill", trace, ctx->stats.windows);
+	ctx->stats.fillSeconds += elapsed(&start);
+	ctx->stats.fillCpuSeconds += seconds(CLOCK_THREAD_CPUTIME_ID) - cpuStart;
+	return 1;
+}
+
+/* Tests a start value, given by its index in the window: it computes each
+ *  term of the sequence a_i = a_i-1 + k*f(i) and checks whether it is a
+ *  prime or not. Only 64-bit arithmetic is done here whatever the size
+ *  of the window offset.
+ */
+static inline int isCorrectSequence(const char *primeArray, int_fast64_t index, int_fast64_t n, int_fast64_t k) {
+	int_fast64_t i = 1;
+	int_fast64_t valueOffset = index;
+	stepState step;
+	if (primeArray[valueOffset])
+		return 0;
+	stepInit(&step, k);
+	while (i++ < n) {
+		if (primeArray[(valueOffset += stepNext(&step))])
+			return 0;
+	}
+	return 1;
+}
+
+/* Same as above but, instead of stopping at the first prime, returns the
+ * depth of the value, ie: the index of the first prime term of the sequence
+ * or n if none of them is prime.
+ */
+static inline int_fast64_t sequenceDepth(const char *primeArray, int_fast64_t index, int_fast64_t n, int_fast64_t k) {
+	int_fast64_t i = 0;
+	int_fast64_t valueOffset = index;
+	stepState step;
+	stepInit(&step, k);
+	while (1) {
+		if (primeArray[valueOffset])
+			return i;
+		if (++i == n)
+			return n;
+		valueOffset += stepNext(&step);
+	}
+}
+
+/* Number of terms looked up by sequenceDepth() for a given depth */
+static inline int_fast64_t depthProbes(int_fast64_t depth, int_fast64_t n) {
+	return depth < n ? depth + 1 : n;
+}
+
+/* NUMA replicas: the thread copies its part of the window to the replica
+ *  of its node, waits for the other threads of the node and probes it.
+ */
+static void replicateWindow(threadArgs *args) {
+	ponderContext *ctx = args->ctx;
+	int node = ctx->threadNode[args->threadID], rank = 0, count = 0;
+	int_fast64_t size = ctx->memSize + ctx->span, part, start;
+	uint64_t trace = traceBegin();
+
+	for (int i = 0; i < ctx->numThreads; i++)
+		if (ctx->threadNode[i] == node) {
+			rank += (i < args->threadID);
+			count++;
+		}
+	part = ((size + count - 1) / count + 4095) / 4096 * 4096; // count parts cover the window
+	if ((start = rank * part) < size)
+		memcpy(ctx->replicas[node] + start, ctx->array + start, start + part <= size ? part : size - start);
+	pthread_barrier_wait(&ctx->nodeBarrier[node]);
+	args->array = ctx->replicas[node];
+	ponderTraceEvent(args->threadID + 1, "replicate", trace, ctx->stats.windows);
+}
+
+/* Waits until runThreads() has started every thread. Returns 0 if one
+ *  could not be: the barriers of the replicas are not there then.
+ */
+static int waitStart(ponderContext *ctx) {
+	int gate;
+
+	pthread_mutex_lock(&ctx->mutex);
+	while (!(gate = ctx->startGate))
+		pthread_cond_wait(&ctx->startCond, &ctx->mutex);
+	pthread_mutex_unlock(&ctx->mutex);
+	return gate > 0;
+}
+
+static void openStart(ponderContext *ctx, int gate) {
+	pthread_mutex_lock(&ctx->mutex);
+	ctx->startGate = gate;
+	pthread_cond_broadcast(&ctx->startCond);
+	pthread_mutex_unlock(&ctx->mutex);
+}
+
+/* Runs a test thread, on the CPU given for it by params.cpus if any */
+static void *threadMain(void *ptr) {
+	threadArgs *args = ptr;
+	uint64_t trace;
+	perfGroup perf;
+	cpu_set_t cpus;
+
+	if (args->ctx->params.cpus) {
+		CPU_ZERO(&cpus);
+		CPU_SET(args->ctx->params.cpus[args->threadID], &cpus);
+		pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+	}
+	if (args->ctx->numNodes && args->ctx->numThreads > 1) {
+		if (!waitStart(args->ctx))
+			return NULL;
+		replicateWindow(args);
+	}
+	trace = traceBegin();
+	if (args->ctx->params.perfCounters)
+		perfStart(&perf, 0);
+	args->loop(args);
+	clock_gettime(CLOCK_MONOTONIC, &args->endTime);
+	ponderTraceEvent(args->threadID + 1, "test", trace, args->ctx->stats.windows);
+	if (args->ctx->params.perfCounters)
+		perfStop(&perf, &args->perf);
+	return NULL;
+}
+
+/* Runs 'loop' on each thread (in the caller thread if there is only one),
+ *  or 'countedLoop' with detailed statistics. The time each thread waits
+ *  for the last one is its idle time (a "wait" event of its trace lane).
+ * If a thread cannot be started, the others are stopped and the window is
+ *  not counted: returns 0 with the error set.
+ */
+static int runThreads(ponderContext *ctx, void *(*loop)(void *), void *(*countedLoop)(void *)) {
+	threadArgs *args = ctx->threads;
+	pthread_t *ID = ctx->threadIDs;
+	struct timespec start, last;
+	double cpuStart = seconds(CLOCK_PROCESS_CPUTIME_ID);
+	uint64_t trace = traceBegin();
+	int i, started;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < ctx->numThreads; i++) {
+		args[i].ctx = ctx;
+		args[i].threadID = i;
+		args[i].loop = ctx->params.detailedStats ? countedLoop : loop;
+		args[i].array = ctx->array;
+		args[i].tests = args[i].probes = args[i].count = 0;
+		perfClear(&args[i].perf);
+	}
+	if (ctx->numThreads == 1) {
+		/* The caller thread gets its own CPUs back afterwards */
+		cpu_set_t callerCpus;
+		int pinned = ctx->params.cpus && !pthread_getaffinity_np(pthread_self(), sizeof(callerCpus), &callerCpus);
+		threadMain(&args[0]);
+		if (pinned)
+			pthread_setaffinity_np(pthread_self(), sizeof(callerCpus), &callerCpus);
+	} else {
+		/* Without memory for the replicas, the threads share the window */
+		if (ctx->numNodes && !allocReplicas(ctx, ctx->memSize + ctx->span))
+			ctx->numNodes = ctx->stats.numaNodes = 0;
+		ctx->startGate = 0;
+		for (started = 0; started < ctx->numThreads; started++)
+			if (pthread_create(&ID[started], NULL, threadMain, &args[started]))
+				break;
+		if (started < ctx->numThreads) {
+			/* The threads with replicas leave at the gate, the others at their next stop check */
+			ctx->cancelled = 1;
+			openStart(ctx, -1);
+			for (i = 0; i < started; i++)
+				pthread_join(ID[i], NULL);
+			setError(ctx, "cannot start thread %d of %d", started + 1, ctx->numThreads);
+			return 0;
+		}
+		for (int node = 0; node < ctx->numNodes; node++) {
+			int count = 0;
+			for (i = 0; i < ctx->numThreads; i++)
+				count += (ctx->threadNode[i] == node);
+			pthread_barrier_init(&ctx->nodeBarrier[node], NULL, count);
+		}
+		openStart(ctx, 1);
+		for (i = 0; i < ctx->numThreads; i++)
+			pthread_join(ID[i], NULL);
+		for (int node = 0; node < ctx->numNodes; node++)
+			pthread_barrier_destroy(&ctx->nodeBarrier[node]);
+		ponderTraceEvent(0, "threads", trace, ctx->stats.windows);
+		for (i = 0; i < ctx->numThreads; i++)
+			ponderTraceEvent(i + 1, "wait", (uint64_t) args[i].endTime.tv_sec * 1000000000 + args[i].endTime.tv_nsec,
+			                 ctx->stats.windows);
+	}
+	ctx->stats.testSeconds += elapsed(&start);
+	ctx->stats.testCpuSeconds += seconds(CLOCK_PROCESS_CPUTIME_ID) - cpuStart;
+
+	last = args[0].endTime;
+	for (i = 1; i < ctx->numThreads; i++)
+		if (args[i].endTime.tv_sec > last.tv_sec ||
+		    (args[i].endTime.tv_sec == last.tv_sec && args[i].endTime.tv_nsec > last.tv_nsec))
+			last = args[i].endTime;
+	ctx->stats.numThreads = ctx->numThreads;
+	for (i = 0; i < ctx->numThreads; i++) {
+		ponderThreadStats *t = &ctx->stats.threads[i];
+		t->tests += args[i].tests;
+		t->probes += args[i].probes;
+		t->idleSeconds += (last.tv_sec - args[i].endTime.tv_sec) + (last.tv_nsec - args[i].endTime.tv_nsec) * 1e-9;
+		perfAdd(&t->perf, &args[i].perf);
+		perfAdd(&ctx->stats.testPerf, &args[i].perf);
+		ctx->stats.tests += args[i].tests;
+		ctx->stats.probes += args[i].probes;
+	}
+	return 1;
+}
+
+/* This is the loop executed by each thread for a single search.
+ * A thread checks the values of the window from its ID with step
+ *  numThreads and stops:
+ *  - at the end of the window, or when asked to stop (then 'interrupted'
+ *    is set, the window is not completed),
+ *  - when another thread has already found a correct starting value
+ *    lower than its current tested value,
+ *  - when it has found a correct value: if it is lower than the current
+ *    best value (or no correct value has yet been found), the best value
+ *    is updated under the lock.
+ */
+static inline __attribute__((always_inline)) void searchLoopBody(threadArgs *args, const int countProbes) {
+	ponderContext *ctx = args->ctx;
+	int_fast64_t index = args->threadID, tests = 0, probes = 0, depth;
+	int res = 0;
+
+	while (index < ctx->memSize) {
+		if (countProbes) {
+			depth = sequenceDepth(args->array, index, ctx->params.n, ctx->params.k);
+			probes += depthProbes(depth, ctx->params.n);
+			res = (depth == ctx->params.n);
+		} else
+			res = isCorrectSequence(args->array, index, ctx->params.n, ctx->params.k);
+		tests++;
+		if (res || (ctx->bestIndex >= 0 && ctx->bestIndex < index))
+			break;
+		if (!(tests & 0xFFFF) && stopping(ctx)) {
+			atomic_store(&ctx->interrupted, 1);
+			break;
+		}
+		index += ctx->numThreads;
+	}
+	args->tests = tests;
+	args->probes = probes;
+	if (!res)
+		return;
+	pthread_mutex_lock(&ctx->mutex);
+	if (ctx->bestIndex < 0 || index < ctx->bestIndex)
+		ctx->bestIndex = index;
+	pthread_mutex_unlock(&ctx->mutex);
+}
+
+/* The same loop is compiled twice so that counting probes costs nothing
+ *  when it is not asked for.
+ */
+static void *searchLoop(void *ptr) {
+	searchLoopBody(ptr, 0);
+	return NULL;
+}
+
+static void *searchLoopCounted(void *ptr) {
+	searchLoopBody(ptr, 1);
+	return NULL;
+}
+
+/* Grows the thread statistics to 'count' entries, the new ones cleared.
+ *  Returns 0 on failure.
+ */
+static int growThreadStats(ponderContext *ctx, int count) {
+	ponderThreadStats *threads;
+
+	if (count <= ctx->statsSlots)
+		return 1;
+	if (!(threads = realloc(ctx->stats.threads, sizeof(ponderThreadStats) * count)))
+		return 0;
+	memset(threads + ctx->statsSlots, 0, sizeof(ponderThreadStats) * (count - ctx->statsSlots));
+	for (int i = ctx->statsSlots; i < count; i++)
+		perfClear(&threads[i].perf);
+	ctx->stats.threads = threads;
+	ctx->statsSlots = count;
+	return 1;
+}
+
+/* Checks the parameters common to the window engines and allocates the
+ *  state of the threads
+ */
+static ponderStatus setupWindowEngine(ponderContext *ctx) {
+	if (ctx->params.engine == PONDER_ENGINE_WINDOW)
+		ctx->numThreads = 1;
+	else if ((ctx->numThreads = ctx->params.numThreads) <= 0 || ctx->numThreads > PONDER_MAX_THREADS)
+		return setError(ctx, "number of threads has to be between 1 and %d", PONDER_MAX_THREADS);
+	if (ctx->threadSlots < ctx->numThreads) {
+		free(ctx->threads);
+		free(ctx->threadIDs);
+		ctx->threads = malloc(sizeof(threadArgs) * ctx->numThreads);
+		ctx->threadIDs = malloc(sizeof(pthread_t) * ctx->numThreads);
+		if (!ctx->threads || !ctx->threadIDs || !growThreadStats(ctx, ctx->numThreads)) {
+			ctx->threadSlots = 0;
+			return setError(ctx, "cannot allocate the state of %d threads", ctx->numThreads);
+		}
+		ctx->threadSlots = ctx->numThreads;
+	}
+	setMemSize(ctx, ctx->params.engine == PONDER_ENGINE_WINDOW ? DEFAULT_MEMSIZE_WINDOW : DEFAULT_MEMSIZE_THREADED);
+	setupNuma(ctx);
+	return PONDER_FOUND;
+}
+
+static ponderStatus windowSearch(ponderContext *ctx, ponder_u128 *value) {
+	if (setupWindowEngine(ctx) == PONDER_ERROR)
+		return PONDER_ERROR;
+	while (1) {
+		if (ctx->params.endValue && ctx->offset >= ctx->params.endValue)
+			return PONDER_NOT_FOUND;
+		if (!fillArrayOfPrimes(ctx))
+			return PONDER_ERROR;
+		ctx->bestIndex = -1;
+		atomic_store(&ctx->interrupted, 0);
+		if (!runThreads(ctx, searchLoop, searchLoopCounted))
+			return PONDER_ERROR;
+		if (atomic_load(&ctx->interrupted))
+			return PONDER_CANCELLED; // the watermark is still the window offset
+		if (ctx->bestIndex >= 0) {
+			*value = ctx->offset + ctx->bestIndex;
+			if (ctx->params.endValue && *value >= ctx->params.endValue) {
+				ctx->watermark = ctx->params.endValue;
+				return PONDER_NOT_FOUND;
+			}
+			ctx->watermark = *value;
+			return PONDER_FOUND;
+		}
+		if (!nextWindow(ctx))
+			return PONDER_ERROR;
+		if (progress(ctx))
+			return PONDER_CANCELLED;
+	}
+}
+
+/*********************************************************************
+ * Enumerate mode
+ *********************************************************************/
+
+/* Sleeping on one side of the queue: the waiting flag is set before the
+ *  queue is checked again, and the other side checks the flag after
+ *  updating the queue (a full fence on both sides), so that one of them
+ *  sees the other and no wake-up is lost.
+ */
+static void wakeQueue(ponderContext *ctx, atomic_int *waiting, pthread_cond_t *cond) {
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(waiting, memory_order_relaxed)) {
+		pthread_mutex_lock(&ctx->queueMutex);
+		pthread_cond_broadcast(cond);
+		pthread_mutex_unlock(&ctx->queueMutex);
+	}
+}
+
+/* Returns 1 if the slot of 'pos' is free for a push */
+static int slotFree(ponderContext *ctx, size_t pos) {
+	return atomic_load_explicit(&ctx->queue[pos & (QUEUE_SIZE - 1)].sequence, memory_order_acquire) >= pos;
+}
+
+static void pushResult(ponderContext *ctx, ponder_u128 value, int_fast64_t depth) {
+	size_t pos = atomic_load_explicit(&ctx->queueHead, memory_order_relaxed);
+	queueSlot *slot;
+	while (1) {
+		slot = &ctx->queue[pos & (QUEUE_SIZE - 1)];
+		size_t seq = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+		if (seq == pos) {
+			if (atomic_compare_exchange_weak_explicit(&ctx->queueHead, &pos, pos + 1,
+			                                          memory_order_relaxed, memory_order_relaxed))
+				break;
+		} else if (seq < pos) {
+			// queue is full, wait for the writer
+			pthread_mutex_lock(&ctx->queueMutex);
+			atomic_fetch_add(&ctx->producersWaiting, 1);
+			atomic_thread_fence(memory_order_seq_cst);
+			if (!slotFree(ctx, pos))
+				pthread_cond_wait(&ctx->queueFreed, &ctx->queueMutex);
+			atomic_fetch_sub(&ctx->producersWaiting, 1);
+			pthread_mutex_unlock(&ctx->queueMutex);
+			pos = atomic_load_explicit(&ctx->queueHead, memory_order_relaxed);
+		} else
+			pos = atomic_load_explicit(&ctx->queueHead, memory_order_relaxed);
+	}
+	slot->value = value;
+	slot->depth = depth;
+	atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+	if (pos + 1 - atomic_load_explicit(&ctx->queueTail, memory_order_relaxed) >= QUEUE_SIZE / 2)
+		wakeQueue(ctx, &ctx->writerWaiting, &ctx->queueFilled);
+}
+
+/* Returns 1 if the writer has an element to pop */
+static int resultReady(ponderContext *ctx) {
+	size_t pos = atomic_load_explicit(&ctx->queueTail, memory_order_relaxed);
+	return atomic_load_explicit(&ctx->queue[pos & (QUEUE_SIZE - 1)].sequence, memory_order_acquire) == pos + 1;
+}
+
+/* Returns 1 and fills value/depth if an element could be popped, 0 otherwise */
+static int popResult(ponderContext *ctx, ponder_u128 *value, int_fast64_t *depth) {
+	size_t pos = atomic_load_explicit(&ctx->queueTail, memory_order_relaxed);
+	queueSlot *slot = &ctx->queue[pos & (QUEUE_SIZE - 1)];
+	if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != pos + 1)
+		return 0;
+	*value = slot->value;
+	*depth = slot->depth;
+	atomic_store_explicit(&slot->sequence, pos + QUEUE_SIZE, memory_order_release);
+	atomic_store_explicit(&ctx->queueTail, pos + 1, memory_order_relaxed);
+	if (atomic_load_explicit(&ctx->queueHead, memory_order_relaxed) - (pos + 1) <= QUEUE_SIZE / 2)
+		wakeQueue(ctx, &ctx->producersWaiting, &ctx->queueFreed);
+	return 1;
+}
+
+/* The writer thread: empties the queue into the result callback until
+ *  the search is over and the queue is empty, sleeping while it is empty.
+ */
+static void *writerLoop(void *ptr) {
+	ponderContext *ctx = ptr;
+	int_fast64_t depth;
+	ponder_u128 value;
+
+	while (1) {
+		if (popResult(ctx, &value, &depth))
+			ctx->result(ctx->params.userData, value, depth);
+		else if (atomic_load_explicit(&ctx->producersDone, memory_order_acquire)) {
+			// All pushes were done before the flag was set: drain and leave
+			while (popResult(ctx, &value, &depth))
+				ctx->result(ctx->params.userData, value, depth);
+			break;
+		} else {
+			struct timespec until;
+			clock_gettime(CLOCK_REALTIME, &until);
+			if ((until.tv_nsec += WRITER_WAIT_MS * 1000000L) >= 1000000000L) {
+				until.tv_sec++;
+				until.tv_nsec -= 1000000000L;
+			}
+			pthread_mutex_lock(&ctx->queueMutex);
+			atomic_store(&ctx->writerWaiting, 1);
+			atomic_thread_fence(memory_order_seq_cst);
+			if (!resultReady(ctx) && !atomic_load(&ctx->producersDone))
+				pthread_cond_timedwait(&ctx->queueFilled, &ctx->queueMutex, &until);
+			atomic_store(&ctx->writerWaiting, 0);
+			pthread_mutex_unlock(&ctx->queueMutex);
+		}
+	}
+	return NULL;
+}
+
+/* This is the loop executed by each thread in enumerate mode.
+ * It works like the search loop (same starting index and step) but it
+ *  never stops before the end of the window (or of the enumeration) and
+ *  pushes every value whose depth is at least minDepth to the writer.
+ */
+static inline __attribute__((always_inline)) void enumerateLoopBody(threadArgs *args, const int countProbes) {
+	ponderContext *ctx = args->ctx;
+	int_fast64_t depth, tests = 0, probes = 0, count = 0;
+
+	for (int_fast64_t index = args->threadID; index < ctx->enumerateEnd; index += ctx->numThreads) {
+		tests++;
+		depth = sequenceDepth(args->array, index, ctx->params.n, ctx->params.k);
+		if (countProbes)
+			probes += depthProbes(depth, ctx->params.n);
+		if (depth >= ctx->minDepth) {
+			pushResult(ctx, ctx->offset + index, depth);
+			count++;
+		}
+		if (!(tests & 0xFFFF) && stopping(ctx)) {
+			atomic_store(&ctx->interrupted, 1);
+			break;
+		}
+	}
+	args->tests = tests;
+	args->probes = probes;
+	args->count = count;
+}
+
+static void *enumerateLoop(void *ptr) {
+	enumerateLoopBody(ptr, 0);
+	return NULL;
+}
+
+static void *enumerateLoopCounted(void *ptr) {
+	enumerateLoopBody(ptr, 1);
+	return NULL;
+}
+
+static ponderStatus enumerate(ponderContext *ctx, int_fast64_t *count) {
+	pthread_t writerID;
+	ponderStatus status = PONDER_NOT_FOUND;
+
+	if (!ctx->params.endValue)
+		return setError(ctx, "enumerate mode needs an end value");
+	if (setupWindowEngine(ctx) == PONDER_ERROR)
+		return PONDER_ERROR;
+	if (ctx->minDepth <= 0 || ctx->minDepth > ctx->params.n)
+		ctx->minDepth = ctx->params.n;
+	if (!ctx->queue && !(ctx->queue = malloc(QUEUE_SIZE * sizeof(queueSlot))))
+		return setError(ctx, "cannot allocate the results queue");
+	for (size_t i = 0; i < QUEUE_SIZE; i++)
+		atomic_init(&ctx->queue[i].sequence, i);
+	atomic_init(&ctx->queueHead, 0);
+	atomic_init(&ctx->queueTail, 0);
+	atomic_init(&ctx->producersDone, 0);
+	atomic_init(&ctx->writerWaiting, 0);
+	atomic_init(&ctx->producersWaiting, 0);
+	if (pthread_create(&writerID, NULL, writerLoop, ctx))
+		return setError(ctx, "cannot start the writer thread");
+
+	*count = 0;
+	while (ctx->offset < ctx->params.endValue) {
+		if (!fillArrayOfPrimes(ctx)) {
+			status = PONDER_ERROR;
+			break;
+		}
+		ctx->enumerateEnd = ctx->memSize;
+		if (ctx->params.endValue - ctx->offset < (ponder_u128) ctx->enumerateEnd)
+			ctx->enumerateEnd = ctx->params.endValue - ctx->offset;
+		atomic_store(&ctx->interrupted, 0);
+		if (!runThreads(ctx, enumerateLoop, enumerateLoopCounted)) {
+			status = PONDER_ERROR;
+			break;
+		}
+		for (int i = 0; i < ctx->numThreads; i++)
+			*count += ctx->threads[i].count;
+		if (atomic_load(&ctx->interrupted)) {
+			status = PONDER_CANCELLED;
+			break;
+		}
+		if (ctx->params.endValue - ctx->offset <= (ponder_u128) ctx->memSize) {
+			ctx->watermark = ctx->params.endValue;
+			break;
+		}
+		if (!nextWindow(ctx)) {
+			status = PONDER_ERROR;
+			break;
+		}
+		if (progress(ctx)) {
+			status = PONDER_CANCELLED;
+			break;
+		}
+	}
+	atomic_store_explicit(&ctx->producersDone, 1, memory_order_release);
+	wakeQueue(ctx, &ctx->writerWaiting, &ctx->queueFilled);
+	pthread_join(writerID, NULL);
+	return status;
+}
+
+/*********************************************************************
+ * Batch mode
+ *********************************************************************/
+
+/* This is the loop executed by each thread in batch mode.
+ * It walks the window like the search loop but each value is tested
+ *  against every parameter set that has no correct value below it yet,
+ *  so the window is read once for all of them.
+ * A thread stops when all parameter sets have a best value lower than
+ *  its current value or at the end of the window.
+ */
+static inline __attribute__((always_inline)) void batchLoopBody(threadArgs *args, const int countProbes) {
+	ponderContext *ctx = args->ctx;
+	int_fast64_t best, depth, tests = 0, probes = 0;
+	int j, active, res;
+
+	for (int_fast64_t index = args->threadID; index < ctx->memSize; index += ctx->numThreads) {
+		active = 0;
+		for (j = 0; j < ctx->batchSize; j++) {
+			batchState *b = &ctx->batch[j];
+			if (b->done || ((best = b->bestIndex) >= 0 && best < index))
+				continue; // this parameter set is done
+			active = 1;
+			tests++;
+			if (countProbes) {
+				depth = sequenceDepth(args->array, index, b->n, b->k);
+				probes += depthProbes(depth, b->n);
+				res = (depth == b->n);
+			} else
+				res = isCorrectSequence(args->array, index, b->n, b->k);
+			if (res) {
+				pthread_mutex_lock(&ctx->mutex);
+				if (b->bestIndex < 0 || index < b->bestIndex)
+					b->bestIndex = index;
+				pthread_mutex_unlock(&ctx->mutex);
+			}
+		}
+		if (!active)
+			break;
+		if (!(tests & 0xFFFF) && stopping(ctx)) {
+			atomic_store(&ctx->interrupted, 1);
+			break;
+		}
+	}
+	args->tests = tests;
+	args->probes = probes;
+}
+
+static void *batchLoop(void *ptr) {
+	batchLoopBody(ptr, 0);
+	return NULL;
+}
+
+static void *batchLoopCounted(void *ptr) {
+	batchLoopBody(ptr, 1);
+	return NULL;
+}
+
+static ponderStatus batch(ponderContext *ctx, const ponderBatchSet *sets, int numSets, ponderBatchFunc found) {
+	int remaining = numSets;
+
+	if (numSets <= 0 || numSets > MAX_BATCH)
+		return setError(ctx, "between 1 and %d parameter sets in a batch", MAX_BATCH);
+	ctx->span = 0;
+	for (int j = 0; j < numSets; j++) {
+		int_fast64_t span = stepSpan(sets[j].n, sets[j].k);
+		if (span < 0)
+			return setError(ctx, "the sequence span does not fit in 64 bits");
+		if (span > ctx->span)
+			ctx->span = span; // one window fits all
+		ctx->batch[j].n = sets[j].n;
+		ctx->batch[j].k = sets[j].k;
+		ctx->batch[j].bestIndex = -1;
+		ctx->batch[j].done = 0;
+	}
+	ctx->batchSize = numSets;
+	if (setupWindowEngine(ctx) == PONDER_ERROR)
+		return PONDER_ERROR;
+
+	while (remaining) {
+		if (ctx->params.endValue && ctx->offset >= ctx->params.endValue)
+			return PONDER_NOT_FOUND;
+		if (!fillArrayOfPrimes(ctx))
+			return PONDER_ERROR;
+		atomic_store(&ctx->interrupted, 0);
+		if (!runThreads(ctx, batchLoop, batchLoopCounted))
+			return PONDER_ERROR;
+		if (atomic_load(&ctx->interrupted))
+			return PONDER_CANCELLED;
+		for (int j = 0; j < numSets; j++) {
+			batchState *b = &ctx->batch[j];
+			if (b->done || b->bestIndex < 0)
+				continue;
+			b->done = 1;
+			remaining--;
+			if (found)
+				found(ctx->params.userData, j, ctx->offset + b->bestIndex);
+		}
+		if (!remaining)
+			break;
+		if (!nextWindow(ctx))
+			return PONDER_ERROR;
+		if (progress(ctx))
+			return PONDER_CANCELLED;
+	}
+	return PONDER_FOUND;
+}
+
+/*********************************************************************
+ * Point queries
+ *********************************************************************/
+
+#define DEPTH_PRIME(p) p,
+static const uint8_t depthPrimes[] = { 2, PONDER_SMALL_PRIMES(DEPTH_PRIME) };
+#undef DEPTH_PRIME
+#define NUM_DEPTH_PRIMES ((int) sizeof(depthPrimes))
+
+/* steps[i] is k*f(i) (steps[0] is 0) and stepResidues[i][j] is steps[i]
+ *  modulo depthPrimes[j]: the residues of the terms are updated with
+ *  additions only.
+ */
+struct ponderDepthEngine {
+	int_fast64_t maxDepth;
+	int_fast64_t *steps;
+	uint8_t (*stepResidues)[NUM_DEPTH_PRIMES];
+	ponder_u128 span;
+};
+
+typedef struct {
+	const ponderDepthEngine *engine;
+	const ponder_u128 *values;
+	int_fast64_t *depths;
+	int_fast64_t first, last;
+} depthChunk;
+
+ponderDepthEngine *ponderDepthCreate(int_fast64_t maxDepth, int_fast64_t k) {
+	ponderDepthEngine *engine;
+	stepState step;
+
+	if (stepSpan(maxDepth, k) < 0 || !(engine = calloc(1, sizeof(ponderDepthEngine))))
+		return NULL;
+	engine->maxDepth = maxDepth;
+	engine->span = stepSpan(maxDepth, k);
+	if (!(engine->steps = malloc(maxDepth * sizeof(int_fast64_t))) ||
+	    !(engine->stepResidues = malloc(maxDepth * sizeof(*engine->stepResidues)))) {
+		ponderDepthDestroy(engine);
+		return NULL;
+	}
+	stepInit(&step, k);
+	for (int_fast64_t i = 0; i < maxDepth; i++) {
+		engine->steps[i] = i ? stepNext(&step) : 0;
+		for (int j = 0; j < NUM_DEPTH_PRIMES; j++)
+			engine->stepResidues[i][j] = engine->steps[i] % depthPrimes[j];
+	}
+	return engine;
+}
+
+void ponderDepthDestroy(ponderDepthEngine *engine) {
+	if (!engine)
+		return;
+	free(engine->steps);
+	free(engine->stepResidues);
+	free(engine);
+}
+
+int_fast64_t ponderDepthOf(const ponderDepthEngine *engine, ponder_u128 a) {
+	uint8_t residues[NUM_DEPTH_PRIMES];
+	ponder_u128 term = a;
+	int j, divisible;
+
+	if (a > PONDER_U128_MAX - engine->span)
+		return -1;
+	for (j = 0; j < NUM_DEPTH_PRIMES; j++)
+		residues[j] = a % depthPrimes[j];
+	for (int_fast64_t i = 0; i < engine->maxDepth; i++) {
+		if (i) {
+			term += engine->steps[i];
+			for (j = 0; j < NUM_DEPTH_PRIMES; j++) {
+				residues[j] += engine->stepResidues[i][j];
+				if (residues[j] >= depthPrimes[j])
+					residues[j] -= depthPrimes[j];
+			}
+		}
+		if (term < 101 * 101) { // too small for the residues to be enough
+			if (isPrime64((uint64_t) term))
+				return i;
+			continue;
+		}
+		for (j = 0, divisible = 0; j < NUM_DEPTH_PRIMES; j++)
+			divisible |= !residues[j];
+		if (divisible)
+			continue;
+		if ((term >> 64) ? isPrime128(term) : millerRabin64((uint64_t) term))
+			return i;
+	}
+	return engine->maxDepth;
+}
+
+static void *depthBatchLoop(void *ptr) {
+	depthChunk *chunk = ptr;
+	for (int_fast64_t i = chunk->first; i < chunk->last; i++)
+		chunk->depths[i] = ponderDepthOf(chunk->engine, chunk->values[i]);
+	return NULL;
+}
+
+void ponderDepthBatch(const ponderDepthEngine *engine, const ponder_u128 *values, int_fast64_t count,
+                      int_fast64_t *depths, int numThreads) {
+	pthread_t *ID;
+	depthChunk *chunks, single;
+	int i;
+
+	if (numThreads > PONDER_MAX_THREADS)
+		numThreads = PONDER_MAX_THREADS;
+	if (numThreads > count / 64) // a query only takes microseconds
+		numThreads = count / 64;
+	if (numThreads < 1)
+		numThreads = 1;
+	ID = numThreads > 1 ? malloc(sizeof(pthread_t) * numThreads) : NULL;
+	chunks = numThreads > 1 ? malloc(sizeof(depthChunk) * numThreads) : &single;
+	if (numThreads > 1 && (!ID || !chunks)) { // one thread without memory for more
+		free(ID);
+		if (chunks != &single)
+			free(chunks);
+		ID = NULL;
+		chunks = &single;
+		numThreads = 1;
+	}
+	for (i = 0; i < numThreads; i++) {
+		chunks[i].engine = engine;
+		chunks[i].values = values;
+		chunks[i].depths = depths;
+		chunks[i].first = count * i / numThreads;
+		chunks[i].last = count * (i+1) / numThreads;
+	}
+	if (numThreads == 1)
+		depthBatchLoop(&chunks[0]);
+	else {
+		for (i = 0; i < numThreads; i++)
+			pthread_create(&ID[i], NULL, depthBatchLoop, &chunks[i]);
+		for (i = 0; i < numThreads; i++)
+			pthread_join(ID[i], NULL);
+		free(ID);
+		free(chunks);
+	}
+}
+
+/*********************************************************************
+ * Public functions
+ *********************************************************************/
+
+void ponderDefaultParams(ponderParams *params) {
+	memset(params, 0, sizeof(*params));
+	params->engine = PONDER_ENGINE_THREADED;
+	params->k = 1;
+	params->numThreads = 1;
+	params->primeCache = getenv("PONDER_PRIME_CACHE");
+}
+
+ponderContext *ponderCreate(const ponderParams *params) {
+	ponderContext *ctx = calloc(1, sizeof(ponderContext));
+
+	if (!ctx)
+		return NULL;
+	ctx->params = *params;
+	perfClear(&ctx->stats.fillPerf);
+	perfClear(&ctx->stats.testPerf);
+	perfClear(&ctx->stats.eliminatePerf);
+	if (!growThreadStats(ctx, 1)) { // Algorithm 1 and the window engine
+		free(ctx);
+		return NULL;
+	}
+	primesieve_init(&ctx->it);
+	pthread_mutex_init(&ctx->mutex, NULL);
+	pthread_cond_init(&ctx->startCond, NULL);
+	pthread_mutex_init(&ctx->queueMutex, NULL);
+	pthread_cond_init(&ctx->queueFilled, NULL);
+	pthread_cond_init(&ctx->queueFreed, NULL);
+	return ctx;
+}
+
+void ponderDestroy(ponderContext *ctx) {
+	if (!ctx)
+		return;
+	primesieve_free_iterator(&ctx->it);
+	primeCacheClose(ctx->cache);
+	pthread_mutex_destroy(&ctx->mutex);
+	pthread_cond_destroy(&ctx->startCond);
+	pthread_mutex_destroy(&ctx->queueMutex);
+	pthread_cond_destroy(&ctx->queueFilled);
+	pthread_cond_destroy(&ctx->queueFreed);
+	unmapArray(ctx);
+	unmapReplicas(ctx);
+	free(ctx->threads);
+	free(ctx->threadIDs);
+	free(ctx->stats.threads);
+	free(ctx->killers);
+	free(ctx->queue);
+	free(ctx);
+}
+
+void ponderSetParams(ponderContext *ctx, const ponderParams *params) {
+	ctx->params = *params;
+}
+
+/* Resets the search state before a search function, checks the parameters
+ *  common to all of them and sets the span of the sequence.
+ */
+static ponderStatus startSearch(ponderContext *ctx, int needSequence) {
+	ctx->error[0] = 0;
+	ctx->cancelled = 0;
+	ctx->offset = ctx->watermark = ctx->params.startValue;
+	if (ctx->params.endValue && ctx->params.endValue <= ctx->params.startValue)
+		return setError(ctx, "the end value has to be larger than the start value");
+	if (needSequence && (ctx->span = stepSpan(ctx->params.n, ctx->params.k)) < 0)
+		return setError(ctx, "the sequence span does not fit in 64 bits (or n or k is not positive)");
+	if (ctx->params.engine != PONDER_ENGINE_BACKWARD && ctx->params.engine != PONDER_ENGINE_WINDOW &&
+	    ctx->params.engine != PONDER_ENGINE_THREADED)
+		return setError(ctx, "unknown engine %d", (int) ctx->params.engine);
+	// A cache which cannot be opened is not an error, windows are then sieved
+	if (ctx->params.primeCache && *ctx->params.primeCache && !ctx->cache)
+		ctx->cache = primeCacheOpen(ctx->params.primeCache);
+	return PONDER_FOUND;
+}
+
+ponderStatus ponderSearch(ponderContext *ctx, ponder_u128 *value) {
+	struct timespec start;
+	ponderStatus status;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if ((status = startSearch(ctx, 1)) == PONDER_FOUND) {
+		if (ctx->params.engine == PONDER_ENGINE_BACKWARD)
+			status = backwardSearch(ctx, value);
+		else
+			status = windowSearch(ctx, value);
+	}
+	ctx->stats.totalSeconds += elapsed(&start);
+	return status;
+}
+
+ponderStatus ponderEnumerate(ponderContext *ctx, int_fast64_t minDepth, ponderResultFunc result,
+                             int_fast64_t *count) {
+	struct timespec start;
+	ponderStatus status;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	*count = 0;
+	if ((status = startSearch(ctx, 1)) == PONDER_FOUND) {
+		if (ctx->params.engine == PONDER_ENGINE_BACKWARD)
+			status = setError(ctx, "Algorithm 1 cannot enumerate");
+		else {
+			ctx->minDepth = minDepth;
+			ctx->result = result;
+			status = enumerate(ctx, count);
+		}
+	}
+	ctx->stats.totalSeconds += elapsed(&start);
+	return status;
+}
+
+ponderStatus ponderBatch(ponderContext *ctx, const ponderBatchSet *sets, int numSets, ponderBatchFunc found) {
+	struct timespec start;
+	ponderStatus status;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if ((status = startSearch(ctx, 0)) == PONDER_FOUND) {
+		if (ctx->params.engine == PONDER_ENGINE_BACKWARD)
+			status = setError(ctx, "Algorithm 1 cannot run a batch");
+		else
+			status = batch(ctx, sets, numSets, found);
+	}
+	ctx->stats.totalSeconds += elapsed(&start);
+	return status;
+}
+
+void ponderCancel(ponderContext *ctx) {
+	ctx->cancelled = 1;
+}
+
+ponder_u128 ponderWatermark(const ponderContext *ctx) {
+	return ctx->watermark;
+}
+
+int ponderCopyStats(ponderStats *to, const ponderStats *from) {
+	ponderThreadStats *threads = to->threads;
+
+	if (from->numThreads > 0 && !(threads = realloc(threads, sizeof(ponderThreadStats) * from->numThreads))) {
+		threads = to->threads;
+		*to = *from;
+		to->threads = threads;
+		to->numThreads = 0;
+		return 0;
+	}
+	*to = *from;
+	to->threads = threads;
+	if (from->numThreads > 0)
+		memcpy(threads, from->threads, sizeof(ponderThreadStats) * from->numThreads);
+	return 1;
+}
+
+int ponderGetStats(const ponderContext *ctx, ponderStats *stats) {
+	return ponderCopyStats(stats, &ctx->stats);
+}
+
+void ponderFreeStats(ponderStats *stats) {
+	free(stats->threads);
+	stats->threads = NULL;
+	stats->numThreads = 0;
+}
+
+const char *ponderError(const ponderContext *ctx) {
+	return ctx->error;
+}
+
+const char *ponderStepName(void) {
+	return STEP_NAME;
+}
+
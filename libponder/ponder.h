@@ -0,0 +1,267 @@
+/*********************************************************************
+ * libponder: the searches of the 'IBM Ponder this' challenge from
+ *  March 2024 as a library.
+ * See: research.ibm.com/haifa/ponderthis/challenges/March2024.html
+ *
+ * All the state of a search lives in a ponderContext, so several
+ *  searches can run at the same time in one process (one context per
+ *  search, a context being used by one caller thread at a time).
+ *  Nothing is printed and the library never exits: errors are returned
+ *  as PONDER_ERROR and described by ponderError().
+ *
+ * Typical use:
+ *	ponderParams params;
+ *	ponderContext *ctx;
+ *	ponder_u128 value;
+ *
+ *	ponderDefaultParams(&params);
+ *	params.engine = PONDER_ENGINE_THREADED;
+ *	params.n = 1000;
+ *	params.numThreads = 4;
+ *	ctx = ponderCreate(&params);
+ *	if (ponderSearch(ctx, &value) == PONDER_FOUND)
+ *		...
+ *	ponderDestroy(ctx);
+ *
+ * The step function f of a_i = a_{i-1} + k*f(i) is chosen when compiling
+ *  the library (see common/ponder_step.h), ponderStepName() tells which.
+ * It uses the primesieve library (github.com/kimwalisch/primesieve).
+ ********************************************************************/
+
+#ifndef PONDER_H
+#define PONDER_H
+
+#include <stdint.h>
+#include <signal.h>
+
+#include "../common/ponder_u128.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The most CPUs a thread can be bound to (CPU_SETSIZE of glibc) */
+#define PONDER_MAX_THREADS 1024
+
+typedef enum {
+	PONDER_ENGINE_BACKWARD = 1, /* Algorithm 1: primes rule out start values backwards */
+	PONDER_ENGINE_WINDOW,       /* Algorithm 2: each start value is tested in a window of primes */
+	PONDER_ENGINE_THREADED      /* Algorithm 3: the window is shared by several threads */
+} ponderEngine;
+
+typedef enum {
+	PONDER_FOUND = 0,           /* a correct start value has been found */
+	PONDER_NOT_FOUND,           /* none below params.endValue */
+	PONDER_CANCELLED,           /* ponderCancel(), the stop flag or the progress callback */
+	PONDER_ERROR                /* see ponderError() */
+} ponderStatus;
+
+/* Hardware counters of a phase, with params.perfCounters (Linux perf
+ *  events of the threads of the phase, user space only, see
+ *  common/ponder_perf.h). -1 for an event not available on the host.
+ */
+enum {
+	PONDER_PERF_CYCLES,
+	PONDER_PERF_INSTRUCTIONS,
+	PONDER_PERF_LLC_MISSES,     /* last level cache */
+	PONDER_PERF_DTLB_MISSES,    /* data TLB, loads */
+	PONDER_PERF_BRANCH_MISSES,
+	PONDER_PERF_NODE_LOADS,     /* loads served by memory, local or remote */
+	PONDER_PERF_NODE_MISSES,    /* loads served by the memory of another NUMA node */
+	PONDER_PERF_EVENTS
+};
+
+typedef struct {
+	int_fast64_t count[PONDER_PERF_EVENTS];
+} ponderPerfCounters;
+
+typedef struct {
+	int_fast64_t tests;         /* start values (times parameter sets) tested by the thread */
+	int_fast64_t probes;        /* terms looked up, window engines with params.detailedStats only */
+	double idleSeconds;         /* time waiting for the other threads at the end of windows */
+	ponderPerfCounters perf;    /* test phase of the thread */
+} ponderThreadStats;
+
+/* Wall and CPU times are in seconds. The test phase CPU time is the one
+ *  of the whole process (all the threads).
+ */
+typedef struct {
+	int_fast64_t windows;       /* windows (or blocks for Algorithm 1) completed */
+	int_fast64_t primes;        /* primes generated with primesieve */
+	int_fast64_t tests;         /* start values (times parameter sets) tested */
+	int_fast64_t probes;        /* terms looked up, window engines with params.detailedStats only */
+	double fillSeconds;         /* time spent filling prime windows */
+	double fillCpuSeconds;
+	double testSeconds;         /* time spent testing start values */
+	double testCpuSeconds;
+	double totalSeconds;        /* time spent in the search functions */
+	ponderPerfCounters fillPerf;      /* filling windows (caller thread) */
+	ponderPerfCounters testPerf;      /* testing start values (all the threads) */
+	ponderPerfCounters eliminatePerf; /* Algorithm 1: ruling out values backwards */
+	int numaNodes;              /* window replicas (params.numaReplicas), 0 for none */
+	int_fast64_t arrayPageSize; /* pages of the window buffer: 1 GB or 2 MB for reserved huge pages,
+	                               else the normal size (transparent huge pages may be used) */
+	int numThreads;             /* entries of 'threads' */
+	ponderThreadStats *threads; /* allocated for numThreads, see ponderGetStats() */
+} ponderStats;
+
+/* Called after each window with the value below which every start value
+ *  has been ruled out. Returning nonzero cancels the search.
+ */
+typedef int (*ponderProgressFunc)(void *userData, ponder_u128 watermark, const ponderStats *stats);
+
+/* Algorithm 1 only: called after each block with, for the next 'count'
+ *  start values, the index of the prime term which ruled each one out
+ *  (a minimality proof, see common/ponder_proof.h).
+ */
+typedef void (*ponderProofFunc)(void *userData, const uint32_t *indices, int_fast64_t count);
+
+/* ponderEnumerate(): called for each start value of depth at least
+ *  minDepth, from a single thread, in no particular order.
+ */
+typedef void (*ponderResultFunc)(void *userData, ponder_u128 value, int_fast64_t depth);
+
+/* ponderBatch(): called when parameter set 'set' gets its answer */
+typedef void (*ponderBatchFunc)(void *userData, int set, ponder_u128 value);
+
+/* Window engines only: fills array[0..size) with 1 for the primes and 0
+ *  for the other integers of [offset, offset+size), for a caller keeping
+ *  prime windows of its own. Returning 0 lets the library sieve it.
+ */
+typedef int (*ponderWindowFunc)(void *userData, ponder_u128 offset, char *array, int_fast64_t size);
+
+typedef struct {
+	ponderEngine engine;
+	int_fast64_t n;
+	int_fast64_t k;                  /* step multiplier, default 1 */
+	int_fast64_t memSize;            /* window size, 0 for the engine default */
+	int numThreads;                  /* threaded engine only, default 1 */
+	ponder_u128 startValue;
+	ponder_u128 endValue;            /* 0 for no end; see ponderSearch() */
+	volatile sig_atomic_t *stopFlag; /* optional, the search stops when it is set */
+	ponderProgressFunc progress;     /* optional */
+	ponderProofFunc proof;           /* optional, Algorithm 1 only */
+	ponderWindowFunc window;         /* optional, window engines only */
+	const char *primeCache;          /* optional prime bitmap cache file, window engines only
+	                                    (see common/ponder_primecache.h), default $PONDER_PRIME_CACHE */
+	int detailedStats;               /* counts the probes, with test loops a bit slower */
+	int perfCounters;                /* measures hardware counters, see ponderPerfCounters */
+	const int *cpus;                 /* optional, window engines: test thread i runs on CPU cpus[i]
+	                                    (numThreads entries), default wherever the system puts it */
+	int numaReplicas;                /* with cpus on several NUMA nodes: each window is copied to
+	                                    every node by its threads, which then probe the local copy */
+	void *userData;                  /* given to the callbacks */
+} ponderParams;
+
+typedef struct {
+	int_fast64_t n;
+	int_fast64_t k;
+} ponderBatchSet;
+
+typedef struct ponderContext ponderContext;
+
+/* Sets the defaults, the prime cache file being taken from the
+ *  PONDER_PRIME_CACHE environment variable.
+ */
+void ponderDefaultParams(ponderParams *params);
+
+/* Returns a new context, or NULL if memory is exhausted. Wrong parameters
+ *  are only reported when searching.
+ */
+ponderContext *ponderCreate(const ponderParams *params);
+void ponderDestroy(ponderContext *ctx);
+
+/* Changes the parameters of a context which is not searching, keeping
+ *  its memory (and statistics) for the next search.
+ */
+void ponderSetParams(ponderContext *ctx, const ponderParams *params);
+
+/* Looks for the smallest correct start value in [startValue, endValue)
+ *  and stores it in *value.
+ */
+ponderStatus ponderSearch(ponderContext *ctx, ponder_u128 *value);
+
+/* Window engines only: calls 'result' for every start value in
+ *  [startValue, endValue) whose first minDepth terms are not prime.
+ *  *count is set to the number of such values.
+ */
+ponderStatus ponderEnumerate(ponderContext *ctx, int_fast64_t minDepth, ponderResultFunc result,
+                             int_fast64_t *count);
+
+/* Window engines only: searches the answers of several parameter sets
+ *  at once (n and k of the parameters are ignored), each prime window
+ *  being filled once for all of them. 'found' is called for each one.
+ */
+ponderStatus ponderBatch(ponderContext *ctx, const ponderBatchSet *sets, int numSets, ponderBatchFunc found);
+
+/* Point queries: the depth L(a) of scattered start values a, ie: the
+ *  index of the first prime term of a, a+k*f(1)... or maxDepth if none of
+ *  the first maxDepth terms is prime (the depth of ponderEnumerate()).
+ *  No window is sieved: the terms are tested one after the other, most
+ *  of them being ruled out by their residues modulo the primes below 100
+ *  and the others tested with Miller-Rabin, so a query costs a few
+ *  microseconds. An engine is read only once created and can be used by
+ *  several threads at the same time.
+ */
+typedef struct ponderDepthEngine ponderDepthEngine;
+
+/* Returns NULL if maxDepth or k is wrong or memory is exhausted */
+ponderDepthEngine *ponderDepthCreate(int_fast64_t maxDepth, int_fast64_t k);
+void ponderDepthDestroy(ponderDepthEngine *engine);
+
+/* Returns L(a), or -1 if the terms go past 2^128 */
+int_fast64_t ponderDepthOf(const ponderDepthEngine *engine, ponder_u128 a);
+
+/* depths[i] = L(values[i]) for 'count' values, with up to numThreads threads */
+void ponderDepthBatch(const ponderDepthEngine *engine, const ponder_u128 *values, int_fast64_t count,
+                      int_fast64_t *depths, int numThreads);
+
+/* Can be called from any thread (or a signal handler): the running
+ *  search stops as soon as possible and returns PONDER_CANCELLED.
+ */
+void ponderCancel(ponderContext *ctx);
+
+/* Every start value below it has been ruled out (after a search, even
+ *  cancelled, this is where to resume from).
+ */
+ponder_u128 ponderWatermark(const ponderContext *ctx);
+
+/* Copies the statistics of a context, or of another copy. The thread
+ *  statistics of 'stats' are (re)allocated: it has to be zeroed before its
+ *  first use and freed with ponderFreeStats(). Returns 0 if they cannot be
+ *  allocated (stats->numThreads is then 0). The statistics given to the
+ *  progress callback belong to the context.
+ */
+int ponderGetStats(const ponderContext *ctx, ponderStats *stats);
+int ponderCopyStats(ponderStats *to, const ponderStats *from);
+void ponderFreeStats(ponderStats *stats);
+const char *ponderError(const ponderContext *ctx);
+const char *ponderStepName(void);
+
+/* Timeline tracing, process wide and off by default. Once started, the
+ *  searches record their phases (window fill, elimination, test of each
+ *  thread, wait at the end of the window) as time intervals, in a ring
+ *  buffer per lane keeping the last 'eventsPerLane' events. Lane 0 is the
+ *  thread calling the search, lane i+1 test thread i. The caller can add
+ *  its own events (verification, checkpoints...) with ponderTraceEvent().
+ * Only one traced search at a time: a lane is written by one thread.
+ */
+#define PONDER_TRACE_LANES (PONDER_MAX_THREADS + 1)
+
+int ponderTraceStart(int_fast64_t eventsPerLane);   /* 0 on failure */
+uint64_t ponderTraceClock(void);                    /* nanoseconds, for ponderTraceEvent() */
+/* Records 'name' from 'start' (a ponderTraceClock() value) to now, with the
+ *  index of the window as argument (-1 for none); does nothing if tracing
+ *  is off. 'name' has to stay valid until ponderTraceWrite().
+ */
+void ponderTraceEvent(int lane, const char *name, uint64_t start, int_fast64_t arg);
+/* Writes the events in the Chrome trace event format (JSON), for
+ *  chrome://tracing or Perfetto. Returns 0 on failure.
+ */
+int ponderTraceWrite(const char *fileName);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PONDER_H */